@@ -2,6 +2,7 @@
 #define EXTERNAL_SORT_H
 
 #include <stdint.h>
+#include <string.h>
 #include "file/ion_file.h"
 
 #if defined(__cplusplus)
@@ -17,6 +18,21 @@ typedef struct {
     uint16_t    num_values_last_page;
     int8_t      headerSize;
     int8_t      (*compare_fcn)(void *a, void *b);
+    int8_t      run_gen_algorithm;          /* Run generation strategy RUN_GEN_* (default RUN_GEN_REPLACEMENT_SELECTION) */
+    int8_t      key_type;                   /* KEY_TYPE_* of key at key_offset. Used by key_prefix_compare and the input profile. */
+    int8_t      (*output_sink)(void *state, void *block);   /* If not NULL, receives each sorted output block (with header) of final merge pass rather than writing to file. Returns 0 if success. */
+    void        *output_sink_state;
+    int8_t      heap_arity;                 /* Children per node of replacement selection heap: 0 (default binary heap built by insertion), or 2, 4, 8 (heap built bottom-up) */
+    int8_t      key_prefix_compare;         /* If 1, heap and merge compare keys of key_type at key_offset directly and only call compare_fcn on ties. 0 (default) always calls compare_fcn. */
+    uint16_t    key_offset;                 /* Offset of key in record for key_prefix_compare. */
+    int8_t      presorted_fast_path;        /* If 1, replacement selection first writes input blocks directly as a sublist while they continue sorted order. A new sublist starts at the first block out of order. */
+    int32_t     max_disorder;               /* Most positions a record is out of place in input. If > 0, replacement selection heap holds this many records (at most buffer) and input is one sublist. EXTERNAL_SORT_ESTIMATE_DISORDER estimates it from first block. 0 (default) heap uses buffer. */
+    int8_t      two_way_runs;               /* If 1, replacement selection builds each sublist ascending or descending following the input trend. Descending sublists are merged from their last block. 0 (default) all ascending. */
+    int8_t      run_descending;             /* Run state. Set by run generation in the sort's copy of es while it builds a descending sublist. Comparisons are reversed. Caller's value is not used. */
+    int8_t      profile_blocks;             /* If > 0, samples this many input blocks (at most the buffer less one block) into the buffer before sorting and chooses run_gen_algorithm, presorted_fast_path, two_way_runs, in_memory_algorithm, and merge_fan_in from the sample in place of these settings. es is not changed. Plan is reported in metrics_t. 0 (default) no sampling. */
+    int8_t      in_memory_algorithm;        /* IN_MEMORY_SORT_* used to sort blocks in run generation. 0 (default) quicksort. Radix sort requires an integer key at offset 0 and a buffer of 3 or more blocks. It uses the last buffer block as scratch so run generation has one block less. Quicksort is used with 2 blocks. */
+    int16_t     merge_fan_in;               /* Most sublists merged at once. 0 (default) one per buffer block. */
+    char        *radix_scratch;             /* Run state. Set by the sort in its copy of es to the buffer block radix sort uses as scratch. Caller's value is not used. */
 } external_sort_t;
 
 typedef struct {
@@ -27,6 +43,19 @@ typedef struct {
     uint32_t num_runs;
     double time;
     uint32_t genTime;
+    uint32_t stallTime;     /* Microseconds merge waited for reads. Only measured by host files. */
+    uint32_t deviceTime;    /* Predicted microseconds the storage device was busy during the sort, including reading input on the same device. Only measured by simulated device files (host_sim_backend). */
+    uint32_t disorder_violations;   /* Sublists replacement selection started because input was more out of order than es->max_disorder. 0 if input kept the bound or max_disorder is 0. */
+    /* Input profile and sort plan. Profile fields and predictions are only set if es->profile_blocks > 0, otherwise 0. */
+    uint8_t  profile_sorted_pct;        /* Percent of adjacent sample records in ascending order (equal counts as in order) */
+    uint8_t  profile_reverse_pct;       /* Percent of adjacent sample records in descending order (equal counts as in order) */
+    uint8_t  profile_duplicate_pct;     /* Percent of sample records equal to an earlier sample record */
+    uint16_t profile_key_bits;          /* Bits spanned by range of sample keys for integer key types. Key size in bits for other key types. */
+    int8_t   plan_run_gen;              /* RUN_GEN_* used */
+    int8_t   plan_in_memory_algorithm;  /* IN_MEMORY_SORT_* used to sort blocks */
+    int16_t  plan_fan_in;               /* Most sublists merged at once */
+    uint32_t predicted_runs;            /* Predicted sublists after run generation. 0 if input size es->num_pages is unknown. */
+    uint32_t predicted_io;              /* Predicted reads plus writes. 0 if input size es->num_pages is unknown. */
 } metrics_t;
 
 typedef struct {
@@ -41,11 +70,102 @@ typedef struct {
 	uint32_t recordSize;
 } file_iterator_state_t;
 
+typedef struct {
+	const char *records;				/* Records in memory such as a file mapped with host_fmap() */
+	uint32_t recordsRead;
+	uint32_t totalRecords;
+	uint32_t recordSize;
+} mapped_iterator_state_t;
+
 /* Constant declarations */
 #define    BLOCK_HEADER_SIZE    sizeof(int32_t)+sizeof(int16_t)
 #define    BLOCK_ID_OFFSET      0
 #define    BLOCK_COUNT_OFFSET   sizeof(uint32_t)
 
+/* Run generation algorithms. Merge run generation requires a buffer of 2 blocks otherwise replacement selection is used.
+   Index replacement selection orders record slot indices in its heap so records are only copied when output. Its heap of 2 bytes
+   per record shares the heap blocks with the records, so it holds (M-1)*page_size/(record_size+2) records instead of
+   (M-1) full blocks and may produce more, shorter runs than replacement selection.
+   Load-sort-store sorts the whole buffer at a time so sublists are the buffer size. Natural runs sorts one block at a time and
+   continues a sublist while blocks are in order so it only uses one block. All write the same sublist format for the merge. */
+#define    RUN_GEN_REPLACEMENT_SELECTION    0
+#define    RUN_GEN_MERGE                    1
+#define    RUN_GEN_REPLACEMENT_SELECTION_INDEX  2
+#define    RUN_GEN_LOAD_SORT_STORE          3
+#define    RUN_GEN_NATURAL_RUNS             4
+
+/* max_disorder value to estimate bound from first input block. If input exceeds the bound, sort still succeeds by merging sublists (metrics_t num_runs > 1). */
+#define    EXTERNAL_SORT_ESTIMATE_DISORDER  -1
+
+/* Key types. KEY_TYPE_OTHER (default) only orders keys using compare_fcn. */
+#define    KEY_TYPE_OTHER                   0
+#define    KEY_TYPE_INT32                   1
+#define    KEY_TYPE_UINT32                  2
+#define    KEY_TYPE_INT64                   3
+#define    KEY_TYPE_BYTES                   4       /* Unsigned byte string of key_size bytes. Prefix compare uses first KEY_PREFIX_BYTES bytes. */
+
+#define    KEY_PREFIX_BYTES                 8
+
+/* Prefix of sort functions that take an external_sort_t. Empty in C. no_output_buffer_sort_template.h redefines it to make
+   them templates on a record layout with compile-time sizes and comparator. */
+#if !defined(EXTERNAL_SORT_TEMPLATE)
+#define    EXTERNAL_SORT_TEMPLATE
+#endif
+
+/**
+ * Compares the order-preserving prefix of keys of type key_type at a and b. Returns 0 if prefixes are equal or key type is KEY_TYPE_OTHER.
+ */
+static inline int8_t external_sort_compare_prefix(void *a, void *b, int8_t key_type, uint16_t key_size)
+{
+    switch (key_type)
+    {
+        case KEY_TYPE_INT32:
+        {
+            int32_t x, y;
+            memcpy(&x, a, sizeof(int32_t));
+            memcpy(&y, b, sizeof(int32_t));
+            return (int8_t) ((x > y) - (x < y));
+        }
+        case KEY_TYPE_UINT32:
+        {
+            uint32_t x, y;
+            memcpy(&x, a, sizeof(uint32_t));
+            memcpy(&y, b, sizeof(uint32_t));
+            return (int8_t) ((x > y) - (x < y));
+        }
+        case KEY_TYPE_INT64:
+        {
+            int64_t x, y;
+            memcpy(&x, a, sizeof(int64_t));
+            memcpy(&y, b, sizeof(int64_t));
+            return (int8_t) ((x > y) - (x < y));
+        }
+        case KEY_TYPE_BYTES:
+        {
+            int c = memcmp(a, b, key_size < KEY_PREFIX_BYTES ? key_size : KEY_PREFIX_BYTES);
+            return (int8_t) ((c > 0) - (c < 0));
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compares records a and b. Uses key prefix if key_prefix_compare is set and calls compare_fcn only if prefixes are equal.
+ * Order is reversed while run generation builds a descending sublist.
+ */
+static inline int8_t external_sort_compare(void *a, void *b, external_sort_t *es)
+{
+    int8_t c = 0;
+
+    if (es->key_prefix_compare)
+        c = external_sort_compare_prefix((char*) a + es->key_offset, (char*) b + es->key_offset, es->key_type, es->key_size);
+    if (c == 0)
+        c = es->compare_fcn(a, b);
+    if (es->run_descending)
+        return (int8_t) ((c < 0) - (c > 0));
+    return c;
+}
+
 
 #if defined(__cplusplus)
 }
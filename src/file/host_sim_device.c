@@ -0,0 +1,262 @@
+/******************************************************************************/
+/**
+@file		host_sim_device.c
+@author		IonDB Project Contributors
+@brief		Simulated SD card or flash storage device for host files.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+/* Implementation uses the real stdio functions rather than the intercepted ones */
+#define ION_HOST_FILE_IMPL
+
+#include "host_sim_device.h"
+
+#if defined(ION_HOST_FILE) && !defined(ARDUINO)
+
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+host_sim_device_t host_sim_device = {
+	NULL, 512, 1000, 1500, 300, 16384, 3000, 32768, 2500, 0, 0, 0, 0, 0, 0, 0
+};
+
+/**
+@brief		A file on the simulated device.
+*/
+typedef struct host_sim_file {
+	const host_file_backend_t	*storage;
+	void						*handle;		/**< Storage backend handle. */
+	int32_t						id;				/**< Distinguishes files for seeks and erases. */
+	uint32_t					clusters;		/**< Clusters allocated to file. */
+} host_sim_file_t;
+
+static pthread_mutex_t	host_sim_lock			= PTHREAD_MUTEX_INITIALIZER;	/* Protects device state. Files are accessed by prefetch and write-behind threads. */
+static int32_t			host_sim_next_id		= 0;
+static int32_t			host_sim_last_id		= -1;	/* File of previous access. -1 if none. */
+static long				host_sim_last_page		= 0;	/* Last page of previous access */
+static int32_t			host_sim_write_id		= -1;	/* File of previous write. -1 if none. */
+static long				host_sim_erase_block	= 0;	/* Erase block of end of previous write */
+
+void
+host_sim_reset(
+	void
+) {
+	pthread_mutex_lock(&host_sim_lock);
+	host_sim_device.time		= 0;
+	host_sim_device.page_reads	= 0;
+	host_sim_device.page_writes = 0;
+	host_sim_device.seeks		= 0;
+	host_sim_device.erases		= 0;
+	host_sim_device.clusters	= 0;
+	host_sim_last_id			= -1;
+	host_sim_write_id			= -1;
+	pthread_mutex_unlock(&host_sim_lock);
+}
+
+/**
+@brief		Adds the device time of an access of @p size bytes at @p offset to the device totals.
+			Waits for the time if the device delays accesses.
+*/
+static void
+host_sim_charge(
+	host_sim_file_t *file,
+	long			offset,
+	size_t			size,
+	int8_t			write
+) {
+	host_sim_device_t	*device		= &host_sim_device;
+	long				pageSize	= device->page_size > 0 ? (long) device->page_size : 1;
+	long				end			= offset + (long) size;
+	long				first		= offset / pageSize;
+	long				last		= (end - 1) / pageSize;
+	unsigned long		pages		= (unsigned long) (last - first + 1);
+	unsigned long		time;
+
+	if (0 == size) {
+		return;
+	}
+
+	pthread_mutex_lock(&host_sim_lock);
+	time = pages * (write ? device->write_us : device->read_us);
+
+	if ((file->id != host_sim_last_id) || ((first != host_sim_last_page) && (first != host_sim_last_page + 1))) {
+		time += device->seek_us;
+		device->seeks++;
+	}
+
+	host_sim_last_id	= file->id;
+	host_sim_last_page	= last;
+
+	if (write) {
+		device->page_writes += pages;
+
+		if (device->erase_block_size > 0) {
+			if ((file->id != host_sim_write_id) || (offset / (long) device->erase_block_size != host_sim_erase_block)) {
+				time += device->erase_us;
+				device->erases++;
+			}
+
+			host_sim_write_id		= file->id;
+			host_sim_erase_block	= (end - 1) / (long) device->erase_block_size;
+		}
+
+		if (device->cluster_size > 0) {
+			uint32_t clusters = (uint32_t) ((end + (long) device->cluster_size - 1) / (long) device->cluster_size);
+
+			if (clusters > file->clusters) {
+				time				+= (clusters - file->clusters) * device->cluster_us;
+				device->clusters	+= clusters - file->clusters;
+				file->clusters		= clusters;
+			}
+		}
+	}
+	else {
+		device->page_reads += pages;
+	}
+
+	device->time += time;
+	pthread_mutex_unlock(&host_sim_lock);
+
+	if (device->delay) {
+		struct timespec ts;
+
+		ts.tv_sec	= (time_t) (time / 1000000UL);
+		ts.tv_nsec	= (long) (time % 1000000UL) * 1000L;
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void *
+host_sim_open(
+	const char	*filename,
+	const char	*mode
+) {
+	host_sim_file_t *file = calloc(1, sizeof(host_sim_file_t));
+
+	if (NULL == file) {
+		return NULL;
+	}
+
+	file->storage	= NULL != host_sim_device.storage ? host_sim_device.storage : &host_ram_backend;
+	file->handle	= file->storage->open(filename, mode);
+
+	if (NULL == file->handle) {
+		free(file);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&host_sim_lock);
+	file->id = host_sim_next_id++;
+
+	if (host_sim_device.cluster_size > 0) {
+		file->clusters = (uint32_t) ((file->storage->length(file->handle) + (long) host_sim_device.cluster_size - 1) / (long) host_sim_device.cluster_size);
+	}
+
+	pthread_mutex_unlock(&host_sim_lock);
+	return file;
+}
+
+static int
+host_sim_close(
+	void *handle
+) {
+	host_sim_file_t *file	= (host_sim_file_t *) handle;
+	int				result	= file->storage->close(file->handle);
+
+	free(file);
+	return result;
+}
+
+static size_t
+host_sim_read_at(
+	void	*handle,
+	long	offset,
+	void	*buffer,
+	size_t	size
+) {
+	host_sim_file_t *file	= (host_sim_file_t *) handle;
+	size_t			read	= file->storage->read_at(file->handle, offset, buffer, size);
+
+	host_sim_charge(file, offset, read, 0);
+	return read;
+}
+
+static size_t
+host_sim_write_at(
+	void		*handle,
+	long		offset,
+	const void	*buffer,
+	size_t		size
+) {
+	host_sim_file_t *file		= (host_sim_file_t *) handle;
+	size_t			written		= file->storage->write_at(file->handle, offset, buffer, size);
+
+	host_sim_charge(file, offset, written, 1);
+	return written;
+}
+
+static int
+host_sim_flush(
+	void *handle
+) {
+	host_sim_file_t *file = (host_sim_file_t *) handle;
+
+	return file->storage->flush(file->handle);
+}
+
+static long
+host_sim_length(
+	void *handle
+) {
+	host_sim_file_t *file = (host_sim_file_t *) handle;
+
+	return file->storage->length(file->handle);
+}
+
+static unsigned long
+host_sim_device_time(
+	void *handle
+) {
+	unsigned long time;
+
+	(void) handle;
+	pthread_mutex_lock(&host_sim_lock);
+	time = host_sim_device.time;
+	pthread_mutex_unlock(&host_sim_lock);
+	return time;
+}
+
+const host_file_backend_t host_sim_backend = {
+	host_sim_open, host_sim_close, host_sim_read_at, host_sim_write_at, host_sim_flush, host_sim_length, host_sim_device_time, NULL, NULL, NULL
+};
+
+#endif /* Clause ION_HOST_FILE */
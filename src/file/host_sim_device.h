@@ -0,0 +1,105 @@
+/******************************************************************************/
+/**
+@file		host_sim_device.h
+@author		IonDB Project Contributors
+@brief		Simulated SD card or flash storage device for host files.
+@details	host_sim_backend stores data using another backend (RAM or stdio
+			files) and adds the time the device would take for each access:
+			a latency per page read or written, a seek penalty for an access
+			that does not continue the previous one, an erase when writes move
+			to another erase block, and a FAT cluster allocation when a file
+			grows. Sort performance on a device can then be predicted on a host.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(HOST_SIM_DEVICE_H_)
+#define HOST_SIM_DEVICE_H_
+
+#if defined(ION_HOST_FILE) && !defined(ARDUINO)
+
+#include <stdint.h>
+#include "host_stdio_c_iface.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief		Latencies of the simulated device and totals since host_sim_reset().
+			All files opened with host_sim_backend are on the one device.
+			Defaults are rough figures for an SD card in SPI mode on an 8-bit AVR.
+			Measure the card used and set them before opening files.
+*/
+typedef struct host_sim_device {
+	const host_file_backend_t	*storage;			/**< Backend storing the data. @c NULL is host_ram_backend. */
+	uint16_t					page_size;			/**< Bytes per device page. Each page an access touches is charged. */
+	unsigned long				read_us;			/**< Microseconds to read a page. */
+	unsigned long				write_us;			/**< Microseconds to write a page. */
+	unsigned long				seek_us;			/**< Added to an access that does not continue at the page of the previous access. */
+	uint32_t					erase_block_size;	/**< Bytes per erase block. @c 0 if writes are not charged for erases. */
+	unsigned long				erase_us;			/**< Added to a write that starts in another erase block than the previous write. */
+	uint32_t					cluster_size;		/**< Bytes per FAT cluster. @c 0 if file growth is not charged. */
+	unsigned long				cluster_us;			/**< Added per cluster allocated when a write extends a file. */
+	int8_t						delay;				/**< If @c 1, accesses also wait for their time so prefetch and write-behind overlap is real. */
+	unsigned long				time;				/**< Predicted microseconds the device was busy. */
+	unsigned long				page_reads;
+	unsigned long				page_writes;
+	unsigned long				seeks;
+	unsigned long				erases;
+	unsigned long				clusters;			/**< Clusters allocated. */
+} host_sim_device_t;
+
+/**
+@brief		The simulated device.
+*/
+extern host_sim_device_t host_sim_device;
+
+/**
+@brief		Backend of files on the simulated device. Select it with host_set_backend().
+			host_fdevicetime() returns host_sim_device.time.
+*/
+extern const host_file_backend_t host_sim_backend;
+
+/**
+@brief		Sets totals of the simulated device to @c 0 and forgets the previous access.
+*/
+void
+host_sim_reset(
+	void
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* Clause ION_HOST_FILE */
+
+#endif
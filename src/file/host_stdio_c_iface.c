@@ -0,0 +1,1604 @@
+/******************************************************************************/
+/**
+@file		host_stdio_c_iface.c
+@author		IonDB Project Contributors
+@brief		This code contains implementations for stdio.h file functions
+			for PC hosts with read-ahead prefetching.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+/* Implementation uses the real stdio functions rather than the intercepted ones */
+#define ION_HOST_FILE_IMPL
+
+/* O_DIRECT */
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "host_stdio_c_iface.h"
+
+#if defined(ION_HOST_FILE) && !defined(ARDUINO)
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static int8_t host_prefetch_enabled = 1;
+static const host_file_backend_t *host_backend = NULL;		/* Backend of files opened next. NULL is host_posix_backend. */
+
+/**
+@brief		Returns a monotonic time in microseconds.
+*/
+static unsigned long
+host_micros(
+) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long) ts.tv_sec * 1000000UL + (unsigned long) (ts.tv_nsec / 1000);
+}
+
+/* ==================== stdio backend ==================== */
+
+static void *
+host_stdio_open(
+	const char	*filename,
+	const char	*mode
+) {
+	return fopen(filename, mode);
+}
+
+static int
+host_stdio_close(
+	void *handle
+) {
+	return fclose((FILE *) handle);
+}
+
+static size_t
+host_stdio_read_at(
+	void	*handle,
+	long	offset,
+	void	*buffer,
+	size_t	size
+) {
+	if (0 != fseek((FILE *) handle, offset, SEEK_SET)) {
+		return 0;
+	}
+
+	return fread(buffer, 1, size, (FILE *) handle);
+}
+
+static size_t
+host_stdio_write_at(
+	void		*handle,
+	long		offset,
+	const void	*buffer,
+	size_t		size
+) {
+	if (0 != fseek((FILE *) handle, offset, SEEK_SET)) {
+		return 0;
+	}
+
+	return fwrite(buffer, 1, size, (FILE *) handle);
+}
+
+static int
+host_stdio_flush(
+	void *handle
+) {
+	return fflush((FILE *) handle);
+}
+
+static long
+host_stdio_length(
+	void *handle
+) {
+	if (0 != fseek((FILE *) handle, 0, SEEK_END)) {
+		return 0;
+	}
+
+	return ftell((FILE *) handle);
+}
+
+const host_file_backend_t host_stdio_backend = {
+	host_stdio_open, host_stdio_close, host_stdio_read_at, host_stdio_write_at, host_stdio_flush, host_stdio_length, NULL, NULL, NULL, NULL
+};
+
+/* ==================== POSIX backend ==================== */
+
+/**
+@brief		A file of the POSIX backends.
+*/
+typedef struct host_posix_file {
+	int		fd;
+	int		direct_fd;		/**< Descriptor opened with O_DIRECT. -1 if not used. */
+	char	*bounce;		/**< Aligned copy of a direct access whose memory is not aligned. */
+	size_t	bounce_size;
+} host_posix_file_t;
+
+int
+host_open_flags(
+	const char *mode
+) {
+	int flags = NULL != strchr(mode, '+') ? O_RDWR : ('r' == mode[0] ? O_RDONLY : O_WRONLY);
+
+	if ('w' == mode[0]) {
+		flags |= O_CREAT | O_TRUNC;
+	}
+	else if ('a' == mode[0]) {
+		flags |= O_CREAT;
+	}
+
+	return flags;
+}
+
+/**
+@brief		Opens a file with open() flags for a stdio mode. With @p direct, also opens it with O_DIRECT
+			if the file system supports it.
+*/
+static void *
+host_posix_open_file(
+	const char	*filename,
+	const char	*mode,
+	int8_t		direct
+) {
+	host_posix_file_t	*file = calloc(1, sizeof(host_posix_file_t));
+	int					flags = host_open_flags(mode);
+
+	if (NULL == file) {
+		return NULL;
+	}
+
+	file->fd		= open(filename, flags, 0666);
+	file->direct_fd = -1;
+
+	if (-1 == file->fd) {
+		free(file);
+		return NULL;
+	}
+
+#if defined(O_DIRECT)
+	if (direct) {
+		file->direct_fd = open(filename, (flags & ~(O_CREAT | O_TRUNC)) | O_DIRECT);
+	}
+#else
+	(void) direct;
+#endif
+
+	return file;
+}
+
+static void *
+host_posix_open(
+	const char	*filename,
+	const char	*mode
+) {
+	return host_posix_open_file(filename, mode, 0);
+}
+
+static void *
+host_direct_open(
+	const char	*filename,
+	const char	*mode
+) {
+	return host_posix_open_file(filename, mode, 1);
+}
+
+static int
+host_posix_close(
+	void *handle
+) {
+	host_posix_file_t	*file	= (host_posix_file_t *) handle;
+	int					result	= close(file->fd);
+
+	if (-1 != file->direct_fd) {
+		close(file->direct_fd);
+	}
+
+	free(file->bounce);
+	free(file);
+	return 0 == result ? 0 : EOF;
+}
+
+/**
+@brief		Returns the descriptor of an access. The O_DIRECT descriptor is used if the offset and size are
+			aligned to HOST_DIRECT_ALIGNMENT. Sets @p *bounce to an aligned buffer of @p size bytes if the memory
+			is not aligned, or @c NULL.
+*/
+static int
+host_posix_fd(
+	host_posix_file_t	*file,
+	long				offset,
+	const void			*buffer,
+	size_t				size,
+	char				**bounce
+) {
+	*bounce = NULL;
+
+	if ((-1 == file->direct_fd) || (0 != offset % HOST_DIRECT_ALIGNMENT) || (0 != size % HOST_DIRECT_ALIGNMENT)) {
+		return file->fd;
+	}
+
+	if (0 != (uintptr_t) buffer % HOST_DIRECT_ALIGNMENT) {
+		if (size > file->bounce_size) {
+			void *aligned;
+
+			if (0 != posix_memalign(&aligned, HOST_DIRECT_ALIGNMENT, size)) {
+				return file->fd;
+			}
+
+			free(file->bounce);
+			file->bounce		= aligned;
+			file->bounce_size	= size;
+		}
+
+		*bounce = file->bounce;
+	}
+
+	return file->direct_fd;
+}
+
+static size_t
+host_posix_read_at(
+	void	*handle,
+	long	offset,
+	void	*buffer,
+	size_t	size
+) {
+	host_posix_file_t	*file	= (host_posix_file_t *) handle;
+	size_t				done	= 0;
+	char				*bounce;
+	int					fd		= host_posix_fd(file, offset, buffer, size, &bounce);
+	char				*to		= NULL != bounce ? bounce : (char *) buffer;
+	ssize_t				n;
+
+	while (done < size) {
+		n = pread(fd, to + done, size - done, offset + (long) done);
+
+		if ((n < 0) && (EINTR == errno)) {
+			continue;
+		}
+
+		if ((n < 0) && (EINVAL == errno) && (fd == file->direct_fd)) {
+			/* File system does not allow this direct access. Use the page cache from now on. */
+			close(file->direct_fd);
+			file->direct_fd = -1;
+			fd				= file->fd;
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+	if (NULL != bounce) {
+		memcpy(buffer, bounce, done);
+	}
+
+	return done;
+}
+
+static size_t
+host_posix_write_at(
+	void		*handle,
+	long		offset,
+	const void	*buffer,
+	size_t		size
+) {
+	host_posix_file_t	*file	= (host_posix_file_t *) handle;
+	size_t				done	= 0;
+	char				*bounce;
+	int					fd		= host_posix_fd(file, offset, buffer, size, &bounce);
+	const char			*from	= (const char *) buffer;
+	ssize_t				n;
+
+	if (NULL != bounce) {
+		memcpy(bounce, buffer, size);
+		from = bounce;
+	}
+
+	while (done < size) {
+		n = pwrite(fd, from + done, size - done, offset + (long) done);
+
+		if ((n < 0) && (EINTR == errno)) {
+			continue;
+		}
+
+		if ((n < 0) && (EINVAL == errno) && (fd == file->direct_fd)) {
+			close(file->direct_fd);
+			file->direct_fd = -1;
+			fd				= file->fd;
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+	return done;
+}
+
+static int
+host_posix_flush(
+	void *handle
+) {
+	/* Writes are not buffered in the process */
+	(void) handle;
+	return 0;
+}
+
+static long
+host_posix_length(
+	void *handle
+) {
+	struct stat st;
+
+	if (0 != fstat(((host_posix_file_t *) handle)->fd, &st)) {
+		return 0;
+	}
+
+	return (long) st.st_size;
+}
+
+static int
+host_posix_advise(
+	void	*handle,
+	long	offset,
+	long	size,
+	int		advice
+) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+	static const int advices[] = { POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED };
+
+	return posix_fadvise(((host_posix_file_t *) handle)->fd, offset, size, advices[advice]);
+#else
+	(void) handle;
+	(void) offset;
+	(void) size;
+	(void) advice;
+	return 0;
+#endif
+}
+
+const host_file_backend_t host_posix_backend = {
+	host_posix_open, host_posix_close, host_posix_read_at, host_posix_write_at, host_posix_flush, host_posix_length, NULL, host_posix_advise, NULL, NULL
+};
+
+const host_file_backend_t host_direct_backend = {
+	host_direct_open, host_posix_close, host_posix_read_at, host_posix_write_at, host_posix_flush, host_posix_length, NULL, host_posix_advise, NULL, NULL
+};
+
+/* ==================== mmap backend ==================== */
+
+/**
+@brief		A file of the mmap backend.
+*/
+typedef struct host_mmap_file {
+	int		fd;
+	int		writable;
+	char	*map;			/**< Mapping of capacity bytes. NULL if nothing is mapped. */
+	size_t	capacity;		/**< Bytes of the file and of the mapping. */
+	long	length;			/**< Bytes of data. The file is cut to this length when closed. */
+} host_mmap_file_t;
+
+/**
+@brief		Grows the file and its mapping to hold @p end bytes.
+@returns	@c 0 on success, non-zero otherwise.
+*/
+static int
+host_mmap_reserve(
+	host_mmap_file_t	*file,
+	size_t				end
+) {
+	size_t	page		= (size_t) sysconf(_SC_PAGESIZE);
+	size_t	capacity	= 2 * file->capacity;
+	void	*map;
+
+	if (end <= file->capacity) {
+		return 0;
+	}
+
+	if (capacity < end) {
+		capacity = end;
+	}
+
+	if (capacity < (size_t) HOST_MMAP_GROWTH) {
+		capacity = (size_t) HOST_MMAP_GROWTH;
+	}
+
+	capacity = (capacity + page - 1) / page * page;
+
+	if (0 != ftruncate(file->fd, (off_t) capacity)) {
+		return 1;
+	}
+
+#if defined(MREMAP_MAYMOVE)
+	map = NULL == file->map ? mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0) : mremap(file->map, file->capacity, capacity, MREMAP_MAYMOVE);
+#else
+	if (NULL != file->map) {
+		munmap(file->map, file->capacity);
+	}
+
+	map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+#endif
+
+	if (MAP_FAILED == map) {
+		/* mremap() keeps the old mapping if it fails */
+#if !defined(MREMAP_MAYMOVE)
+		file->map		= NULL;
+		file->capacity	= 0;
+#endif
+		return 1;
+	}
+
+	file->map		= map;
+	file->capacity	= capacity;
+	return 0;
+}
+
+static void *
+host_mmap_open(
+	const char	*filename,
+	const char	*mode
+) {
+	host_mmap_file_t	*file = calloc(1, sizeof(host_mmap_file_t));
+	int					flags = host_open_flags(mode);
+	struct stat			st;
+
+	if (NULL == file) {
+		return NULL;
+	}
+
+	/* A shared writable mapping needs read access */
+	file->writable = O_RDONLY != (flags & O_ACCMODE);
+
+	if (file->writable) {
+		flags = (flags & ~O_ACCMODE) | O_RDWR;
+	}
+
+	file->fd = open(filename, flags, 0666);
+
+	if ((-1 == file->fd) || (0 != fstat(file->fd, &st))) {
+		if (-1 != file->fd) {
+			close(file->fd);
+		}
+
+		free(file);
+		return NULL;
+	}
+
+	file->length	= (long) st.st_size;
+	file->capacity	= (size_t) st.st_size;
+
+	if (file->capacity > 0) {
+		file->map = mmap(NULL, file->capacity, file->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file->fd, 0);
+
+		if (MAP_FAILED == file->map) {
+			close(file->fd);
+			free(file);
+			return NULL;
+		}
+	}
+
+	return file;
+}
+
+static int
+host_mmap_close(
+	void *handle
+) {
+	host_mmap_file_t	*file	= (host_mmap_file_t *) handle;
+	int					result	= 0;
+
+	if (NULL != file->map) {
+		munmap(file->map, file->capacity);
+	}
+
+	if (file->writable && (file->capacity != (size_t) file->length) && (0 != ftruncate(file->fd, (off_t) file->length))) {
+		result = EOF;
+	}
+
+	if (0 != close(file->fd)) {
+		result = EOF;
+	}
+
+	free(file);
+	return result;
+}
+
+static size_t
+host_mmap_read_at(
+	void	*handle,
+	long	offset,
+	void	*buffer,
+	size_t	size
+) {
+	host_mmap_file_t *file = (host_mmap_file_t *) handle;
+
+	if (offset >= file->length) {
+		return 0;
+	}
+
+	if (size > (size_t) (file->length - offset)) {
+		size = (size_t) (file->length - offset);
+	}
+
+	memcpy(buffer, file->map + offset, size);
+	return size;
+}
+
+static size_t
+host_mmap_write_at(
+	void		*handle,
+	long		offset,
+	const void	*buffer,
+	size_t		size
+) {
+	host_mmap_file_t *file = (host_mmap_file_t *) handle;
+
+	if (!file->writable || (0 != host_mmap_reserve(file, (size_t) offset + size))) {
+		return 0;
+	}
+
+	memcpy(file->map + offset, buffer, size);
+
+	if (offset + (long) size > file->length) {
+		file->length = offset + (long) size;
+	}
+
+	return size;
+}
+
+static int
+host_mmap_flush(
+	void *handle
+) {
+	/* Writes are in the page cache */
+	(void) handle;
+	return 0;
+}
+
+static long
+host_mmap_length(
+	void *handle
+) {
+	return ((host_mmap_file_t *) handle)->length;
+}
+
+static int
+host_mmap_advise(
+	void	*handle,
+	long	offset,
+	long	size,
+	int		advice
+) {
+	static const int	advices[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+	host_mmap_file_t	*file	= (host_mmap_file_t *) handle;
+	long				page	= sysconf(_SC_PAGESIZE);
+	long				start	= offset / page * page;
+	long				end		= 0 == size ? (long) file->capacity : offset + size;
+
+	/* madvise() needs a page aligned start */
+	if ((NULL == file->map) || (start >= (long) file->capacity)) {
+		return 0;
+	}
+
+	if (end > (long) file->capacity) {
+		end = (long) file->capacity;
+	}
+
+	return madvise(file->map + start, (size_t) (end - start), advices[advice]);
+}
+
+static void *
+host_mmap_map(
+	void	*handle,
+	long	offset,
+	long	size
+) {
+	host_mmap_file_t *file = (host_mmap_file_t *) handle;
+
+	if ((offset < 0) || (size < 0) || (offset + size > file->length) || (NULL == file->map)) {
+		return NULL;
+	}
+
+	return file->map + offset;
+}
+
+const host_file_backend_t host_mmap_backend = {
+	host_mmap_open, host_mmap_close, host_mmap_read_at, host_mmap_write_at, host_mmap_flush, host_mmap_length, NULL, host_mmap_advise, host_mmap_map, NULL
+};
+
+/* ==================== RAM backend ==================== */
+
+/**
+@brief		A file of the RAM backend. Once the RAM budget is used, bytes from @c limit on are in a spill file.
+*/
+typedef struct host_ram_file {
+	char					*name;
+	char					*data;
+	long					length;
+	size_t					capacity;
+	FILE					*spill;			/**< Spill file. NULL if file has not spilled. */
+	char					*spill_name;
+	long					limit;			/**< Bytes in RAM once spilled. Capacity does not change after that. */
+	struct host_ram_file	*next;
+} host_ram_file_t;
+
+static host_ram_file_t	*host_ram_files		= NULL;
+static size_t			host_ram_budget		= 0;		/* Most bytes of all RAM files. 0 is no limit. */
+static size_t			host_ram_used		= 0;		/* Bytes allocated to RAM files */
+static unsigned long	host_ram_spill_bytes = 0;		/* Bytes written to spill files */
+static pthread_mutex_t	host_ram_lock		= PTHREAD_MUTEX_INITIALIZER;	/* Protects list of files and budget */
+
+/**
+@brief		Frees the RAM and closes and removes the spill file of a file. Caller holds the lock.
+*/
+static void
+host_ram_truncate(
+	host_ram_file_t *file
+) {
+	if (NULL != file->spill) {
+		fclose(file->spill);
+		remove(file->spill_name);
+	}
+
+	free(file->spill_name);
+	free(file->data);
+	host_ram_used		-= file->capacity;
+	file->data			= NULL;
+	file->capacity		= 0;
+	file->spill			= NULL;
+	file->spill_name	= NULL;
+	file->length		= 0;
+}
+
+/**
+@brief		Grows RAM of a file to hold @p end bytes within the budget. If they do not fit, bytes from the
+			capacity reached on go to a spill file. Caller holds the lock.
+@returns	@c 0 on success, non-zero if the spill file could not be opened.
+*/
+static int
+host_ram_reserve(
+	host_ram_file_t *file,
+	size_t			end
+) {
+	size_t	capacity = file->capacity > 0 ? file->capacity : 4096;
+	char	*data;
+
+	while (capacity < end) {
+		capacity *= 2;
+	}
+
+	if ((host_ram_budget > 0) && (host_ram_used - file->capacity + capacity > host_ram_budget)) {
+		capacity = host_ram_budget > host_ram_used ? file->capacity + (host_ram_budget - host_ram_used) : file->capacity;
+	}
+
+	if ((capacity > file->capacity) && (NULL != (data = realloc(file->data, capacity)))) {
+		host_ram_used	+= capacity - file->capacity;
+		file->data		= data;
+		file->capacity	= capacity;
+	}
+
+	if (file->capacity >= end) {
+		return 0;
+	}
+
+	file->spill_name = malloc(strlen(file->name) + 7);
+
+	if (NULL == file->spill_name) {
+		return -1;
+	}
+
+	strcpy(file->spill_name, file->name);
+	strcat(file->spill_name, ".spill");
+	file->spill = fopen(file->spill_name, "w+b");
+
+	if (NULL == file->spill) {
+		free(file->spill_name);
+		file->spill_name = NULL;
+		return -1;
+	}
+
+	file->limit = (long) file->capacity;
+	return 0;
+}
+
+static void *
+host_ram_open(
+	const char	*filename,
+	const char	*mode
+) {
+	host_ram_file_t *file;
+
+	pthread_mutex_lock(&host_ram_lock);
+
+	for (file = host_ram_files; NULL != file && 0 != strcmp(file->name, filename); file = file->next) {}
+
+	if ((NULL == file) && ('r' != mode[0])) {
+		file = calloc(1, sizeof(host_ram_file_t));
+
+		if ((NULL != file) && (NULL == (file->name = malloc(strlen(filename) + 1)))) {
+			free(file);
+			file = NULL;
+		}
+
+		if (NULL != file) {
+			strcpy(file->name, filename);
+			file->next		= host_ram_files;
+			host_ram_files	= file;
+		}
+	}
+
+	if ((NULL != file) && ('w' == mode[0])) {
+		host_ram_truncate(file);
+	}
+
+	pthread_mutex_unlock(&host_ram_lock);
+	return file;
+}
+
+static int
+host_ram_close(
+	void *handle
+) {
+	(void) handle;
+	return 0;
+}
+
+static size_t
+host_ram_read_at(
+	void	*handle,
+	long	offset,
+	void	*buffer,
+	size_t	size
+) {
+	host_ram_file_t *file	= (host_ram_file_t *) handle;
+	long			ramEnd	= NULL != file->spill ? file->limit : file->length;
+	size_t			read	= 0;
+
+	if (offset >= file->length) {
+		return 0;
+	}
+
+	if ((long) size > file->length - offset) {
+		size = (size_t) (file->length - offset);
+	}
+
+	if (offset < ramEnd) {
+		read = (long) size < ramEnd - offset ? size : (size_t) (ramEnd - offset);
+		memcpy(buffer, file->data + offset, read);
+	}
+
+	if (read < size) {
+		read += host_stdio_read_at(file->spill, offset + (long) read, (char *) buffer + read, size - read);
+	}
+
+	return read;
+}
+
+static size_t
+host_ram_write_at(
+	void		*handle,
+	long		offset,
+	const void	*buffer,
+	size_t		size
+) {
+	host_ram_file_t *file		= (host_ram_file_t *) handle;
+	size_t			end			= (size_t) offset + size;
+	size_t			written		= 0;
+	long			ramEnd;
+
+	if ((NULL == file->spill) && (end > file->capacity)) {
+		int result;
+
+		pthread_mutex_lock(&host_ram_lock);
+		result = host_ram_reserve(file, end);
+		pthread_mutex_unlock(&host_ram_lock);
+
+		if (0 != result) {
+			return 0;
+		}
+	}
+
+	ramEnd = NULL != file->spill ? file->limit : (long) end;
+
+	if (offset < ramEnd) {
+		/* Gap after end of file reads as zeros. Gap in spill file is a hole. */
+		if (offset > file->length) {
+			memset(file->data + file->length, 0, (size_t) (offset - file->length));
+		}
+
+		written = (long) size < ramEnd - offset ? size : (size_t) (ramEnd - offset);
+		memcpy(file->data + offset, buffer, written);
+	}
+
+	if (written < size) {
+		size_t spilled = host_stdio_write_at(file->spill, offset + (long) written, (const char *) buffer + written, size - written);
+
+		pthread_mutex_lock(&host_ram_lock);
+		host_ram_spill_bytes += spilled;
+		pthread_mutex_unlock(&host_ram_lock);
+		written += spilled;
+	}
+
+	if (offset + (long) written > file->length) {
+		file->length = offset + (long) written;
+	}
+
+	return written;
+}
+
+static int
+host_ram_flush(
+	void *handle
+) {
+	host_ram_file_t *file = (host_ram_file_t *) handle;
+
+	return NULL != file->spill ? fflush(file->spill) : 0;
+}
+
+static long
+host_ram_length(
+	void *handle
+) {
+	return ((host_ram_file_t *) handle)->length;
+}
+
+const host_file_backend_t host_ram_backend = {
+	host_ram_open, host_ram_close, host_ram_read_at, host_ram_write_at, host_ram_flush, host_ram_length, NULL, NULL, NULL, NULL
+};
+
+void
+host_ram_set_budget(
+	size_t bytes
+) {
+	pthread_mutex_lock(&host_ram_lock);
+	host_ram_budget = bytes;
+	pthread_mutex_unlock(&host_ram_lock);
+}
+
+unsigned long
+host_ram_spilled(
+	void
+) {
+	unsigned long bytes;
+
+	pthread_mutex_lock(&host_ram_lock);
+	bytes = host_ram_spill_bytes;
+	pthread_mutex_unlock(&host_ram_lock);
+	return bytes;
+}
+
+int
+host_ram_remove(
+	const char *filename
+) {
+	host_ram_file_t **prev, *file;
+
+	pthread_mutex_lock(&host_ram_lock);
+
+	for (prev = &host_ram_files; NULL != *prev && 0 != strcmp((*prev)->name, filename); prev = &(*prev)->next) {}
+
+	file = *prev;
+
+	if (NULL != file) {
+		*prev = file->next;
+		host_ram_truncate(file);
+	}
+
+	pthread_mutex_unlock(&host_ram_lock);
+
+	if (NULL == file) {
+		return -1;
+	}
+
+	free(file->name);
+	free(file);
+	return 0;
+}
+
+void
+host_set_backend(
+	const host_file_backend_t *backend
+) {
+	host_backend = backend;
+}
+
+/* ==================== write-behind ==================== */
+
+/**
+@brief		Returns @c 1 if a queued write overlaps the region. Caller holds the lock.
+*/
+static int8_t
+host_write_overlaps(
+	HOST_FILE	*stream,
+	long		offset,
+	size_t		size
+) {
+	int16_t				i;
+	host_write_slot_t	*slot;
+
+	for (i = 0; i < stream->write_count; i++) {
+		slot = &stream->write_slots[(stream->write_head + i) % stream->write_pages];
+
+		if ((slot->offset < offset + (long) size) && (offset < slot->offset + (long) slot->size)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+@brief		Waits until all queued writes are written. Caller holds the lock.
+*/
+static void
+host_write_drain(
+	HOST_FILE *stream
+) {
+	while (stream->write_count > 0) {
+		pthread_cond_wait(&stream->cond, &stream->lock);
+	}
+}
+
+/**
+@brief		Write-behind thread. Writes queued pages in order. If the backend does batches, all queued pages are
+			given to it in one batch.
+*/
+static void *
+host_writer_thread(
+	void *arg
+) {
+	HOST_FILE			*stream = (HOST_FILE *) arg;
+	host_write_slot_t	*slot;
+	host_io_request_t	*request;
+	int16_t				count;
+	int16_t				i;
+	int8_t				failed;
+
+	pthread_mutex_lock(&stream->lock);
+
+	while (1) {
+		while (!stream->stop_thread && (0 == stream->write_count)) {
+			pthread_cond_wait(&stream->cond, &stream->lock);
+		}
+
+		if (0 == stream->write_count) {
+			break;
+		}
+
+		/* Busy pages are not changed by other threads */
+		count				= NULL != stream->backend->submit ? stream->write_count : 1;
+		stream->write_busy	= count;
+
+		for (i = 0; i < count; i++) {
+			int16_t index	= (stream->write_head + i) % stream->write_pages;
+
+			slot				= &stream->write_slots[index];
+			request				= &stream->write_requests[i];
+			request->offset		= slot->offset;
+			request->buffer		= stream->write_buffer + (size_t) index * stream->write_page_size;
+			request->size		= slot->size;
+			request->write		= 1;
+			request->done		= 0;
+		}
+
+		pthread_mutex_unlock(&stream->lock);
+
+		pthread_mutex_lock(&stream->io_lock);
+
+		if (NULL != stream->backend->submit) {
+			failed = 0 != stream->backend->submit(stream->handle, stream->write_requests, count);
+		}
+		else {
+			request			= &stream->write_requests[0];
+			request->done	= stream->backend->write_at(stream->handle, request->offset, request->buffer, request->size);
+			failed			= request->done != request->size;
+		}
+
+		pthread_mutex_unlock(&stream->io_lock);
+
+		pthread_mutex_lock(&stream->lock);
+
+		if (failed) {
+			stream->write_error = 1;
+		}
+
+		stream->write_head	= (stream->write_head + count) % stream->write_pages;
+		stream->write_count -= count;
+		stream->write_busy	= 0;
+		pthread_cond_broadcast(&stream->cond);
+	}
+
+	pthread_mutex_unlock(&stream->lock);
+	return NULL;
+}
+
+/**
+@brief		Queues a write at @p offset. Appends to the newest queued page if the write follows it and fits.
+			Caller holds the lock.
+@returns	@c 0 on success, non-zero if the write thread could not be started.
+*/
+static int
+host_write_enqueue(
+	HOST_FILE	*stream,
+	long		offset,
+	const void	*ptr,
+	size_t		size
+) {
+	int16_t				tail;
+	host_write_slot_t	*slot;
+
+	if (stream->write_count > stream->write_busy) {
+		tail	= (stream->write_head + stream->write_count - 1) % stream->write_pages;
+		slot	= &stream->write_slots[tail];
+
+		if ((slot->offset + (long) slot->size == offset) && (slot->size + size <= stream->write_page_size)) {
+			memcpy(stream->write_buffer + (size_t) tail * stream->write_page_size + slot->size, ptr, size);
+			slot->size += size;
+			return 0;
+		}
+	}
+
+	if (!stream->writer_running) {
+		if (0 != pthread_create(&stream->writer, NULL, host_writer_thread, stream)) {
+			return -1;
+		}
+
+		stream->writer_running = 1;
+	}
+
+	while (stream->write_count == stream->write_pages) {
+		pthread_cond_wait(&stream->cond, &stream->lock);
+	}
+
+	tail			= (stream->write_head + stream->write_count) % stream->write_pages;
+	slot			= &stream->write_slots[tail];
+	slot->offset	= offset;
+	slot->size		= size;
+	memcpy(stream->write_buffer + (size_t) tail * stream->write_page_size, ptr, size);
+	stream->write_count++;
+	pthread_cond_broadcast(&stream->cond);
+	return 0;
+}
+
+int
+host_set_write_behind(
+	HOST_FILE	*stream,
+	int16_t		pages,
+	size_t		page_size
+) {
+	char				*buffer		= NULL;
+	host_write_slot_t	*slots		= NULL;
+	host_io_request_t	*requests	= NULL;
+	int					result;
+
+	if (pages > 0) {
+		buffer		= malloc((size_t) pages * page_size);
+		slots		= malloc(sizeof(host_write_slot_t) * (size_t) pages);
+		requests	= malloc(sizeof(host_io_request_t) * (size_t) pages);
+
+		if ((NULL == buffer) || (NULL == slots) || (NULL == requests)) {
+			free(buffer);
+			free(slots);
+			free(requests);
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&stream->lock);
+	host_write_drain(stream);
+	free(stream->write_buffer);
+	free(stream->write_slots);
+	free(stream->write_requests);
+	stream->write_buffer	= buffer;
+	stream->write_slots		= slots;
+	stream->write_requests	= requests;
+	stream->write_pages		= pages > 0 ? pages : 0;
+	stream->write_page_size = page_size;
+	stream->write_head		= 0;
+	result					= stream->write_error;
+	pthread_mutex_unlock(&stream->lock);
+	return result;
+}
+
+/* ==================== prefetching ==================== */
+
+/**
+@brief		Prefetch thread. Reads each requested region into the prefetch buffer.
+*/
+static void *
+host_prefetch_thread(
+	void *arg
+) {
+	HOST_FILE	*stream = (HOST_FILE *) arg;
+	long		offset;
+	size_t		size, read;
+
+	pthread_mutex_lock(&stream->lock);
+
+	while (1) {
+		/* A region being written behind is read once its writes are done */
+		while (!stream->stop_thread && ((HOST_PREFETCH_REQUESTED != stream->prefetch_state) || host_write_overlaps(stream, stream->prefetch_offset, stream->prefetch_size))) {
+			pthread_cond_wait(&stream->cond, &stream->lock);
+		}
+
+		if (stream->stop_thread) {
+			break;
+		}
+
+		stream->prefetch_state	= HOST_PREFETCH_READING;
+		offset					= stream->prefetch_offset;
+		size					= stream->prefetch_size;
+		pthread_mutex_unlock(&stream->lock);
+
+		/* Buffer is not changed by other threads while state is reading */
+		pthread_mutex_lock(&stream->io_lock);
+		read = stream->backend->read_at(stream->handle, offset, stream->prefetch_buffer, size);
+		pthread_mutex_unlock(&stream->io_lock);
+
+		pthread_mutex_lock(&stream->lock);
+		stream->prefetch_read	= read;
+		stream->prefetch_state	= HOST_PREFETCH_READY;
+		pthread_cond_broadcast(&stream->cond);
+	}
+
+	pthread_mutex_unlock(&stream->lock);
+	return NULL;
+}
+
+/**
+@brief		Waits until no prefetch is being read. Caller holds the lock.
+*/
+static void
+host_prefetch_wait(
+	HOST_FILE *stream
+) {
+	while (HOST_PREFETCH_READING == stream->prefetch_state) {
+		pthread_cond_wait(&stream->cond, &stream->lock);
+	}
+}
+
+void
+host_set_prefetch(
+	int8_t enabled
+) {
+	host_prefetch_enabled = enabled;
+}
+
+void
+host_fprefetch(
+	HOST_FILE	*stream,
+	long		offset,
+	size_t		size
+) {
+	if (!host_prefetch_enabled || (NULL == stream)) {
+		return;
+	}
+
+	pthread_mutex_lock(&stream->lock);
+
+	if ((HOST_PREFETCH_READING == stream->prefetch_state) || ((HOST_PREFETCH_IDLE != stream->prefetch_state) && (offset == stream->prefetch_offset) && (size <= stream->prefetch_size))) {
+		pthread_mutex_unlock(&stream->lock);
+		return;
+	}
+
+	if (size > stream->prefetch_capacity) {
+		char *buffer = realloc(stream->prefetch_buffer, size);
+
+		if (NULL == buffer) {
+			pthread_mutex_unlock(&stream->lock);
+			return;
+		}
+
+		stream->prefetch_buffer		= buffer;
+		stream->prefetch_capacity	= size;
+	}
+
+	if (!stream->thread_running) {
+		if (0 != pthread_create(&stream->thread, NULL, host_prefetch_thread, stream)) {
+			pthread_mutex_unlock(&stream->lock);
+			return;
+		}
+
+		stream->thread_running = 1;
+	}
+
+	stream->prefetch_offset = offset;
+	stream->prefetch_size	= size;
+	stream->prefetch_state	= HOST_PREFETCH_REQUESTED;
+	pthread_cond_broadcast(&stream->cond);
+	pthread_mutex_unlock(&stream->lock);
+}
+
+unsigned long
+host_fstalltime(
+	HOST_FILE *stream
+) {
+	return stream->stall_time;
+}
+
+unsigned long
+host_fdevicetime(
+	HOST_FILE *stream
+) {
+	return NULL != stream->backend->device_time ? stream->backend->device_time(stream->handle) : 0;
+}
+
+int
+host_fadvise(
+	HOST_FILE	*stream,
+	long		offset,
+	long		size,
+	int			advice
+) {
+	int result;
+
+	if ((NULL == stream) || (NULL == stream->backend->advise)) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&stream->io_lock);
+	result = stream->backend->advise(stream->handle, offset, size, advice);
+	pthread_mutex_unlock(&stream->io_lock);
+	return result;
+}
+
+void *
+host_fmap(
+	HOST_FILE	*stream,
+	long		offset,
+	long		size
+) {
+	void *map;
+
+	if ((NULL == stream) || (NULL == stream->backend->map)) {
+		return NULL;
+	}
+
+	/* Queued writes of the region must be in the file */
+	pthread_mutex_lock(&stream->lock);
+	host_write_drain(stream);
+	pthread_mutex_unlock(&stream->lock);
+
+	pthread_mutex_lock(&stream->io_lock);
+	map = stream->backend->map(stream->handle, offset, size);
+	pthread_mutex_unlock(&stream->io_lock);
+	return map;
+}
+
+/* ==================== stdio functions ==================== */
+
+HOST_FILE *
+host_fopen(
+	const char	*filename,
+	const char	*mode
+) {
+	return host_fopen_backend(filename, mode, NULL);
+}
+
+HOST_FILE *
+host_fopen_backend(
+	const char					*filename,
+	const char					*mode,
+	const host_file_backend_t	*backend
+) {
+	HOST_FILE *stream = calloc(1, sizeof(HOST_FILE));
+
+	if (NULL == stream) {
+		return NULL;
+	}
+
+	if (NULL == backend) {
+		backend = NULL != host_backend ? host_backend : &host_posix_backend;
+	}
+
+	stream->backend = backend;
+	stream->handle	= stream->backend->open(filename, mode);
+
+	if (NULL == stream->handle) {
+		free(stream);
+		return NULL;
+	}
+
+	stream->length = stream->backend->length(stream->handle);
+
+	if ('a' == mode[0]) {
+		stream->position = stream->length;
+	}
+
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_mutex_init(&stream->io_lock, NULL);
+	pthread_cond_init(&stream->cond, NULL);
+	return stream;
+}
+
+int
+host_fclose(
+	HOST_FILE *stream
+) {
+	int result;
+
+	if (NULL == stream) {
+		return 0;
+	}
+
+	/* Writer thread writes all queued pages before it stops */
+	pthread_mutex_lock(&stream->lock);
+	stream->stop_thread = 1;
+	pthread_cond_broadcast(&stream->cond);
+	pthread_mutex_unlock(&stream->lock);
+
+	if (stream->thread_running) {
+		pthread_join(stream->thread, NULL);
+	}
+
+	if (stream->writer_running) {
+		pthread_join(stream->writer, NULL);
+	}
+
+	result = stream->backend->close(stream->handle);
+
+	if (stream->write_error) {
+		result = EOF;
+	}
+
+	pthread_cond_destroy(&stream->cond);
+	pthread_mutex_destroy(&stream->io_lock);
+	pthread_mutex_destroy(&stream->lock);
+	free(stream->prefetch_buffer);
+	free(stream->write_buffer);
+	free(stream->write_slots);
+	free(stream->write_requests);
+	free(stream);
+	return result;
+}
+
+/**
+@brief		Reads @p total bytes at @p offset. Does not use or change the file position.
+@returns	The number of bytes read.
+*/
+static size_t
+host_read(
+	HOST_FILE	*stream,
+	long		offset,
+	void		*ptr,
+	size_t		total
+) {
+	size_t			read	= 0;
+	int8_t			served	= 0;
+	unsigned long	start	= host_micros();
+
+	if (0 == total) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&stream->lock);
+
+	if ((HOST_PREFETCH_IDLE != stream->prefetch_state) && (offset == stream->prefetch_offset) && (total <= stream->prefetch_size)) {
+		/* Requested region is being prefetched. Wait for it if still reading. */
+		while (HOST_PREFETCH_READY != stream->prefetch_state) {
+			pthread_cond_wait(&stream->cond, &stream->lock);
+		}
+
+		read = stream->prefetch_read < total ? stream->prefetch_read : total;
+		memcpy(ptr, stream->prefetch_buffer, read);
+		stream->prefetch_state = HOST_PREFETCH_IDLE;
+		stream->prefetch_hits++;
+		served = 1;
+	}
+	else {
+		while (host_write_overlaps(stream, offset, total)) {
+			pthread_cond_wait(&stream->cond, &stream->lock);
+		}
+	}
+
+	pthread_mutex_unlock(&stream->lock);
+
+	if (!served) {
+		pthread_mutex_lock(&stream->io_lock);
+		read = stream->backend->read_at(stream->handle, offset, ptr, total);
+		pthread_mutex_unlock(&stream->io_lock);
+	}
+
+	stream->stall_time += host_micros() - start;
+	return read;
+}
+
+/**
+@brief		Writes @p total bytes at @p offset. Does not use or change the file position.
+@returns	The number of bytes written.
+*/
+static size_t
+host_write(
+	HOST_FILE	*stream,
+	long		offset,
+	const void	*ptr,
+	size_t		total
+) {
+	size_t written;
+
+	if (0 == total) {
+		return 0;
+	}
+
+	/* Discard a prefetch of a region this write overlaps */
+	pthread_mutex_lock(&stream->lock);
+
+	if ((HOST_PREFETCH_IDLE != stream->prefetch_state) && (offset < stream->prefetch_offset + (long) stream->prefetch_size) && (stream->prefetch_offset < offset + (long) total)) {
+		host_prefetch_wait(stream);
+		stream->prefetch_state = HOST_PREFETCH_IDLE;
+	}
+
+	if (stream->write_error) {
+		pthread_mutex_unlock(&stream->lock);
+		return 0;
+	}
+
+	if ((stream->write_pages > 0) && (total <= stream->write_page_size) && (0 == host_write_enqueue(stream, offset, ptr, total))) {
+		written = total;
+		pthread_mutex_unlock(&stream->lock);
+	}
+	else {
+		/* Direct write is done after queued writes to keep writes in order */
+		host_write_drain(stream);
+		pthread_mutex_unlock(&stream->lock);
+
+		pthread_mutex_lock(&stream->io_lock);
+		written = stream->backend->write_at(stream->handle, offset, ptr, total);
+		pthread_mutex_unlock(&stream->io_lock);
+	}
+
+	if (offset + (long) written > stream->length) {
+		stream->length = offset + (long) written;
+	}
+
+	return written;
+}
+
+size_t
+host_fread(
+	void		*ptr,
+	size_t		size,
+	size_t		nmemb,
+	HOST_FILE	*stream
+) {
+	size_t read = host_read(stream, stream->position, ptr, size * nmemb);
+
+	stream->position += (long) read;
+	return 0 == size ? 0 : read / size;
+}
+
+size_t
+host_fwrite(
+	const void	*ptr,
+	size_t		size,
+	size_t		nmemb,
+	HOST_FILE	*stream
+) {
+	size_t written = host_write(stream, stream->position, ptr, size * nmemb);
+
+	stream->position += (long) written;
+	return 0 == size ? 0 : written / size;
+}
+
+size_t
+host_fread_at(
+	void		*ptr,
+	size_t		size,
+	size_t		nmemb,
+	HOST_FILE	*stream,
+	long		offset
+) {
+	return 0 == size ? 0 : host_read(stream, offset, ptr, size * nmemb) / size;
+}
+
+size_t
+host_fwrite_at(
+	const void	*ptr,
+	size_t		size,
+	size_t		nmemb,
+	HOST_FILE	*stream,
+	long		offset
+) {
+	return 0 == size ? 0 : host_write(stream, offset, ptr, size * nmemb) / size;
+}
+
+int
+host_fseek(
+	HOST_FILE	*stream,
+	long		offset,
+	int			whence
+) {
+	long position;
+
+	switch (whence) {
+		case SEEK_SET:
+			position = offset;
+			break;
+
+		case SEEK_CUR:
+			position = stream->position + offset;
+			break;
+
+		case SEEK_END:
+			position = stream->length + offset;
+			break;
+
+		default:
+			return -1;
+	}
+
+	if (position < 0) {
+		return -1;
+	}
+
+	stream->position = position;
+	return 0;
+}
+
+long
+host_ftell(
+	HOST_FILE *stream
+) {
+	return stream->position;
+}
+
+int
+host_fflush(
+	HOST_FILE *stream
+) {
+	int result;
+
+	pthread_mutex_lock(&stream->lock);
+	host_write_drain(stream);
+	pthread_mutex_unlock(&stream->lock);
+
+	pthread_mutex_lock(&stream->io_lock);
+	result = stream->backend->flush(stream->handle);
+	pthread_mutex_unlock(&stream->io_lock);
+	return stream->write_error ? EOF : result;
+}
+
+#endif /* Clause ION_HOST_FILE */
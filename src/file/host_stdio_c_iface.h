@@ -0,0 +1,454 @@
+/******************************************************************************/
+/**
+@file		host_stdio_c_iface.h
+@author		IonDB Project Contributors
+@brief		This code contains definitions for stdio.h file functions
+			for PC hosts with read-ahead prefetching.
+@details	Files are accessed through a backend using positional reads and
+			writes. A background thread reads a block requested with
+			fprefetch() so that it is in memory when it is read. Writes can
+			be queued in a fixed number of pages and written by a background
+			thread (write-behind). fflush() waits until queued writes are done.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(HOST_STDIO_C_IFACE_H_)
+#define HOST_STDIO_C_IFACE_H_
+
+#if defined(ION_HOST_FILE) && !defined(ARDUINO)
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief		Defined when fprefetch() hints are used so callers can skip forecasting work otherwise.
+*/
+#define ION_FILE_PREFETCH	1
+
+/**
+@brief		A read or write of a batch given to the submit operation of a backend.
+*/
+typedef struct host_io_request {
+	long	offset;
+	void	*buffer;
+	size_t	size;
+	int8_t	write;			/**< @c 1 to write the buffer, @c 0 to read into it. */
+	size_t	done;			/**< Bytes read or written. Set by submit. */
+} host_io_request_t;
+
+/**
+@brief		Operations of a storage backend. All reads and writes are at an offset
+			so backends do not track a file position.
+*/
+typedef struct host_file_backend {
+	void *(*open)(const char *filename, const char *mode);
+	int (*close)(void *handle);
+	size_t (*read_at)(void *handle, long offset, void *buffer, size_t size);
+	size_t (*write_at)(void *handle, long offset, const void *buffer, size_t size);
+	int (*flush)(void *handle);
+	long (*length)(void *handle);
+	unsigned long (*device_time)(void *handle);		/**< Predicted microseconds the storage device was busy. NULL if the backend does not model a device. */
+	int (*advise)(void *handle, long offset, long size, int advice);	/**< Hints how a region is accessed. NULL if the backend takes no hints. */
+	void *(*map)(void *handle, long offset, long size);		/**< Returns the memory holding a region. NULL if the backend does not map files. */
+	int (*submit)(void *handle, host_io_request_t *requests, int count);	/**< Does a batch of accesses with several in flight. Returns @c 0 if all were done in full. NULL if accesses are done one at a time. */
+} host_file_backend_t;
+
+/**
+@brief		Access patterns given to host_fadvise(). Accesses of ION_FILE_ADVICE_SEQUENTIAL regions read ahead
+			more, ION_FILE_ADVICE_RANDOM regions do not read ahead, and ION_FILE_ADVICE_WILLNEED regions are
+			read ahead now.
+*/
+#define ION_FILE_ADVICE_NORMAL		0
+#define ION_FILE_ADVICE_SEQUENTIAL	1
+#define ION_FILE_ADVICE_RANDOM		2
+#define ION_FILE_ADVICE_WILLNEED	3
+
+/**
+@brief		Backend using C stdio files.
+*/
+extern const host_file_backend_t host_stdio_backend;
+
+/**
+@brief		Backend using pread() and pwrite() on a file descriptor. Default backend.
+			Reads and writes do not seek and are not copied through a stdio buffer.
+*/
+extern const host_file_backend_t host_posix_backend;
+
+/**
+@brief		Alignment of offsets, sizes, and memory of reads and writes done with O_DIRECT.
+*/
+#define HOST_DIRECT_ALIGNMENT	512
+
+/**
+@brief		Backend using pread() and pwrite() with O_DIRECT so aligned reads and writes
+			bypass the page cache. Accesses not aligned to HOST_DIRECT_ALIGNMENT, and all accesses
+			on file systems without O_DIRECT, use the page cache as host_posix_backend does.
+			Memory that is not aligned is copied through an aligned buffer.
+*/
+extern const host_file_backend_t host_direct_backend;
+
+/**
+@brief		Backend mapping files into memory with mmap(). Reads and writes copy to and from the page cache
+			and host_fmap() returns the mapped file without a copy. The file grows in steps of at least
+			HOST_MMAP_GROWTH bytes and is cut to its length when closed.
+*/
+extern const host_file_backend_t host_mmap_backend;
+
+/**
+@brief		Smallest number of bytes a mapped file grows by.
+*/
+#define HOST_MMAP_GROWTH	(1L << 20)
+
+/**
+@brief		Backend keeping files in memory. A file is found by name when opened again
+			and is kept after it is closed until host_ram_remove() is called.
+			Once the budget set by host_ram_set_budget() is used, bytes a file cannot
+			keep in RAM are written at the same offset in a stdio spill file named
+			after it with suffix ".spill".
+*/
+extern const host_file_backend_t host_ram_backend;
+
+/**
+@brief		A queued write. Data is in the page of the write-behind buffer with the same index.
+*/
+typedef struct host_write_slot {
+	long	offset;
+	size_t	size;
+} host_write_slot_t;
+
+/**
+@brief		State of a host file.
+*/
+typedef struct _HOST_File {
+	const host_file_backend_t	*backend;
+	void						*handle;			/**< Backend file handle. */
+	long						position;			/**< Current file position. */
+	long						length;				/**< Current file length. */
+	pthread_mutex_t				lock;				/**< Protects prefetch state. */
+	pthread_mutex_t				io_lock;			/**< Serializes backend calls. */
+	pthread_cond_t				cond;				/**< Signals prefetch state changes. */
+	pthread_t					thread;				/**< Prefetch thread. Started on first prefetch. */
+	int8_t						thread_running;
+	int8_t						stop_thread;
+	int8_t						prefetch_state;		/**< HOST_PREFETCH_* */
+	long						prefetch_offset;
+	size_t						prefetch_size;		/**< Bytes requested. */
+	size_t						prefetch_read;		/**< Bytes read by prefetch. */
+	char						*prefetch_buffer;
+	size_t						prefetch_capacity;
+	unsigned long				stall_time;			/**< Microseconds spent waiting for reads. */
+	unsigned long				prefetch_hits;		/**< Reads served by a prefetch. */
+	pthread_t					writer;				/**< Write-behind thread. Started on first queued write. */
+	int8_t						writer_running;
+	int8_t						write_error;		/**< Set if a queued write failed. Reported by next fwrite() or fflush(). */
+	int16_t						write_pages;		/**< Number of pages in write-behind queue. 0 if writes are not queued. */
+	size_t						write_page_size;	/**< Largest write that is queued. Larger writes are done directly. */
+	char						*write_buffer;		/**< write_pages pages of write_page_size bytes. */
+	host_write_slot_t			*write_slots;
+	int16_t						write_head;			/**< Oldest queued write. */
+	int16_t						write_count;		/**< Number of queued writes. */
+	int16_t						write_busy;			/**< Number of queued writes from the head being written. They cannot be appended to. */
+	host_io_request_t			*write_requests;	/**< Batch of queued writes given to the submit operation of the backend. */
+} HOST_FILE;
+
+#define HOST_PREFETCH_IDLE		0
+#define HOST_PREFETCH_REQUESTED	1
+#define HOST_PREFETCH_READING	2
+#define HOST_PREFETCH_READY		3
+
+/**
+@brief		Returns the open() flags of a stdio mode. Append mode does not use O_APPEND as host files write at their position.
+*/
+int
+host_open_flags(
+	const char *mode
+);
+
+/**
+@brief		Sets the backend of files opened afterwards.
+@param		backend
+				Backend to use. @c NULL selects host_posix_backend.
+*/
+void
+host_set_backend(
+	const host_file_backend_t *backend
+);
+
+/**
+@brief		Sets the most bytes of RAM all files of the RAM backend use together.
+			Files that have already spilled keep the RAM they have.
+@param		bytes
+				Budget in bytes. @c 0 (default) is no limit.
+*/
+void
+host_ram_set_budget(
+	size_t bytes
+);
+
+/**
+@brief		Returns the number of bytes written to spill files of the RAM backend.
+*/
+unsigned long
+host_ram_spilled(
+	void
+);
+
+/**
+@brief		Frees a file of the RAM backend and removes its spill file. It must not be open.
+@returns	@c 0 on success, non-zero if there is no such file.
+*/
+int
+host_ram_remove(
+	const char *filename
+);
+
+/**
+@brief		Enables or disables prefetching for all files. Enabled by default.
+@param		enabled
+				@c 1 to start reads requested by fprefetch(), @c 0 to ignore them.
+*/
+void
+host_set_prefetch(
+	int8_t enabled
+);
+
+/**
+@brief		Sets the number of pages a file may use to queue writes. Writes of up to
+			@p page_size bytes return once copied to the queue and are written by a
+			background thread in order. Contiguous small writes are combined into one page.
+			The pages are the only extra memory used. Queued writes are done first.
+@param		pages
+				Number of pages to queue. @c 0 disables write-behind.
+@param		page_size
+				Size of a page in bytes.
+@returns	@c 0 on success, non-zero if the queue could not be allocated or a queued write failed.
+*/
+int
+host_set_write_behind(
+	HOST_FILE	*stream,
+	int16_t		pages,
+	size_t		page_size
+);
+
+/**
+@brief		Opens a file using the backend set by host_set_backend().
+@param		filename
+				Path of file.
+@param		mode
+				Mode as for stdio fopen.
+@returns	A pointer to a host file, or @c NULL if an error occurred.
+*/
+HOST_FILE *
+host_fopen(
+	const char	*filename,
+	const char	*mode
+);
+
+/**
+@brief		Opens a file using a backend. Selects the backend of one file, for example
+			temporary sublists in RAM while input is on the SD card.
+@param		backend
+				Backend of the file. @c NULL uses the backend set by host_set_backend().
+@returns	A pointer to a host file, or @c NULL if an error occurred.
+*/
+HOST_FILE *
+host_fopen_backend(
+	const char					*filename,
+	const char					*mode,
+	const host_file_backend_t	*backend
+);
+
+/**
+@brief		Closes a file. Waits for queued writes and any prefetch in progress and stops the threads.
+@returns	@c 0 on success, non-zero otherwise.
+*/
+int
+host_fclose(
+	HOST_FILE *stream
+);
+
+/**
+@brief		Reads @p nmemb items of @p size bytes at the current position. Served from a
+			completed or in progress prefetch of the same position if there is one.
+			Waits for queued writes of the region.
+@returns	The number of items read.
+*/
+size_t
+host_fread(
+	void		*ptr,
+	size_t		size,
+	size_t		nmemb,
+	HOST_FILE	*stream
+);
+
+/**
+@brief		Writes @p nmemb items of @p size bytes at the current position.
+			A prefetch of an overlapping region is discarded. Queued if write-behind is enabled.
+@returns	The number of items written.
+*/
+size_t
+host_fwrite(
+	const void	*ptr,
+	size_t		size,
+	size_t		nmemb,
+	HOST_FILE	*stream
+);
+
+/**
+@brief		Reads @p nmemb items of @p size bytes at @p offset.
+			Does not use or change the current position.
+@returns	The number of items read.
+*/
+size_t
+host_fread_at(
+	void		*ptr,
+	size_t		size,
+	size_t		nmemb,
+	HOST_FILE	*stream,
+	long		offset
+);
+
+/**
+@brief		Writes @p nmemb items of @p size bytes at @p offset.
+			Does not use or change the current position.
+@returns	The number of items written.
+*/
+size_t
+host_fwrite_at(
+	const void	*ptr,
+	size_t		size,
+	size_t		nmemb,
+	HOST_FILE	*stream,
+	long		offset
+);
+
+/**
+@brief		Sets the current position of a file.
+@param		whence
+				SEEK_SET, SEEK_CUR, or SEEK_END.
+@returns	@c 0 on success, non-zero otherwise.
+*/
+int
+host_fseek(
+	HOST_FILE	*stream,
+	long		offset,
+	int			whence
+);
+
+/**
+@brief		Returns the current position of a file.
+*/
+long
+host_ftell(
+	HOST_FILE *stream
+);
+
+/**
+@brief		Flushes a file to its backend. Barrier for write-behind: waits until all
+			queued writes are written.
+@returns	@c 0 on success, non-zero if a write failed.
+*/
+int
+host_fflush(
+	HOST_FILE *stream
+);
+
+/**
+@brief		Hints that @p size bytes at @p offset will be read soon. Starts reading them in the
+			background. Only one prefetch per file is outstanding. A hint while a prefetch is
+			being read is ignored.
+*/
+void
+host_fprefetch(
+	HOST_FILE	*stream,
+	long		offset,
+	size_t		size
+);
+
+/**
+@brief		Returns microseconds spent waiting for reads of a file.
+*/
+unsigned long
+host_fstalltime(
+	HOST_FILE *stream
+);
+
+/**
+@brief		Returns predicted microseconds the storage device of a file has been busy.
+			@c 0 if the backend of the file does not model a device.
+*/
+unsigned long
+host_fdevicetime(
+	HOST_FILE *stream
+);
+
+/**
+@brief		Hints how a region of a file is accessed next.
+@param		size
+				Bytes of the region. @c 0 is to the end of the file.
+@param		advice
+				ION_FILE_ADVICE_*
+@returns	@c 0 on success or if the backend of the file takes no hints, non-zero otherwise.
+*/
+int
+host_fadvise(
+	HOST_FILE	*stream,
+	long		offset,
+	long		size,
+	int			advice
+);
+
+/**
+@brief		Returns the memory holding @p size bytes of a file at @p offset so they can be read without a copy.
+			Queued writes are written first. The memory is valid until the file grows or is closed.
+@returns	@c NULL if the backend of the file does not map files or the region is past the end of the file.
+*/
+void *
+host_fmap(
+	HOST_FILE	*stream,
+	long		offset,
+	long		size
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#include "kv_stdio_intercept.h"
+
+#endif /* Clause ION_HOST_FILE */
+
+#endif
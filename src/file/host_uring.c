@@ -0,0 +1,463 @@
+/******************************************************************************/
+/**
+@file		host_uring.c
+@author		IonDB Project Contributors
+@brief		io_uring engine for host files.
+@copyright	Copyright 2021
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+/* Implementation uses the real stdio functions rather than the intercepted ones */
+#define ION_HOST_FILE_IMPL
+
+#include "host_uring.h"
+
+#if defined(ION_HOST_FILE) && !defined(ARDUINO)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#define HOST_URING	1
+#endif
+
+host_uring_stats_t host_uring_stats = {
+	0, 0, 0, 0, 0
+};
+
+static pthread_mutex_t host_uring_lock = PTHREAD_MUTEX_INITIALIZER;	/* Protects totals. Batches are done by write-behind threads. */
+
+#if defined(HOST_URING)
+/**
+@brief		Submission and completion rings of an io_uring instance.
+*/
+typedef struct host_uring_ring {
+	int					fd;
+	unsigned			*sq_tail;
+	unsigned			*sq_mask;
+	unsigned			*sq_array;
+	unsigned			*cq_head;
+	unsigned			*cq_tail;
+	unsigned			*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void				*sq_ring;
+	size_t				sq_ring_size;
+	void				*cq_ring;			/**< Same as sq_ring if the kernel maps both rings at once. */
+	size_t				cq_ring_size;
+	size_t				sqes_size;
+	unsigned			entries;
+} host_uring_ring_t;
+#endif
+
+/**
+@brief		A file of the io_uring backend.
+*/
+typedef struct host_uring_file {
+	int					fd;
+	int8_t				ring_ready;		/**< @c 1 if ring is set up and io_uring is allowed. */
+#if defined(HOST_URING)
+	host_uring_ring_t	ring;
+#endif
+} host_uring_file_t;
+
+void
+host_uring_reset(
+	void
+) {
+	pthread_mutex_lock(&host_uring_lock);
+	memset(&host_uring_stats, 0, sizeof(host_uring_stats_t));
+	pthread_mutex_unlock(&host_uring_lock);
+}
+
+#if defined(HOST_URING)
+/**
+@brief		Sets up an io_uring instance with HOST_URING_ENTRIES entries.
+@returns	@c 0 on success, non-zero if io_uring is not available.
+*/
+static int
+host_uring_setup(
+	host_uring_ring_t *ring
+) {
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = (int) syscall(__NR_io_uring_setup, HOST_URING_ENTRIES, &p);
+
+	if (ring->fd < 0) {
+		return -1;
+	}
+
+	ring->entries		= p.sq_entries;
+	ring->sq_ring_size	= p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size	= p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size		= p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring	= mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring	= ring->sq_ring;
+	ring->sqes		= MAP_FAILED;
+
+	if ((MAP_FAILED != ring->sq_ring) && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	}
+
+	if ((MAP_FAILED != ring->sq_ring) && (MAP_FAILED != ring->cq_ring)) {
+		ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	}
+
+	if (MAP_FAILED == ring->sqes) {
+		if ((MAP_FAILED != ring->cq_ring) && (ring->cq_ring != ring->sq_ring)) {
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+
+		if (MAP_FAILED != ring->sq_ring) {
+			munmap(ring->sq_ring, ring->sq_ring_size);
+		}
+
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->sq_tail	= (unsigned *) ((char *) ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask	= (unsigned *) ((char *) ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array	= (unsigned *) ((char *) ring->sq_ring + p.sq_off.array);
+	ring->cq_head	= (unsigned *) ((char *) ring->cq_ring + p.cq_off.head);
+	ring->cq_tail	= (unsigned *) ((char *) ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask	= (unsigned *) ((char *) ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes		= (struct io_uring_cqe *) ((char *) ring->cq_ring + p.cq_off.cqes);
+	return 0;
+}
+
+static void
+host_uring_teardown(
+	host_uring_ring_t *ring
+) {
+	munmap(ring->sqes, ring->sqes_size);
+
+	if (ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+/**
+@brief		Submits @p count accesses, at most the ring entries, and waits for all of them. Sets done of each
+			access io_uring completed. Accesses it refused or did in part are finished by the caller.
+@returns	@c 0 on success, non-zero if io_uring refused the submission.
+*/
+static int
+host_uring_run(
+	host_uring_file_t	*file,
+	host_io_request_t	*requests,
+	int					count
+) {
+	host_uring_ring_t	*ring		= &file->ring;
+	unsigned			tail		= *ring->sq_tail;
+	unsigned			head;
+	int					submitted	= 0;
+	int					completed	= 0;
+	int					i;
+	long				ret;
+
+	for (i = 0; i < count; i++) {
+		unsigned			index	= tail & *ring->sq_mask;
+		struct io_uring_sqe	*sqe	= &ring->sqes[index];
+
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode				= requests[i].write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd					= file->fd;
+		sqe->addr				= (unsigned long) requests[i].buffer;
+		sqe->len				= (unsigned) requests[i].size;
+		sqe->off				= (unsigned long long) requests[i].offset;
+		sqe->user_data			= (unsigned long long) i;
+		ring->sq_array[index]	= index;
+		tail++;
+	}
+
+	/* Kernel reads the entries once it sees the new tail */
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	while (completed < count) {
+		ret = syscall(__NR_io_uring_enter, ring->fd, (unsigned) (count - submitted), 1U, IORING_ENTER_GETEVENTS, NULL, 0);
+
+		if ((ret < 0) && (EINTR != errno) && (0 == submitted)) {
+			/* Take back the entries so the ring stays consistent */
+			__atomic_store_n(ring->sq_tail, tail - (unsigned) count, __ATOMIC_RELEASE);
+			return -1;
+		}
+
+		/* Submitted entries are in flight until they complete as their buffers are in use */
+		if (ret > 0) {
+			submitted += (int) ret;
+		}
+
+		head = *ring->cq_head;
+
+		while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+			if (cqe->res > 0) {
+				requests[cqe->user_data].done = (size_t) cqe->res;
+			}
+
+			completed++;
+			head++;
+		}
+
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_lock(&host_uring_lock);
+	host_uring_stats.submissions++;
+
+	if ((unsigned long) count > host_uring_stats.max_depth) {
+		host_uring_stats.max_depth = (unsigned long) count;
+	}
+
+	pthread_mutex_unlock(&host_uring_lock);
+	return 0;
+}
+#endif
+
+int8_t
+host_uring_available(
+	void
+) {
+#if defined(HOST_URING)
+	host_uring_ring_t ring;
+
+	if (0 != host_uring_setup(&ring)) {
+		return 0;
+	}
+
+	host_uring_teardown(&ring);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+static void *
+host_uring_open(
+	const char	*filename,
+	const char	*mode
+) {
+	host_uring_file_t *file = calloc(1, sizeof(host_uring_file_t));
+
+	if (NULL == file) {
+		return NULL;
+	}
+
+	file->fd = open(filename, host_open_flags(mode), 0666);
+
+	if (-1 == file->fd) {
+		free(file);
+		return NULL;
+	}
+
+#if defined(HOST_URING)
+	file->ring_ready = 0 == host_uring_setup(&file->ring);
+#endif
+	return file;
+}
+
+static int
+host_uring_close(
+	void *handle
+) {
+	host_uring_file_t	*file	= (host_uring_file_t *) handle;
+	int					result	= close(file->fd);
+
+#if defined(HOST_URING)
+	if (file->ring_ready) {
+		host_uring_teardown(&file->ring);
+	}
+#endif
+
+	free(file);
+	return 0 == result ? 0 : EOF;
+}
+
+static size_t
+host_uring_read_at(
+	void	*handle,
+	long	offset,
+	void	*buffer,
+	size_t	size
+) {
+	host_uring_file_t	*file	= (host_uring_file_t *) handle;
+	size_t				done	= 0;
+	ssize_t				n;
+
+	while (done < size) {
+		n = pread(file->fd, (char *) buffer + done, size - done, offset + (long) done);
+
+		if ((n < 0) && (EINTR == errno)) {
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+	return done;
+}
+
+static size_t
+host_uring_write_at(
+	void		*handle,
+	long		offset,
+	const void	*buffer,
+	size_t		size
+) {
+	host_uring_file_t	*file	= (host_uring_file_t *) handle;
+	size_t				done	= 0;
+	ssize_t				n;
+
+	while (done < size) {
+		n = pwrite(file->fd, (const char *) buffer + done, size - done, offset + (long) done);
+
+		if ((n < 0) && (EINTR == errno)) {
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+	return done;
+}
+
+/**
+@brief		Does a batch with io_uring in groups of ring entries. Accesses io_uring did not finish are done
+			with pread() and pwrite().
+*/
+static int
+host_uring_submit(
+	void				*handle,
+	host_io_request_t	*requests,
+	int					count
+) {
+	host_uring_file_t	*file		= (host_uring_file_t *) handle;
+	unsigned long		fallbacks	= 0;
+	int					result		= 0;
+	int					i;
+
+#if defined(HOST_URING)
+	for (i = 0; file->ring_ready && (i < count); i += (int) file->ring.entries) {
+		int group = count - i < (int) file->ring.entries ? count - i : (int) file->ring.entries;
+
+		if (0 != host_uring_run(file, requests + i, group)) {
+			/* Kernel refuses io_uring such as in a sandbox. Later batches use pread() and pwrite(). */
+			file->ring_ready = 0;
+		}
+	}
+#else
+	(void) file;
+#endif
+
+	for (i = 0; i < count; i++) {
+		host_io_request_t	*request	= &requests[i];
+		char				*buffer		= (char *) request->buffer + request->done;
+
+		if (request->done < request->size) {
+			fallbacks++;
+			request->done += request->write
+				? host_uring_write_at(handle, request->offset + (long) request->done, buffer, request->size - request->done)
+				: host_uring_read_at(handle, request->offset + (long) request->done, buffer, request->size - request->done);
+		}
+
+		if (request->done != request->size) {
+			result = -1;
+		}
+	}
+
+	pthread_mutex_lock(&host_uring_lock);
+	host_uring_stats.batches++;
+	host_uring_stats.operations += (unsigned long) count;
+	host_uring_stats.fallbacks	+= fallbacks;
+	pthread_mutex_unlock(&host_uring_lock);
+	return result;
+}
+
+static int
+host_uring_flush(
+	void *handle
+) {
+	/* Writes are not buffered in the process */
+	(void) handle;
+	return 0;
+}
+
+static long
+host_uring_length(
+	void *handle
+) {
+	struct stat st;
+
+	if (0 != fstat(((host_uring_file_t *) handle)->fd, &st)) {
+		return 0;
+	}
+
+	return (long) st.st_size;
+}
+
+const host_file_backend_t host_uring_backend = {
+	host_uring_open, host_uring_close, host_uring_read_at, host_uring_write_at, host_uring_flush, host_uring_length, NULL, NULL, NULL, host_uring_submit
+};
+
+#endif /* Clause ION_HOST_FILE */
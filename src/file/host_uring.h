@@ -0,0 +1,103 @@
+/******************************************************************************/
+/**
+@file		host_uring.h
+@author		IonDB Project Contributors
+@brief		io_uring engine for host files.
+@details	host_uring_backend reads and writes with pread() and pwrite() like
+			host_posix_backend and does batches of accesses with io_uring so
+			several are in flight at once. The write-behind queue gives all
+			queued pages to it as one batch. io_uring is used with system calls
+			so liburing is not needed. If the kernel or a sandbox does not allow
+			io_uring, batches are done with pread() and pwrite().
+@copyright	Copyright 2021
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(HOST_URING_H_)
+#define HOST_URING_H_
+
+#if defined(ION_HOST_FILE) && !defined(ARDUINO)
+
+#include <stdint.h>
+#include "host_stdio_c_iface.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief		Most accesses of a batch in flight at once. Larger batches are submitted in parts.
+*/
+#define HOST_URING_ENTRIES	64
+
+/**
+@brief		Totals of batches since host_uring_reset().
+*/
+typedef struct host_uring_stats {
+	unsigned long	batches;			/**< Batches given to the engine. */
+	unsigned long	submissions;		/**< Groups of accesses in flight together in io_uring. */
+	unsigned long	operations;			/**< Accesses of all batches. */
+	unsigned long	max_depth;			/**< Most accesses in flight at once. */
+	unsigned long	fallbacks;			/**< Accesses done with pread() or pwrite() as io_uring was not available or did not finish them. */
+} host_uring_stats_t;
+
+/**
+@brief		Totals of all files of host_uring_backend.
+*/
+extern host_uring_stats_t host_uring_stats;
+
+/**
+@brief		Backend of files using io_uring for batches. Select it with host_set_backend().
+*/
+extern const host_file_backend_t host_uring_backend;
+
+/**
+@brief		Sets totals of host_uring_stats to @c 0.
+*/
+void
+host_uring_reset(
+	void
+);
+
+/**
+@brief		Returns @c 1 if the kernel allows io_uring.
+*/
+int8_t
+host_uring_available(
+	void
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* Clause ION_HOST_FILE */
+
+#endif
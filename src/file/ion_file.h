@@ -66,12 +66,26 @@ typedef struct file_handle {
 #include "stdio.h"
 #include "unistd.h"
 
+#if defined(ION_HOST_FILE)
+
+#include "host_stdio_c_iface.h"
+#include "host_sim_device.h"
+#include "host_uring.h"
+
+typedef HOST_FILE *ion_file_handle_t;
+
+#else
+
 typedef FILE *ion_file_handle_t;
 
+#endif /* Clause ION_HOST_FILE */
+
 #define ION_NOFILE ((ion_file_handle_t) (NULL))
 
 #endif /* Clause ARDUINO */
 
+#include "kv_stdio_intercept.h"
+
 #define ION_FILE_NULL -1
 
 ion_boolean_t
@@ -72,6 +72,50 @@ extern "C" {
 }
 #endif
 
+#elif defined(ION_HOST_FILE) && !defined(ION_HOST_FILE_IMPL)
+
+#define  ION_FILE HOST_FILE
+#define  fopen(x, y)		host_fopen(x, y)
+#define  fclose(x)			host_fclose(x)
+#define  fwrite(w, x, y, z) host_fwrite(w, x, y, z)
+#define  fflush(x)			host_fflush(x)
+#define  fseek(x, y, z)		host_fseek(x, y, z)
+#define  fread(w, x, y, z)	host_fread(w, x, y, z)
+#define  ftell(x)			host_ftell(x)
+#define  fprefetch(x, y, z)	host_fprefetch(x, y, z)
+#define  fstalltime(x)		host_fstalltime(x)
+#define  fdevicetime(x)		host_fdevicetime(x)
+#define  fread_at(w, x, y, z, o)	host_fread_at(w, x, y, z, o)
+#define  fwrite_at(w, x, y, z, o)	host_fwrite_at(w, x, y, z, o)
+#define  fadvise(x, o, n, a)	host_fadvise(x, o, n, a)
+
 #endif /* Clause ARDUINO */
 
+/* Plain stdio files on hosts without the host file layer */
+#if !defined(ION_FILE)
+#define  ION_FILE FILE
+#endif
+
+/* Read-ahead hints, stall time, and device time are only supported by host files */
+#if !defined(fprefetch)
+#define  fprefetch(x, y, z)
+#endif
+#if !defined(fadvise)
+#define  fadvise(x, o, n, a)
+#endif
+#if !defined(fstalltime)
+#define  fstalltime(x)		0
+#endif
+#if !defined(fdevicetime)
+#define  fdevicetime(x)		0
+#endif
+
+/* Positional read and write. Files without them seek first and leave the position after the access. */
+#if !defined(fread_at)
+#define  fread_at(w, x, y, z, o)	(0 == fseek(z, o, SEEK_SET) ? fread(w, x, y, z) : 0)
+#endif
+#if !defined(fwrite_at)
+#define  fwrite_at(w, x, y, z, o)	(0 == fseek(z, o, SEEK_SET) ? fwrite(w, x, y, z) : 0)
+#endif
+
 #endif /* KV_STDIO_INTERCEPT_H_ */
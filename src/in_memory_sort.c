@@ -2,7 +2,7 @@
 /**
 @file
 @author		Kris Wallperington
-@brief		Implementation of an in-place, recursive quicksort written by the author.
+@brief		Implementation of an in-place, recursive quicksort written by the author and a non-recursive introsort.
 @copyright	Copyright 2016
 				The University of British Columbia,
 				IonDB Project Contributors (see AUTHORS.md)
@@ -21,11 +21,40 @@
 */
 /******************************************************************************/
 //TODO: quick sort throws a seg fault on pc when sorting large arrays (>20000). This may be due to the stack overflowing
-// from the recursive calls to in_memory_quick_sort_helper(...)
+// from the recursive calls to in_memory_quick_sort_helper(...). Use IN_MEMORY_SORT_INTRO for large arrays.
 
 #include <string.h>
 
 #include "in_memory_sort.h"
+#include "external_sort.h"
+
+/* Comparison of values. Order-preserving prefix of key of key_type at key_offset is compared inline before calling compare_fcn. */
+typedef struct {
+	int8_t		(*compare_fcn)(void* a, void* b);
+	int8_t		key_type;
+	uint16_t	key_offset;
+	uint16_t	key_size;
+} in_memory_compare_t;
+
+/**
+ * Compares values a and b. Calls compare_fcn only if key prefixes are equal or key type is KEY_TYPE_OTHER.
+ */
+static inline int8_t
+in_memory_compare(
+	in_memory_compare_t	*compare,
+	char				*a,
+	char				*b
+) {
+	int8_t c = 0;
+
+	if (compare->key_type != KEY_TYPE_OTHER) {
+		c = external_sort_compare_prefix(a + compare->key_offset, b + compare->key_offset, compare->key_type, compare->key_size);
+	}
+	if (c == 0) {
+		c = compare->compare_fcn(a, b);
+	}
+	return c;
+}
 
 int8_t
 merge_sort_int32_comparator(
@@ -54,7 +83,7 @@ void*
 in_memory_quick_sort_partition(
 	void *tmp_buffer,
 	int value_size,
-	int8_t (*compare_fcn)(void* a, void* b),
+	in_memory_compare_t *compare,
 	char* low,
 	char* high
 ) {
@@ -65,11 +94,11 @@ in_memory_quick_sort_partition(
 	while (1) {
 		do {
 			upper_bound -= value_size;
-		} while (compare_fcn(upper_bound, pivot) > 0);
+		} while (in_memory_compare(compare, upper_bound, pivot) > 0);
 
 		do {
 			lower_bound += value_size;
-		} while (compare_fcn(lower_bound, pivot) < 0);
+		} while (in_memory_compare(compare, lower_bound, pivot) < 0);
 
 		if (lower_bound < upper_bound) {
 			in_memory_swap(tmp_buffer, value_size, lower_bound, upper_bound);
@@ -85,15 +114,15 @@ in_memory_quick_sort_helper(
 	void *tmp_buffer,
 	uint32_t num_values,
 	int value_size,
-	int8_t (*compare_fcn)(void* a, void* b),
+	in_memory_compare_t *compare,
 	char* low,
 	char* high
 ) {
 	if (low < high) {
-		char* pivot = in_memory_quick_sort_partition(tmp_buffer, value_size, compare_fcn, low, high);
+		char* pivot = in_memory_quick_sort_partition(tmp_buffer, value_size, compare, low, high);
 
-		in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare_fcn, low, pivot);
-		in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare_fcn, pivot + value_size, high);
+		in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare, low, pivot);
+		in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare, pivot + value_size, high);
 	}
 }
 
@@ -102,20 +131,348 @@ in_memory_quick_sort(
 	void *data,
 	uint32_t num_values,
 	int value_size,
-	int8_t (*compare_fcn)(void* a, void* b)
+	in_memory_compare_t *compare
 ) {
 	void* tmp_buffer = malloc(value_size);
 	if(NULL == tmp_buffer) return 8;
 
 	/*void* low = data*/
 	char* high = (char*)data + (num_values-1)*value_size;
-	in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare_fcn, (char*)data, high);
+	in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare, (char*)data, high);
+
+	free(tmp_buffer);
+
+	return 0;
+}
+
+/**
+ * Swaps count values starting at a going up with count values starting at b going down.
+ */
+void
+in_memory_swap_range(
+	void *tmp_buffer,
+	int value_size,
+	char* a,
+	char* b,
+	uint32_t count
+) {
+	for (; count > 0; count--) {
+		in_memory_swap(tmp_buffer, value_size, a, b);
+		a += value_size;
+		b -= value_size;
+	}
+}
+
+/* Ranges with at most this many values are sorted using insertion sort */
+#define INTRO_SORT_INSERTION_CUTOFF	16
+/* Maximum number of ranges waiting to be sorted. Smaller range is always sorted first so at most log2(num_values). */
+#define INTRO_SORT_STACK_SIZE		32
+
+void
+in_memory_insertion_sort(
+	void *tmp_buffer,
+	int value_size,
+	in_memory_compare_t *compare,
+	char* low,
+	char* high
+) {
+	char* next;
+	char* pos;
+
+	for (next = low + value_size; next <= high; next += value_size) {
+		if (in_memory_compare(compare, next - value_size, next) <= 0) {
+			continue;
+		}
+
+		/* Shift larger values up one position and insert */
+		memcpy(tmp_buffer, next, value_size);
+		pos = next - value_size;
+		while (pos > low && in_memory_compare(compare, pos - value_size, tmp_buffer) > 0) {
+			pos -= value_size;
+		}
+		memmove(pos + value_size, pos, next - pos);
+		memcpy(pos, tmp_buffer, value_size);
+	}
+}
+
+void
+in_memory_heap_sort(
+	void *tmp_buffer,
+	int value_size,
+	in_memory_compare_t *compare,
+	char* low,
+	uint32_t num_values
+) {
+	uint32_t start, end, root, child;
+
+	/* Build max heap then repeatedly move largest value to end */
+	for (end = num_values, start = num_values / 2; end > 1; ) {
+		if (start > 0) {
+			start--;
+		}
+		else {
+			end--;
+			in_memory_swap(tmp_buffer, value_size, low, low + end * value_size);
+		}
+
+		for (root = start; (child = 2 * root + 1) < end; root = child) {
+			if (child + 1 < end && in_memory_compare(compare, low + child * value_size, low + (child + 1) * value_size) < 0) {
+				child++;
+			}
+			if (in_memory_compare(compare, low + root * value_size, low + child * value_size) >= 0) {
+				break;
+			}
+			in_memory_swap(tmp_buffer, value_size, low + root * value_size, low + child * value_size);
+		}
+	}
+}
+
+/**
+ * Orders first, middle, and last value of range. Middle value is the pivot.
+ */
+char*
+in_memory_median_of_three(
+	void *tmp_buffer,
+	int value_size,
+	in_memory_compare_t *compare,
+	char* low,
+	char* high
+) {
+	char* mid = low + ((high - low) / value_size / 2) * value_size;
+
+	if (in_memory_compare(compare, mid, low) < 0) {
+		in_memory_swap(tmp_buffer, value_size, mid, low);
+	}
+	if (in_memory_compare(compare, high, mid) < 0) {
+		in_memory_swap(tmp_buffer, value_size, high, mid);
+		if (in_memory_compare(compare, mid, low) < 0) {
+			in_memory_swap(tmp_buffer, value_size, mid, low);
+		}
+	}
+	return mid;
+}
+
+/**
+ * Non-recursive introsort. Quicksort with median of three pivot and 3-way partition so values equal to the pivot are
+ * not sorted again. Small ranges use insertion sort. Ranges that partition poorly too many times use heap sort.
+ * Stack use is bounded as the smaller range is sorted first.
+ */
+int
+in_memory_intro_sort(
+	void *data,
+	uint32_t num_values,
+	int value_size,
+	in_memory_compare_t *compare
+) {
+	char*		stack_low[INTRO_SORT_STACK_SIZE];
+	char*		stack_high[INTRO_SORT_STACK_SIZE];
+	int8_t		stack_depth[INTRO_SORT_STACK_SIZE];
+	int8_t		stack_size = 0;
+	char		*low, *high, *lt, *gt, *small_low;
+	char		*b, *c, *eq_low, *eq_high;
+	int8_t		depth_limit = 0;
+	int8_t		cmp;
+	uint32_t	n, left_n, right_n, small_n;
+
+	if (num_values < 2) return 0;
+
+	/* Buffer for swaps and a copy of the pivot */
+	char* tmp_buffer = malloc(2 * value_size);
+	if(NULL == tmp_buffer) return 8;
+	char* pivot = tmp_buffer + value_size;
+
+	for (n = num_values; n > 1; n >>= 1) {
+		depth_limit += 2;
+	}
+
+	low = (char*)data;
+	high = (char*)data + (num_values-1)*value_size;
+
+	while (1) {
+		n = (high - low) / value_size + 1;
+
+		if (n > INTRO_SORT_INSERTION_CUTOFF && depth_limit > 0) {
+			depth_limit--;
+
+			memcpy(pivot, in_memory_median_of_three(tmp_buffer, value_size, compare, low, high), value_size);
+
+			/* 3-way partition (Bentley-McIlroy). Values equal to pivot are collected at both ends then swapped to the middle.
+			   Result is [low, lt) < pivot, [lt, gt] == pivot, (gt, high] > pivot. Median of three guarantees
+			   *low <= pivot <= *high so scans stay in range. */
+			eq_low = b = low;
+			eq_high = c = high;
+			while (1) {
+				while (b <= c && (cmp = in_memory_compare(compare, b, pivot)) <= 0) {
+					if (cmp == 0) {
+						in_memory_swap(tmp_buffer, value_size, eq_low, b);
+						eq_low += value_size;
+					}
+					b += value_size;
+				}
+				while (c >= b && (cmp = in_memory_compare(compare, c, pivot)) >= 0) {
+					if (cmp == 0) {
+						in_memory_swap(tmp_buffer, value_size, c, eq_high);
+						eq_high -= value_size;
+					}
+					c -= value_size;
+				}
+				if (b > c) {
+					break;
+				}
+				in_memory_swap(tmp_buffer, value_size, b, c);
+				b += value_size;
+				c -= value_size;
+			}
+
+			left_n = (b - eq_low) / value_size;
+			right_n = (eq_high - c) / value_size;
+			in_memory_swap_range(tmp_buffer, value_size, low, b - value_size, (eq_low - low) / value_size < left_n ? (eq_low - low) / value_size : left_n);
+			in_memory_swap_range(tmp_buffer, value_size, b, high, (high - eq_high) / value_size < right_n ? (high - eq_high) / value_size : right_n);
+			lt = low + left_n * value_size;
+			gt = high - right_n * value_size;
+
+			/* Sort smaller range next and save larger range. Ranges of one value are already sorted. */
+			if (left_n > right_n) {
+				small_low = gt + value_size;
+				small_n = right_n;
+				high = lt - value_size;
+				n = left_n;
+			}
+			else {
+				small_low = low;
+				small_n = left_n;
+				low = gt + value_size;
+				n = right_n;
+			}
+
+			if (small_n > 1) {
+				if (n > 1) {
+					stack_low[stack_size] = low;
+					stack_high[stack_size] = high;
+					stack_depth[stack_size] = depth_limit;
+					stack_size++;
+				}
+				low = small_low;
+				high = small_low + (small_n - 1) * value_size;
+				continue;
+			}
+			if (n > 1) {
+				continue;
+			}
+		}
+		else if (n <= INTRO_SORT_INSERTION_CUTOFF) {
+			in_memory_insertion_sort(tmp_buffer, value_size, compare, low, high);
+		}
+		else {
+			in_memory_heap_sort(tmp_buffer, value_size, compare, low, n);
+		}
+
+		if (stack_size == 0) {
+			break;
+		}
+		stack_size--;
+		low = stack_low[stack_size];
+		high = stack_high[stack_size];
+		depth_limit = stack_depth[stack_size];
+	}
 
 	free(tmp_buffer);
 
 	return 0;
 }
 
+/* Bits per radix sort digit. Fewer buckets on Arduino to save memory. */
+#if defined(ARDUINO)
+#define RADIX_SORT_DIGIT_BITS		4
+#else
+#define RADIX_SORT_DIGIT_BITS		8
+#endif
+#define RADIX_SORT_BUCKETS			(1 << RADIX_SORT_DIGIT_BITS)
+
+/**
+ * Returns the digit of the key at the start of value starting at bit shift. Sign bit is flipped for signed keys so they order as unsigned.
+ */
+static uint8_t
+in_memory_radix_digit(
+	char* value,
+	int sort_algorithm,
+	uint8_t shift
+) {
+	if (sort_algorithm == IN_MEMORY_SORT_RADIX_INT64) {
+		uint64_t key;
+		memcpy(&key, value, sizeof(uint64_t));
+		return (uint8_t) (((key ^ 0x8000000000000000ULL) >> shift) & (RADIX_SORT_BUCKETS - 1));
+	}
+
+	uint32_t key;
+	memcpy(&key, value, sizeof(uint32_t));
+	if (sort_algorithm == IN_MEMORY_SORT_RADIX_INT32) {
+		key ^= 0x80000000UL;
+	}
+	return (uint8_t) ((key >> shift) & (RADIX_SORT_BUCKETS - 1));
+}
+
+/**
+ * LSD radix sort on integer key at start of each value. Values are distributed into the caller's scratch area of num_values values
+ * on each pass. Passes where every key has the same digit are skipped. Sorts with introsort if there is no scratch area.
+ */
+int
+in_memory_radix_sort(
+	void *data,
+	uint32_t num_values,
+	int value_size,
+	in_memory_compare_t *compare,
+	int sort_algorithm,
+	void *scratch
+) {
+	uint32_t	count[RADIX_SORT_BUCKETS];
+	char		*src, *dst, *tmp, *value;
+	uint32_t	i, sum, c;
+	uint8_t		shift;
+	uint8_t		key_bits = sort_algorithm == IN_MEMORY_SORT_RADIX_INT64 ? 64 : 32;
+
+	if (num_values < 2) return 0;
+
+	if (NULL == scratch) {
+		return in_memory_intro_sort(data, num_values, value_size, compare);
+	}
+
+	src = (char*)data;
+	dst = (char*)scratch;
+
+	for (shift = 0; shift < key_bits; shift += RADIX_SORT_DIGIT_BITS) {
+		memset(count, 0, RADIX_SORT_BUCKETS * sizeof(uint32_t));
+		for (i = 0, value = src; i < num_values; i++, value += value_size) {
+			count[in_memory_radix_digit(value, sort_algorithm, shift)]++;
+		}
+
+		if (count[in_memory_radix_digit(src, sort_algorithm, shift)] == num_values) {
+			continue;
+		}
+
+		/* Convert counts to starting position of each bucket */
+		for (i = 0, sum = 0; i < RADIX_SORT_BUCKETS; i++) {
+			c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+
+		for (i = 0, value = src; i < num_values; i++, value += value_size) {
+			memcpy(dst + (size_t) (count[in_memory_radix_digit(value, sort_algorithm, shift)]++) * value_size, value, value_size);
+		}
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != (char*)data) {
+		memcpy(data, src, (size_t) num_values * value_size);
+	}
+
+	return 0;
+}
+
 int
 in_memory_sort(
 	void *data,
@@ -124,10 +481,48 @@ in_memory_sort(
 	int8_t (*compare_fcn)(void* a, void* b),
 	int sort_algorithm
 ) {
+	return in_memory_sort_prefix(data, num_values, value_size, compare_fcn, sort_algorithm, NULL, KEY_TYPE_OTHER, 0, 0);
+}
+
+int
+in_memory_sort_scratch(
+	void *data,
+	uint32_t num_values,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b),
+	int sort_algorithm,
+	void *scratch
+) {
+	return in_memory_sort_prefix(data, num_values, value_size, compare_fcn, sort_algorithm, scratch, KEY_TYPE_OTHER, 0, 0);
+}
+
+int
+in_memory_sort_prefix(
+	void *data,
+	uint32_t num_values,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b),
+	int sort_algorithm,
+	void *scratch,
+	int8_t key_type,
+	uint16_t key_offset,
+	uint16_t key_size
+) {
+	in_memory_compare_t compare = {compare_fcn, key_type, key_offset, key_size};
 	int err = 0;
 	switch (sort_algorithm) {
-		case 1: {
-			err = in_memory_quick_sort(data, num_values, value_size, compare_fcn);
+		case IN_MEMORY_SORT_QUICK: {
+			err = in_memory_quick_sort(data, num_values, value_size, &compare);
+			break;
+		}
+		case IN_MEMORY_SORT_INTRO: {
+			err = in_memory_intro_sort(data, num_values, value_size, &compare);
+			break;
+		}
+		case IN_MEMORY_SORT_RADIX_INT32:
+		case IN_MEMORY_SORT_RADIX_UINT32:
+		case IN_MEMORY_SORT_RADIX_INT64: {
+			err = in_memory_radix_sort(data, num_values, value_size, &compare, sort_algorithm, scratch);
 			break;
 		}
 	}
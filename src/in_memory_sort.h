@@ -9,6 +9,17 @@ extern "C" {
 #include <stdint.h>
 // #include <alloca.h>
 
+/* Values for sort_algorithm */
+#define IN_MEMORY_SORT_QUICK	1		/* Recursive quicksort */
+#define IN_MEMORY_SORT_INTRO	2		/* Non-recursive introsort with 3-way partition */
+/* Radix sort on integer key at start of value. Key must be in native byte order. */
+#define IN_MEMORY_SORT_RADIX_INT32	3
+#define IN_MEMORY_SORT_RADIX_UINT32	4
+#define IN_MEMORY_SORT_RADIX_INT64	5
+
+/**
+ * Sorts num_values values of value_size bytes at data. Radix sort algorithms sort with introsort as there is no scratch area.
+ */
 int
 in_memory_sort(
 	void *data,
@@ -18,6 +29,38 @@ in_memory_sort(
 	int sort_algorithm
 );
 
+/**
+ * Same as in_memory_sort() but radix sort distributes values into scratch, which holds num_values values. No memory is allocated.
+ * Radix sort algorithms sort with introsort if scratch is NULL.
+ */
+int
+in_memory_sort_scratch(
+	void *data,
+	uint32_t num_values,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b),
+	int sort_algorithm,
+	void *scratch
+);
+
+/**
+ * Same as in_memory_sort_scratch() but compares the order-preserving prefix of the key of key_type (KEY_TYPE_* of external_sort.h) at
+ * key_offset inline and calls compare_fcn only if prefixes are equal. Prefix order must agree with compare_fcn.
+ * KEY_TYPE_OTHER calls compare_fcn for every comparison.
+ */
+int
+in_memory_sort_prefix(
+	void *data,
+	uint32_t num_values,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b),
+	int sort_algorithm,
+	void *scratch,
+	int8_t key_type,
+	uint16_t key_offset,
+	uint16_t key_size
+);
+
 /**
  * Compares two records based on an integer key. Uses a and b as pointers to start of record. Assumes key is at start of record.
  */
@@ -0,0 +1,450 @@
+/******************************************************************************/
+/**
+@file		main_host.c
+@author		IonDB Project Contributors
+@brief		Benchmark driver for Linux hosts. Sorts generated data for each combination
+			of buffer pages, page size, record size, dataset size, data distribution, and
+			run generation strategy and writes every metric and the wall time as CSV or JSON.
+@details	Usage: program [-f csv|json] [-o file] [-s seed] [-g strategy] [-q] [-t]
+				-f	Output format (default csv).
+				-o	Output file (default stdout). Sort progress is printed to stdout.
+				-s	Random seed for data generation (default 2020).
+				-g	Only run this run generation strategy (default all). Names are in strategies[].
+				-q	Quick sweep with fewer configurations.
+				-t	Run the tests of test_no_output_buffer_sort_replace.h instead. Exits with 1 if a check fails.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "test_no_output_buffer_sort_replace.h"
+
+#define BENCH_INPUT_FILE    "bench_in.bin"
+#define BENCH_OUTPUT_FILE   "bench_out.bin"
+
+#define BENCH_FORMAT_CSV    0
+#define BENCH_FORMAT_JSON   1
+
+/* Data distribution of a benchmark. testDataType, percentRandom, and numDistinct are as for external_sort_write_test_data(). */
+typedef struct {
+    const char  *name;
+    int         testDataType;
+    int         percentRandom;
+    int         numDistinct;
+} bench_distribution_t;
+
+/* Run generation strategy of a benchmark. If profileBlocks > 0, the sort chooses the strategy from a sample of input. */
+typedef struct {
+    const char  *name;
+    int8_t      runGenAlgorithm;
+    int8_t      profileBlocks;
+} bench_strategy_t;
+
+/* Results of one benchmark configuration */
+typedef struct {
+    int         bufferPages;
+    int         pageSize;
+    int         recordSize;
+    int32_t     numRecords;
+    const char  *distribution;
+    const char  *strategy;
+    int         writePages;         /* Write-behind queue pages of output file. 0 if writes are not queued. */
+    int         err;
+    int         sorted;
+    double      wallMs;
+    double      queueDepth;         /* Average accesses in flight per io_uring submission. 0 if no batches were submitted. */
+    double      iops;               /* Block reads and writes per second */
+    metrics_t   metric;
+} bench_result_t;
+
+static const bench_distribution_t distributions[] = {
+    {"sorted", 0, 0, 0},
+    {"reverse", 1, 0, 0},
+    {"random", 2, 0, EXTERNAL_SORT_MAX_RAND},
+    {"random64", 2, 0, 64},
+    {"random10pct", 3, 10, 0}
+};
+
+/* Merge run generation is only used with 2 buffer pages. It is replacement selection otherwise. */
+static const bench_strategy_t strategies[] = {
+    {"replacement", RUN_GEN_REPLACEMENT_SELECTION, 0},
+    {"replacement_index", RUN_GEN_REPLACEMENT_SELECTION_INDEX, 0},
+    {"load_sort_store", RUN_GEN_LOAD_SORT_STORE, 0},
+    {"natural_runs", RUN_GEN_NATURAL_RUNS, 0},
+    {"merge", RUN_GEN_MERGE, 0},
+    {"auto", RUN_GEN_REPLACEMENT_SELECTION, 4}
+};
+
+static const int fullPages[] = {2, 4, 8, 16, 32};
+static const int fullPageSizes[] = {512, 4096};
+static const int fullRecordSizes[] = {16, 64};
+static const int32_t fullNumRecords[] = {64, 10000, 100000};       /* 64 records fit in the buffer for most settings */
+
+static const int quickPages[] = {2, 4, 16};
+static const int quickPageSizes[] = {512};
+static const int quickRecordSizes[] = {16};
+static const int32_t quickNumRecords[] = {64, 10000};
+
+#define ARRAY_COUNT(a) ((int) (sizeof(a) / sizeof((a)[0])))
+
+/**
+ * Selects the storage of benchmark files: file (pread/pwrite), direct (pread/pwrite with O_DIRECT), mmap (mapped files), uring
+ * (pread/pwrite with batches of queued writes in io_uring), stdio, ram, or sd (simulated SD card storing data in RAM).
+ * latencies, if not NULL, sets the simulated device as page_size,read_us,write_us,seek_us,erase_block_size,erase_us,cluster_size,cluster_us.
+ * ramBudget, if > 0, is the most bytes kept in RAM by ram and sd files. Bytes past it spill to stdio files.
+ * Returns 0 if success.
+ */
+static int bench_set_device(const char *name, const char *latencies, long ramBudget)
+{
+#if defined(ION_HOST_FILE)
+    host_sim_device_t *d = &host_sim_device;
+
+    host_ram_set_budget(ramBudget > 0 ? (size_t) ramBudget : 0);
+    if (0 == strcmp(name, "sd"))
+        host_set_backend(&host_sim_backend);
+    else if (0 == strcmp(name, "ram"))
+        host_set_backend(&host_ram_backend);
+    else if (0 == strcmp(name, "file"))
+        host_set_backend(NULL);
+    else if (0 == strcmp(name, "direct"))
+        host_set_backend(&host_direct_backend);
+    else if (0 == strcmp(name, "mmap"))
+        host_set_backend(&host_mmap_backend);
+    else if (0 == strcmp(name, "uring"))
+        host_set_backend(&host_uring_backend);
+    else if (0 == strcmp(name, "stdio"))
+        host_set_backend(&host_stdio_backend);
+    else
+        return 1;
+
+    if (NULL != latencies && 8 != sscanf(latencies, "%hu,%lu,%lu,%lu,%u,%lu,%u,%lu", &d->page_size, &d->read_us, &d->write_us,
+                                        &d->seek_us, &d->erase_block_size, &d->erase_us, &d->cluster_size, &d->cluster_us))
+        return 1;
+    return 0;
+#else
+    /* Only stdio files without the host file layer */
+    return 0 != strcmp(name, "file") || NULL != latencies || ramBudget > 0;
+#endif
+}
+
+/**
+ * Returns wall time in milliseconds with microsecond resolution.
+ */
+static double bench_wall_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * Generates data, sorts it, and verifies the sorted output. Returns 0 if the benchmark ran (result->err has any sort error).
+ */
+static int bench_run(bench_result_t *result, const bench_distribution_t *dist, const bench_strategy_t *strategy, int seed)
+{
+    external_sort_t     es;
+    verify_sink_state_t sinkState;
+    long                resultFilePtr;
+
+    es.key_size = sizeof(int32_t);
+    es.value_size = result->recordSize - es.key_size;
+    es.headerSize = BLOCK_HEADER_SIZE;
+    es.record_size = result->recordSize;
+    es.page_size = result->pageSize;
+    es.compare_fcn = merge_sort_int32_comparator;
+    es.run_gen_algorithm = strategy->runGenAlgorithm;
+    es.key_type = KEY_TYPE_INT32;
+    es.output_sink = NULL;
+    es.output_sink_state = NULL;
+    es.heap_arity = 0;
+    es.key_prefix_compare = 0;
+    es.key_offset = 0;
+    es.presorted_fast_path = 0;
+    es.max_disorder = 0;
+    es.two_way_runs = 0;
+    es.profile_blocks = strategy->profileBlocks;
+    es.in_memory_algorithm = 0;
+    es.merge_fan_in = 0;
+
+    int32_t valuesPerPage = (es.page_size - es.headerSize) / es.record_size;
+    es.num_pages = (uint32_t) (result->numRecords + valuesPerPage - 1) / valuesPerPage;
+
+    /* Blocks are aligned for O_DIRECT */
+    char *buffer;
+    if (0 != posix_memalign((void **) &buffer, 4096, (size_t) result->bufferPages * es.page_size + es.record_size))
+        return 8;
+    char *tupleBuffer = buffer + es.page_size * result->bufferPages;
+
+    ION_FILE *fp = fopen(BENCH_INPUT_FILE, "w+b");
+    ION_FILE *outFilePtr = fopen(BENCH_OUTPUT_FILE, "w+b");
+    if (NULL == fp || NULL == outFilePtr)
+    {
+        if (NULL != fp)
+            fclose(fp);
+        if (NULL != outFilePtr)
+            fclose(outFilePtr);
+        free(buffer);
+        return 10;
+    }
+#if defined(ION_HOST_FILE)
+    if (result->writePages > 0 && 0 != host_set_write_behind(outFilePtr, (int16_t) result->writePages, es.page_size))
+    {
+        fclose(fp);
+        fclose(outFilePtr);
+        free(buffer);
+        return 8;
+    }
+    host_uring_reset();
+#endif
+
+    srand(seed);
+    external_sort_write_test_data(fp, result->numRecords, es.record_size, dist->testDataType, &es, dist->percentRandom, dist->numDistinct);
+    fflush(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    file_iterator_state_t iteratorState;
+    iteratorState.file = fp;
+    iteratorState.recordsRead = 0;
+    iteratorState.totalRecords = result->numRecords;
+    iteratorState.recordSize = es.record_size;
+
+    int32_t (*iterator)(void*, void*, int32_t) = &fileBlockIterator;
+    void    *state = &iteratorState;
+#if defined(ION_HOST_FILE)
+    /* Records of a mapped input file are copied from the mapping */
+    mapped_iterator_state_t mapState;
+    mapState.records = (const char*) host_fmap(fp, 0, (long) result->numRecords * es.record_size);
+    mapState.recordsRead = 0;
+    mapState.totalRecords = result->numRecords;
+    mapState.recordSize = es.record_size;
+    if (NULL != mapState.records)
+    {
+        iterator = &mappedBlockIterator;
+        state = &mapState;
+    }
+    fadvise(fp, 0, 0, ION_FILE_ADVICE_SEQUENTIAL);
+#endif
+
+    memset(&result->metric, 0, sizeof(metrics_t));
+
+    double start = bench_wall_ms();
+    result->err = no_output_buffer_sort_replace_block(iterator, state, tupleBuffer, outFilePtr, buffer, result->bufferPages, &es, &resultFilePtr, &result->metric, merge_sort_int32_comparator, 0);
+    result->wallMs = bench_wall_ms() - start;
+    result->metric.time = result->wallMs / 1000.0;
+    result->iops = result->wallMs > 0 ? (result->metric.num_reads + result->metric.num_writes) / (result->wallMs / 1000.0) : 0;
+    result->queueDepth = 0;
+#if defined(ION_HOST_FILE)
+    if (host_uring_stats.submissions > 0)
+        result->queueDepth = (double) (host_uring_stats.operations - host_uring_stats.fallbacks) / host_uring_stats.submissions;
+#endif
+
+    sinkState.es = &es;
+    sinkState.numRecords = 0;
+    sinkState.lastKey = 0;
+    sinkState.sorted = 1;
+    fseek(outFilePtr, resultFilePtr, SEEK_SET);
+    for (uint32_t i = 0; 0 == result->err && i < es.num_pages; i++)
+    {
+        if (0 == fread(buffer, es.page_size, 1, outFilePtr))
+            break;
+        verifySortedSink(&sinkState, buffer);
+    }
+    result->sorted = 0 == result->err && sinkState.sorted && sinkState.numRecords == result->numRecords;
+
+    fclose(fp);
+    fclose(outFilePtr);
+    free(buffer);
+    return 0;
+}
+
+static void bench_write_header(FILE *out, int format)
+{
+    if (BENCH_FORMAT_JSON == format)
+        fprintf(out, "[\n");
+    else
+        fprintf(out, "buffer_pages,page_size,record_size,num_records,distribution,run_gen,err,sorted,wall_ms,"
+            "num_reads,num_writes,num_memcpys,num_compar,num_runs,time,gen_time,stall_time,device_time,"
+            "plan_run_gen,plan_in_memory_algorithm,plan_fan_in,predicted_runs,predicted_io,disorder_violations,queue_depth,iops\n");
+}
+
+static void bench_write_result(FILE *out, int format, bench_result_t *r, int first)
+{
+    if (BENCH_FORMAT_JSON == format)
+        fprintf(out, "%s  {\"buffer_pages\": %d, \"page_size\": %d, \"record_size\": %d, \"num_records\": %ld, \"distribution\": \"%s\", \"run_gen\": \"%s\", "
+            "\"err\": %d, \"sorted\": %d, \"wall_ms\": %.3f, \"num_reads\": %lu, \"num_writes\": %lu, \"num_memcpys\": %lu, "
+            "\"num_compar\": %lu, \"num_runs\": %lu, \"time\": %.6f, \"gen_time\": %lu, \"stall_time\": %lu, \"device_time\": %lu, "
+            "\"plan_run_gen\": %d, \"plan_in_memory_algorithm\": %d, \"plan_fan_in\": %d, \"predicted_runs\": %lu, \"predicted_io\": %lu, \"disorder_violations\": %lu, "
+            "\"queue_depth\": %.2f, \"iops\": %.0f}",
+            first ? "" : ",\n", r->bufferPages, r->pageSize, r->recordSize, (long) r->numRecords, r->distribution, r->strategy, r->err, r->sorted, r->wallMs,
+            (unsigned long) r->metric.num_reads, (unsigned long) r->metric.num_writes, (unsigned long) r->metric.num_memcpys,
+            (unsigned long) r->metric.num_compar, (unsigned long) r->metric.num_runs, r->metric.time,
+            (unsigned long) r->metric.genTime, (unsigned long) r->metric.stallTime, (unsigned long) r->metric.deviceTime, r->metric.plan_run_gen, r->metric.plan_in_memory_algorithm,
+            r->metric.plan_fan_in, (unsigned long) r->metric.predicted_runs, (unsigned long) r->metric.predicted_io,
+            (unsigned long) r->metric.disorder_violations, r->queueDepth, r->iops);
+    else
+        fprintf(out, "%d,%d,%d,%ld,%s,%s,%d,%d,%.3f,%lu,%lu,%lu,%lu,%lu,%.6f,%lu,%lu,%lu,%d,%d,%d,%lu,%lu,%lu,%.2f,%.0f\n",
+            r->bufferPages, r->pageSize, r->recordSize, (long) r->numRecords, r->distribution, r->strategy, r->err, r->sorted, r->wallMs,
+            (unsigned long) r->metric.num_reads, (unsigned long) r->metric.num_writes, (unsigned long) r->metric.num_memcpys,
+            (unsigned long) r->metric.num_compar, (unsigned long) r->metric.num_runs, r->metric.time,
+            (unsigned long) r->metric.genTime, (unsigned long) r->metric.stallTime, (unsigned long) r->metric.deviceTime, r->metric.plan_run_gen, r->metric.plan_in_memory_algorithm,
+            r->metric.plan_fan_in, (unsigned long) r->metric.predicted_runs, (unsigned long) r->metric.predicted_io,
+            (unsigned long) r->metric.disorder_violations, r->queueDepth, r->iops);
+    (fflush)(out);
+}
+
+int main(int argc, char **argv)
+{
+    int         format = BENCH_FORMAT_CSV;
+    int         quick = 0;
+    int         tests = 0;
+    int         seed = 2020;
+    const char  *outName = NULL;
+    const char  *strategyName = NULL;
+    const char  *deviceName = "file";
+    const char  *latencies = NULL;
+    long        ramBudget = 0;
+    int         writePages = 0;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "f:o:s:g:d:D:r:w:qt")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                format = 0 == strcmp(optarg, "json") ? BENCH_FORMAT_JSON : BENCH_FORMAT_CSV;
+                break;
+            case 'o':
+                outName = optarg;
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            case 'g':
+                strategyName = optarg;
+                break;
+            case 'd':
+                deviceName = optarg;
+                break;
+            case 'D':
+                latencies = optarg;
+                break;
+            case 'r':
+                ramBudget = atol(optarg);
+                break;
+            case 'w':
+                writePages = atoi(optarg);
+                break;
+            case 'q':
+                quick = 1;
+                break;
+            case 't':
+                tests = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f csv|json] [-o file] [-s seed] [-g strategy] [-d file|direct|mmap|uring|stdio|ram|sd] [-D latencies] [-r ram_budget] [-w write_pages] [-q] [-t]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (tests)
+        return 0 == runalltests() ? 0 : 1;
+    if (0 != bench_set_device(deviceName, latencies, ramBudget))
+    {
+        fprintf(stderr, "Error: Unsupported device %s or latencies %s\n", deviceName, NULL != latencies ? latencies : "");
+        return 1;
+    }
+
+    const int       *pages = quick ? quickPages : fullPages;
+    const int       *pageSizes = quick ? quickPageSizes : fullPageSizes;
+    const int       *recordSizes = quick ? quickRecordSizes : fullRecordSizes;
+    const int32_t   *numRecords = quick ? quickNumRecords : fullNumRecords;
+    int numPages = quick ? ARRAY_COUNT(quickPages) : ARRAY_COUNT(fullPages);
+    int numPageSizes = quick ? ARRAY_COUNT(quickPageSizes) : ARRAY_COUNT(fullPageSizes);
+    int numRecordSizes = quick ? ARRAY_COUNT(quickRecordSizes) : ARRAY_COUNT(fullRecordSizes);
+    int numDatasets = quick ? ARRAY_COUNT(quickNumRecords) : ARRAY_COUNT(fullNumRecords);
+
+    /* Results go to their own stream as the sort prints progress to stdout */
+    /* Results file is a stdio file. Parentheses prevent the host file layer macros replacing fopen/fflush/fclose. */
+    FILE *out = stdout;
+    if (NULL != outName && NULL == (out = (fopen)(outName, "w")))
+    {
+        fprintf(stderr, "Error: Can't open %s\n", outName);
+        return 1;
+    }
+
+    bench_result_t  result;
+    int             first = 1, failed = 0;
+    bench_write_header(out, format);
+    for (int ps = 0; ps < numPageSizes; ps++)
+        for (int rs = 0; rs < numRecordSizes; rs++)
+            for (int n = 0; n < numDatasets; n++)
+                for (int m = 0; m < numPages; m++)
+                    for (int d = 0; d < ARRAY_COUNT(distributions); d++)
+                        for (int g = 0; g < ARRAY_COUNT(strategies); g++)
+                        {
+                            if (NULL != strategyName && 0 != strcmp(strategyName, strategies[g].name))
+                                continue;
+                            result.bufferPages = pages[m];
+                            result.pageSize = pageSizes[ps];
+                            result.recordSize = recordSizes[rs];
+                            result.numRecords = numRecords[n];
+                            result.distribution = distributions[d].name;
+                            result.strategy = strategies[g].name;
+                            result.writePages = writePages;
+
+                            int status = bench_run(&result, &distributions[d], &strategies[g], seed);
+                            if (0 != status)
+                            {
+                                fprintf(stderr, "Error %d: M=%d page=%d record=%d n=%ld %s %s\n", status, result.bufferPages,
+                                    result.pageSize, result.recordSize, (long) result.numRecords, result.distribution, result.strategy);
+                                failed = 1;
+                                continue;
+                            }
+                            failed |= !result.sorted;
+                            bench_write_result(out, format, &result, first);
+                            first = 0;
+                        }
+    if (BENCH_FORMAT_JSON == format)
+        fprintf(out, "\n]\n");
+
+    if (out != stdout)
+        (fclose)(out);
+    remove(BENCH_INPUT_FILE);
+    remove(BENCH_OUTPUT_FILE);
+#if defined(ION_HOST_FILE)
+    host_ram_remove(BENCH_INPUT_FILE);
+    host_ram_remove(BENCH_OUTPUT_FILE);
+#endif
+    return failed;
+}
@@ -1,8 +1,18 @@
 #if !defined(NO_OUTPUT_BUFFER_SORT_REPLACE_H)
-#define NO_OUTPUT_BUFFER_REPLACE_H
+#define NO_OUTPUT_BUFFER_SORT_REPLACE_H
 
 #if defined(ARDUINO)
 #include "serial_c_iface.h"
+#else
+#include <time.h>
+
+/* Milliseconds since an arbitrary start as for Arduino millis() */
+static inline unsigned long millis(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000UL + (unsigned long) (ts.tv_nsec / 1000000);
+}
 #endif
 
 #include <stdint.h>
@@ -17,14 +27,33 @@
 #define BUFFER_OUTPUT_BLOCK_START_OFFSET  	        0
 #define BUFFER_OUTPUT_BLOCK_START_RECORD_OFFSET 	BLOCK_HEADER_SIZE
 
+//run directory: first block of a sublist stores negated size in blocks of previous sublist written in the pass rather than block id 0.
+//merge follows the chain back from last sublist so only first block of each sublist is read to locate it.
+#define SUBLIST_BLOCK_ID(blockId, prevSublistBlocks) ((blockId) == 0 ? -(prevSublistBlocks) : (blockId))
+
+//blocks of a descending sublist store negated record count. Merge reads them from last block to first and reverses records of each block.
+#define SUBLIST_BLOCK_COUNT(count, descending) ((descending) ? -(count) : (count))
+
+//minimum number of sublists merged at once to use selection tree rather than a scan to find the smallest record
+#define MERGE_TREE_MIN_FANIN 3
+
+//input profile plan: radix sort needs this many records per block for each byte of key range to be faster than introsort
+#define PROFILE_RADIX_MIN_RECORDS 8
+//input profile plan: percent of sample records equal to an earlier record to use introsort with its 3-way partition
+#define PROFILE_DUPLICATE_PCT 25
+//input profile plan: percent of sample in descending order to use two-way sublists
+#define PROFILE_TREND_PCT 90
+//input profile plan: record size from which index replacement selection copies fewer bytes than replacement selection
+#define PROFILE_INDEX_MIN_RECORD_SIZE 32
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
 /**
-@brief      No output sort with input iterator and supporting variable number of records per block. Uses replacement selection.
-@param      iterator
-                Row iterator for reading input rows
+@brief      No output sort with block input iterator and supporting variable number of records per block. Uses replacement selection.
+@param      blockIterator
+                Block iterator for reading input rows. Copies up to maxRecords consecutive rows into buffer and returns number copied (0 when no more rows).
 @param      iteratorState
                 Structure stores state of iterator (file info etc.)
 @param      tupleBuffer
@@ -38,11 +67,32 @@ extern "C" {
 @param      es
                 Sorting state info (block size, record size, etc.)
 @param      resultFilePtr
-                Offset within output file of first output record
+                Offset within output file of first output record. -1 if output was sent to es->output_sink.
 @param      metric
                 Tracks algorithm metrics (I/Os, comparisons, memory swaps)
 @param      compareFn
-                Record comparison function for record ordering
+                Not used. Records are ordered by es->compare_fcn. Kept so existing callers compile.
+@param      runGenOnly
+                If 1, only generates sorted sublists and does not merge them
+*/
+int no_output_buffer_sort_replace_block(
+        int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+        void    *iteratorState,
+	void    *tupleBuffer,
+        ION_FILE *outputFile,		
+	char    *buffer,        
+	int     bufferSizeInBlocks,
+	external_sort_t *es,
+	long    *resultFilePtr,
+	metrics_t *metric,
+        int8_t  (*compareFn)(void *a, void *b),
+        int8_t  runGenOnly
+);
+
+/**
+@brief      No output sort with record input iterator. Same as no_output_buffer_sort_replace_block() but reads one row per iterator call.
+@param      iterator
+                Row iterator for reading input rows. Returns 0 when no more rows.
 */
 int no_output_buffer_sort_replace(
         int     (*iterator)(void *state, void* buffer),
@@ -0,0 +1,2941 @@
+/******************************************************************************/
+/**
+@file		no_output_buffer_sort_replace_impl.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		File-based replacement selection with NOB sort. Compiled as C by no_output_buffer_sort_replace.c and as templates
+			on a record layout by no_output_buffer_sort_template.h. Includes no headers, so the includer provides
+			no_output_buffer_sort_replace.h, in_memory_sort.h, no_output_heap.h and the C headers.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if !defined(NO_OUTPUT_BUFFER_SORT_REPLACE_IMPL_H)
+#define NO_OUTPUT_BUFFER_SORT_REPLACE_IMPL_H
+
+// #define     DEBUG            1
+// #define     DEBUG_OUTPUT        1
+// #define     DEBUG_READ          1
+
+/**
+ * Prints the contents of the heap. Used for debugging.
+ */
+EXTERNAL_SORT_TEMPLATE void print_heap(char* buffer,  int32_t heap_start_offset, int heap_size, int list_size, external_sort_t *es)
+{    
+    // Prints the heap
+    int32_t aa;
+    char *addr;
+    int j;
+    for (aa = 0; aa < 1; aa++) {
+        addr = buffer + heap_start_offset;            
+        printf("heap: ");
+        for (j = 0; j < heap_size; j++)
+            printf(" %d", *(int32_t *) (addr - j*es->record_size));
+        printf("| ");
+    }
+    printf("   ");
+    
+    // Prints the list
+    for (aa = 0; aa < 1; aa++) {
+        addr = buffer + es->page_size;            
+        printf("list: ");
+        for (j = 0; j < list_size; j++)
+            printf(" %d", *(int32_t *) (addr + j*es->record_size));
+        printf("| ");
+    }
+    printf("\n");             
+}
+
+/**
+ * Returns the offset in the buffer of the record a selection tree leaf refers to or -1 if the leaf has no record.
+ * Leaf 2*i is the current input record of block i (record1[i]). Leaf 2*i+1 is the top of the heap of output block records
+ * stored in block i (record2[i]). Block 0 is the output block so leaf 1 never has a record.
+ */
+EXTERNAL_SORT_TEMPLATE static int32_t merge_tree_leaf(int16_t leaf, int32_t *record1, int32_t *record2, int32_t sublistsInRun, external_sort_t *es)
+{
+    int32_t blk = leaf >> 1;
+
+    if (leaf < 0 || blk >= sublistsInRun)
+        return -1;
+
+    if ((leaf & 1) == 0)
+        return record1[blk];
+
+    if (blk == OUTPUT_BLOCK_ID || record2[blk] == -1)
+        return -1;
+    return blk * es->page_size + es->headerSize;
+}
+
+/**
+ * Plays a match between two selection tree entries. Returns the leaf with the smaller record. Ties go to the lower leaf.
+ */
+EXTERNAL_SORT_TEMPLATE static int16_t merge_tree_match(int16_t a, int16_t b, char *buffer, int32_t *record1, int32_t *record2, int32_t sublistsInRun, external_sort_t *es, metrics_t *metric)
+{
+    int32_t offsetA = merge_tree_leaf(a, record1, record2, sublistsInRun, es);
+    int32_t offsetB = merge_tree_leaf(b, record1, record2, sublistsInRun, es);
+
+    if (offsetA == -1)
+        return offsetB == -1 ? -1 : b;
+    if (offsetB == -1)
+        return a;
+
+    metric->num_compar++;
+    if (0 < external_sort_compare(buffer + offsetA, buffer + offsetB, es))
+        return b;
+    return a;
+}
+
+/**
+ * Builds the selection (tournament) tree over all leaves. Tree is stored as an array with root at index 1 and leaves
+ * starting at index numLeaves. Each node stores the leaf of the smallest record in its subtree.
+ */
+EXTERNAL_SORT_TEMPLATE static void merge_tree_build(int16_t *tree, int16_t numLeaves, char *buffer, int32_t *record1, int32_t *record2, int32_t sublistsInRun, external_sort_t *es, metrics_t *metric)
+{
+    int16_t node;
+
+    for (node = 0; node < numLeaves; node++)
+        tree[numLeaves + node] = node;
+
+    for (node = numLeaves - 1; node > 0; node--)
+        tree[node] = merge_tree_match(tree[2*node], tree[2*node+1], buffer, record1, record2, sublistsInRun, es, metric);
+}
+
+/**
+ * Replays the matches on the path from each changed leaf to the root. Leaves must be in ascending order.
+ * Paths that join are only replayed once from the node where they meet.
+ */
+EXTERNAL_SORT_TEMPLATE static void merge_tree_update(int16_t *tree, int16_t numLeaves, int16_t *leaves, int8_t numChanged, char *buffer, int32_t *record1, int32_t *record2, int32_t sublistsInRun, external_sort_t *es, metrics_t *metric)
+{
+    int8_t  i;
+    int16_t node;
+
+    for (i = 0; i < numChanged; i++)
+        leaves[i] += numLeaves;
+
+    while (leaves[0] > 1)
+    {
+        for (i = 0; i < numChanged; i++)
+        {
+            node = leaves[i] >> 1;
+            leaves[i] = node;
+            if (i > 0 && node == leaves[i-1])
+                continue;           /* Path already replayed */
+            tree[node] = merge_tree_match(tree[2*node], tree[2*node+1], buffer, record1, record2, sublistsInRun, es, metric);
+        }
+    }
+}
+
+/**
+ * Returns in memory sort algorithm for sorting a block. es->in_memory_algorithm if set, otherwise quicksort.
+ * Radix sort is only used if sort_block() set aside a buffer page for it in es->radix_scratch.
+ */
+EXTERNAL_SORT_TEMPLATE static int block_sort_algorithm(external_sort_t *es)
+{
+    if (es->in_memory_algorithm >= IN_MEMORY_SORT_RADIX_INT32 && NULL == es->radix_scratch)
+        return IN_MEMORY_SORT_QUICK;
+    if (es->in_memory_algorithm != 0)
+        return es->in_memory_algorithm;
+    return IN_MEMORY_SORT_QUICK;
+}
+
+/**
+ * Returns IN_MEMORY_SORT_RADIX_* algorithm for the integer key of key_type if it is at the start of the record, otherwise 0.
+ */
+EXTERNAL_SORT_TEMPLATE static int radix_key_algorithm(external_sort_t *es)
+{
+    if (es->key_offset != 0)
+        return 0;
+    switch (es->key_type)
+    {
+        case KEY_TYPE_INT32:
+            return IN_MEMORY_SORT_RADIX_INT32;
+        case KEY_TYPE_UINT32:
+            return IN_MEMORY_SORT_RADIX_UINT32;
+        case KEY_TYPE_INT64:
+            return IN_MEMORY_SORT_RADIX_INT64;
+    }
+    return 0;
+}
+
+/**
+ * Sorts count records with IN_MEMORY_SORT_* algorithm. Key prefix is compared inline if es->key_prefix_compare is set.
+ */
+EXTERNAL_SORT_TEMPLATE static void sort_records(char *records, int32_t count, int algorithm, external_sort_t *es)
+{
+    in_memory_sort_prefix(records, (uint32_t)count, es->record_size, es->compare_fcn, algorithm, es->radix_scratch,
+                          es->key_prefix_compare ? es->key_type : KEY_TYPE_OTHER, es->key_offset, es->key_size);
+}
+
+/**
+ * Sorts count records of an input block with block_sort_algorithm().
+ */
+EXTERNAL_SORT_TEMPLATE static void sort_input_block(char *records, int32_t count, external_sort_t *es)
+{
+    sort_records(records, count, block_sort_algorithm(es), es);
+}
+
+/**
+ * Reads up to maxRecords records from the block iterator into consecutive record slots starting at addr.
+ * Iterator may return fewer records than requested so call it until full or no more records.
+ * Returns the number of records read.
+ */
+EXTERNAL_SORT_TEMPLATE static int32_t read_input_records(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    char    *addr,
+    int32_t maxRecords,
+    external_sort_t *es
+)
+{
+    int32_t recordsRead = 0, count;
+
+    while (recordsRead < maxRecords)
+    {
+        count = blockIterator(iteratorState, addr, maxRecords - recordsRead);
+        if (count <= 0)
+            break;
+        recordsRead += count;
+        addr += count*es->record_size;
+    }
+    return recordsRead;
+}
+
+/**
+ * Counts input blocks read by reading count more records after inputRecords records. Heap fill of replacement selection
+ * need not end at a block boundary, so the next read finishes a block already counted.
+ */
+static void count_input_reads(int32_t *inputRecords, int32_t count, int16_t tuplesPerPage, metrics_t *metric)
+{
+    metric->num_reads += (*inputRecords + count + tuplesPerPage - 1) / tuplesPerPage - (*inputRecords + tuplesPerPage - 1) / tuplesPerPage;
+    *inputRecords += count;
+}
+
+/* State of block iterator that wraps a record iterator */
+typedef struct {
+    int     (*iterator)(void *state, void* buffer);
+    void    *iteratorState;
+    int32_t recordSize;
+} record_iterator_shim_t;
+
+/**
+ * Block iterator that calls a record iterator once per record.
+ */
+static int32_t record_iterator_shim(void *state, void *buffer, int32_t maxRecords)
+{
+    record_iterator_shim_t *shim = (record_iterator_shim_t*) state;
+    char    *addr = (char*) buffer;
+    int32_t recordsRead = 0;
+
+    while (recordsRead < maxRecords && 0 != shim->iterator(shim->iteratorState, addr))
+    {
+        recordsRead++;
+        addr += shim->recordSize;
+    }
+    return recordsRead;
+}
+
+/* State of block iterator that returns the records sampled by the input profile before the rest of the input. Sample is in the sort buffer. */
+typedef struct {
+    int32_t (*iterator)(void *state, void *buffer, int32_t maxRecords);
+    void    *iteratorState;
+    char    *sample;
+    int32_t sampleCount;
+    int32_t next;               /* Next sample record to return */
+    int32_t recordSize;
+} profile_replay_t;
+
+/**
+ * Block iterator that returns sampled records and then calls the input block iterator. Records are moved as run generation may read
+ * them into buffer space overlapping the sample ahead of it.
+ */
+static int32_t profile_replay_iterator(void *state, void *buffer, int32_t maxRecords)
+{
+    profile_replay_t *replay = (profile_replay_t*) state;
+    int32_t count = replay->sampleCount - replay->next;
+
+    if (count <= 0)
+        return replay->iterator(replay->iteratorState, buffer, maxRecords);
+    if (count > maxRecords)
+        count = maxRecords;
+    memmove(buffer, replay->sample + (size_t) replay->next*replay->recordSize, (size_t) count*replay->recordSize);
+    replay->next += count;
+    return count;
+}
+
+/**
+ * Writes a block of a sublist during run generation. Header stores the index of the block in the sublist and the record count.
+ */
+EXTERNAL_SORT_TEMPLATE static int write_run_block(ION_FILE *outputFile, char *block, int32_t blockId, int16_t count, external_sort_t *es, metrics_t *metric)
+{
+    *((int32_t *) (block + BLOCK_ID_OFFSET)) = blockId;
+    *((int16_t *) (block + BLOCK_COUNT_OFFSET)) = count;
+
+    if (0 == fwrite(block, es->page_size, 1, outputFile))
+        return 9;
+
+    #ifdef DEBUG_OUTPUT
+    printf("Wrote output block. Block index: %d\n", blockId);
+    for (int k=0; k < count; k++)
+    {
+        test_record_t *buf = (void*) (block+es->headerSize+k*es->record_size);
+        printf("%d: Output Record: %d\n", k, buf->key);
+    }
+    #endif
+    metric->num_writes += 1;
+    return 0;
+}
+
+/**
+ * Writes a block of a sublist at offset. Header stores the index of the block in the sublist. Used to rewrite blocks of a sublist in place.
+ */
+EXTERNAL_SORT_TEMPLATE static int rewrite_run_block(ION_FILE *outputFile, char *block, long offset, int32_t blockId, external_sort_t *es, metrics_t *metric)
+{
+    *((int32_t *) (block + BLOCK_ID_OFFSET)) = blockId;
+
+    if (0 == fwrite_at(block, (size_t)es->page_size, 1, outputFile, offset))
+        return 9;
+
+    metric->num_writes += 1;
+    return 0;
+}
+
+/**
+ * Reverses order of count records at records. Bytes are swapped in place as tuple buffer may hold the last output key.
+ */
+EXTERNAL_SORT_TEMPLATE static void reverse_records(char *records, int32_t count, external_sort_t *es, metrics_t *metric)
+{
+    char    *a = records, *b = records + (count-1)*es->record_size, c;
+    uint16_t k;
+
+    for ( ; a < b; a += es->record_size, b -= es->record_size)
+    {
+        for (k = 0; k < es->record_size; k++)
+        {
+            c = a[k];
+            a[k] = b[k];
+            b[k] = c;
+        }
+        metric->num_memcpys += 2;
+    }
+}
+
+/**
+ * Makes a block of a descending sublist ascending by reversing its records and storing a positive record count.
+ * Returns 1 if block was descending.
+ */
+EXTERNAL_SORT_TEMPLATE static int8_t ascending_block(char *block, external_sort_t *es, metrics_t *metric)
+{
+    int16_t count = *((int16_t *) (block + BLOCK_COUNT_OFFSET));
+
+    if (count >= 0)
+        return 0;
+    *((int16_t *) (block + BLOCK_COUNT_OFFSET)) = (int16_t) -count;
+    reverse_records(block + es->headerSize, -count, es, metric);
+    return 1;
+}
+
+/**
+@brief      Returns 1 if the next sublist of two-way replacement selection should change direction. Sublist changes direction
+            if at least half of the input blocks read while building the previous sublist were entirely out of its order.
+@param      wrongBlocks
+                Blocks read whose records all could not be output in the sublist direction
+@param      blocksRead
+                Blocks read while building the sublist
+*/
+static int8_t reverse_run_direction(int32_t wrongBlocks, int32_t blocksRead)
+{
+    return wrongBlocks > 0 && 2*wrongBlocks >= blocksRead;
+}
+
+/**
+@brief      Presorted fast path of run generation. Writes input blocks directly as a sublist while each block continues the
+            sorted order. A block that is not in order is sorted. Only one comparison with the last record written is needed per block.
+            Stops at the first block that starts before the last record written. Block 0 is the input/output block.
+@param      prevSublistBlocks
+                Number of blocks in previous sublist for run directory. 0 if first sublist.
+@param      sublistBlocks
+                Returns number of blocks written to the sublist
+@param      pendingCount
+                Number of sorted records already in block 0 that start the sublist. Returns number of sorted records left in block 0
+                for the next sublist. 0 if all input was written.
+@return     0 if success, 9 if write error
+*/
+EXTERNAL_SORT_TEMPLATE static int presorted_run(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int32_t prevSublistBlocks,
+    external_sort_t *es,
+    metrics_t *metric,
+    int32_t *sublistBlocks,
+    int32_t *pendingCount
+)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    char    *records        = buffer + es->headerSize;
+    int32_t count           = *pendingCount;
+    int32_t i;
+    int     err;
+
+    *sublistBlocks = 0;
+    *pendingCount = 0;
+    for ( ; ; count = 0)
+    {
+        if (count == 0)
+        {
+            if ((count = read_input_records(blockIterator, iteratorState, records, tuplesPerPage, es)) == 0)
+                break;
+            metric->num_reads += 1;
+
+            /* Sort block only if it is not in order */
+            for (i = 1; i < count; i++)
+            {
+                metric->num_compar++;
+                if (external_sort_compare(records + (i-1)*es->record_size, records + i*es->record_size, es) > 0)
+                {
+                    sort_input_block(records, count, es);
+                    break;
+                }
+            }
+        }
+
+        if (*sublistBlocks > 0)
+        {   /* Block must start at or after last record written (in tuple buffer) */
+            metric->num_compar++;
+            if (external_sort_compare(records, tupleBuffer, es) < 0)
+            {
+                *pendingCount = count;
+                return 0;
+            }
+        }
+
+        memcpy(tupleBuffer, records + (count-1)*es->record_size, es->key_offset + es->key_size);
+        if ((err = write_run_block(outputFile, buffer, SUBLIST_BLOCK_ID(*sublistBlocks, prevSublistBlocks), (int16_t)count, es, metric)) != 0)
+            return err;
+        (*sublistBlocks)++;
+    }
+    return 0;
+}
+
+/**
+@brief      Returns number of records run generation heap holds for es->max_disorder. Replacement selection only starts a new sublist
+            if a record is more positions out of place than records in the heap. A heap of max_disorder records (at most capacity)
+            sorts input with that bound into one sublist.
+            If max_disorder is EXTERNAL_SORT_ESTIMATE_DISORDER and block 0 is empty, reads first input block into block 0 and estimates
+            the bound as twice the largest distance in the block from a record back to the first earlier record larger than it.
+            The estimate keeps record positions in block 1, so records must be at least 2 bytes, otherwise heap uses all capacity.
+            The block is sorted and left in block 0 as first input block.
+@param      pendingCount
+                Number of sorted records in block 0. Returns number of records read into block 0.
+@return     number of records in heap
+*/
+EXTERNAL_SORT_TEMPLATE static int32_t disorder_heap_records(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    char    *buffer,
+    int32_t capacity,
+    external_sort_t *es,
+    metrics_t *metric,
+    int32_t *pendingCount
+)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    char    *records        = buffer + es->headerSize;
+    int32_t count, numMax = 0, lateness = 0, lo, hi, mid, i;
+    int16_t *maxPos         = (int16_t*) (buffer + es->page_size);   /* Heap blocks are empty until filled */
+
+    if (es->max_disorder > 0)
+        return es->max_disorder < capacity ? es->max_disorder : capacity;
+    if (es->max_disorder != EXTERNAL_SORT_ESTIMATE_DISORDER || *pendingCount > 0 || (long) tuplesPerPage*sizeof(int16_t) > es->page_size)
+        return capacity;
+
+    count = read_input_records(blockIterator, iteratorState, records, tuplesPerPage, es);
+    if (count == 0)
+        return capacity;
+    metric->num_reads += 1;
+    *pendingCount = count;
+
+    /* Positions of records larger than all records before them in increasing order */
+    for (i = 0; i < count; i++)
+    {
+        metric->num_compar++;
+        if (numMax == 0 || external_sort_compare(records + i*es->record_size, records + maxPos[numMax-1]*es->record_size, es) >= 0)
+        {
+            maxPos[numMax++] = (int16_t) i;
+            continue;
+        }
+
+        /* Find first earlier record larger than record */
+        lo = 0;
+        hi = numMax-1;
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            metric->num_compar++;
+            if (external_sort_compare(records + maxPos[mid]*es->record_size, records + i*es->record_size, es) > 0)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        if (i - maxPos[lo] > lateness)
+            lateness = i - maxPos[lo];
+    }
+
+    if (count > 1)
+        sort_input_block(records, count, es);
+
+    /* Block cannot show disorder more than half its size */
+    if (2*lateness >= count || count < tuplesPerPage)
+        return capacity;
+    if (2*lateness < tuplesPerPage)
+        return tuplesPerPage < capacity ? tuplesPerPage : capacity;
+    return 2*lateness < capacity ? 2*lateness : capacity;
+}
+
+/**
+@brief      Writes count sorted records stored consecutively from the start of buffer as one sublist. Records of each block are moved
+            behind its header first, last block first as records only move toward end of buffer.
+@param      prevSublistBlocks
+                Number of blocks in previous sublist for run directory. 0 if first sublist.
+@param      toSink
+                If 1, blocks are sent to the output sink rather than written
+@return     0 if success, 9 if write error
+*/
+EXTERNAL_SORT_TEMPLATE static int write_sorted_buffer(ION_FILE *outputFile, char *buffer, int32_t count, int32_t prevSublistBlocks, int8_t toSink, external_sort_t *es, metrics_t *metric)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    int32_t numBlocks       = (count + tuplesPerPage - 1) / tuplesPerPage;
+    int32_t blockCount, i;
+    char    *block;
+    int     err;
+
+    for (i = numBlocks-1; i >= 0; i--)
+    {
+        blockCount = i < numBlocks-1 ? tuplesPerPage : count - i*tuplesPerPage;
+        memmove(buffer + i*es->page_size + es->headerSize, buffer + i*tuplesPerPage*es->record_size, (size_t) blockCount*es->record_size);
+        metric->num_memcpys += blockCount;
+    }
+
+    for (i = 0; i < numBlocks; i++)
+    {
+        block = buffer + i*es->page_size;
+        blockCount = i < numBlocks-1 ? tuplesPerPage : count - i*tuplesPerPage;
+        if (toSink)
+        {
+            *((int32_t *) (block + BLOCK_ID_OFFSET)) = i;
+            *((int16_t *) (block + BLOCK_COUNT_OFFSET)) = (int16_t) blockCount;
+            if (0 != es->output_sink(es->output_sink_state, block))
+                return 9;
+        }
+        else if ((err = write_run_block(outputFile, block, SUBLIST_BLOCK_ID(i, prevSublistBlocks), (int16_t)blockCount, es, metric)) != 0)
+            return err;
+    }
+    return 0;
+}
+
+/**
+@brief      In-memory fast path of replacement selection when input ends while filling the heap blocks. Sorts all input in place and
+            writes it once as the only sublist, or sends it to the output sink without writing. No heap is built.
+            Sorts with introsort as radix sort would need a scratch area as large as the records.
+@param      pendingCount
+                Number of sorted input records in block 0
+@param      fillCount
+                Number of input records from start of block 1
+@param      numSublist
+                Returns 1, or 0 if output was sent to the output sink
+@param      lastSublistBlocks
+                Returns number of blocks in sublist
+@return     0 if success, 9 if write error
+*/
+EXTERNAL_SORT_TEMPLATE static int in_memory_run(
+    ION_FILE *outputFile,
+    char    *buffer,
+    int32_t pendingCount,
+    int32_t fillCount,
+    external_sort_t *es,
+    metrics_t *metric,
+    int32_t *numSublist,
+    int32_t *lastSublistBlocks
+)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    int32_t count           = pendingCount + fillCount;
+    int8_t  toSink          = es->output_sink != NULL;
+
+    metric->num_reads += (fillCount + tuplesPerPage - 1) / tuplesPerPage;
+    memmove(buffer, buffer + es->headerSize, (size_t) pendingCount*es->record_size);
+    memmove(buffer + pendingCount*es->record_size, buffer + es->page_size, (size_t) fillCount*es->record_size);
+    metric->num_memcpys += count;
+    if (count > 1)
+        sort_records(buffer, count, IN_MEMORY_SORT_INTRO, es);
+
+    metric->num_runs++;
+    *numSublist = toSink ? 0 : 1;
+    *lastSublistBlocks = toSink ? 0 : (count + tuplesPerPage - 1) / tuplesPerPage;
+    return write_sorted_buffer(outputFile, buffer, count, 0, toSink, es, metric);
+}
+
+/**
+@brief      Replaces top of run generation heap with tuple and restores heap using heap arity configured in es.
+*/
+EXTERNAL_SORT_TEMPLATE static void replace_heap_top(char *heap, void *tuple, int32_t heapSize, external_sort_t *es, metrics_t *metric)
+{
+    if (es->heap_arity > 0)
+        heapify_rev_d(heap, tuple, heapSize, es->heap_arity, es, metric);
+    else
+        heapify_rev(heap, tuple, heapSize, es, metric);
+}
+
+/**
+@brief      Run generation using replacement selection.
+            Sorts input/output block every time new input block is read. Merges with heap in the remaining blocks.
+            Uses a list for any records that would be in next sublist (since they are less than the maximum record key output so far).
+            This list starts in block 1. Output/input block is block 0. Heap is reverse heap with top of heap being end of buffer.
+            With two-way runs a descending sublist uses the same code with comparisons reversed (es->run_descending).
+            Input that ends while filling the heap blocks is sorted in memory by in_memory_run().
+@param      numSublist
+                Returns number of sublists generated. 0 if output was sent to the output sink.
+@param      lastSublistBlocks
+                Returns number of blocks in last sublist
+@return     0 if success, 9 if write error
+*/
+EXTERNAL_SORT_TEMPLATE static int replacement_selection(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    external_sort_t *es,
+    metrics_t *metric,
+    int32_t *numSublist,
+    int32_t *lastSublistBlocks
+)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    int32_t i;
+    char    *addr, *listRecord;
+    int     err;
+
+    int32_t recordsRead     = 0;
+    int32_t heapSize        = 0;
+    int32_t heapStartOffset = bufferSizeInBlocks*es->page_size - es->record_size;
+    int32_t listSize        = 0;
+    int32_t streamedBlocks  = 0;                    /* Blocks written by presorted fast path */
+    int32_t pendingCount    = 0;                    /* Sorted records left in input/output block by presorted fast path or disorder estimate */
+    int32_t heapRecords;                            /* Records in heap blocks */
+    int32_t inputRecords    = 0;                    /* Records read since heap fill started. Earlier reads are whole blocks. */
+
+    *numSublist = 0;
+    /* Write input while it is sorted directly as first sublist */
+    if (es->presorted_fast_path)
+    {
+        if ((err = presorted_run(blockIterator, iteratorState, tupleBuffer, outputFile, buffer, 0, es, metric, &streamedBlocks, &pendingCount)) != 0)
+            return err;
+        if (streamedBlocks > 0)
+        {
+            metric->num_runs++;
+            (*numSublist)++;
+            if (pendingCount == 0)
+            {   /* Input is sorted */
+                *lastSublistBlocks = streamedBlocks;
+                return 0;
+            }
+        }
+    }
+
+    /* Fill all blocks other than first (input block) with tuples. Heap may be smaller for bounded disorder. */
+    heapRecords = disorder_heap_records(blockIterator, iteratorState, buffer, (bufferSizeInBlocks-1)*tuplesPerPage, es, metric, &pendingCount);
+    addr = buffer+es->page_size;
+    recordsRead = read_input_records(blockIterator, iteratorState, addr, heapRecords, es);
+    addr += recordsRead*es->record_size;
+    if (recordsRead < heapRecords && streamedBlocks == 0)
+        return in_memory_run(outputFile, buffer, pendingCount, recordsRead, es, metric, numSublist, lastSublistBlocks);
+
+    count_input_reads(&inputRecords, recordsRead, tuplesPerPage, metric);
+    metric->num_runs++;
+    (*numSublist)++;
+
+    /* Two-way runs: first sublist is descending if input starts decreasing */
+    if (es->two_way_runs && recordsRead > 1)
+    {
+        metric->num_compar++;
+        es->run_descending = external_sort_compare(buffer + es->page_size + (recordsRead-1)*es->record_size, buffer + es->page_size, es) < 0;
+    }
+
+    /* Build heap from tuples in filled blocks */
+    if (es->heap_arity > 0)
+    {   /* Heap root is last record read so records are already in heap array. Heap and list still fit as their total size never grows. */
+        heapStartOffset = es->page_size + (recordsRead-1)*es->record_size;
+        heapSize = recordsRead;
+        build_heap_rev_d(buffer + heapStartOffset, tupleBuffer, heapSize, es->heap_arity, es, metric);
+    }
+    else
+    {
+        for(i = 0; i < recordsRead; i++)
+        {
+            addr -= es->record_size;
+            memcpy(tupleBuffer, addr, es->record_size);
+            metric->num_memcpys++;
+            shiftUp_rev(buffer + heapStartOffset, tupleBuffer, heapSize, es, metric);
+            heapSize++;
+        }
+    }
+
+    void *lastOutputKey        = NULL;              /* Pointer to memory storing value of last key output */
+    int8_t haveOutputKey       = 0;
+    int32_t sublistSize        = 0;                 /* size in blocks */
+    int32_t prevSublistSize    = streamedBlocks;    /* size in blocks of previous sublist */
+    int32_t outputCount        = 0;                 /* number of values in output block */
+    int32_t inputCount;                             /* number of input values at start of input/output block */
+    int32_t recordsLeft        = recordsRead;       /* number of records in buffer */
+    int8_t  inputValid;                             /* 1 if input value can be output in current sublist */
+    void *heapVal, *inputVal;
+    int32_t blocksRead         = 0;                 /* Input blocks read while building sublist (two-way runs) */
+    int32_t wrongBlocks        = 0;                 /* Input blocks read with all records out of sublist order (two-way runs) */
+    int8_t  reverseBlock;                           /* 1 if new sublist changes direction */
+
+    while (recordsLeft != 0 || pendingCount > 0)
+    {
+        /* Read next block and sort it. Block left by presorted fast path is already sorted. */
+        if (pendingCount > 0)
+        {
+            recordsRead = pendingCount;
+            pendingCount = 0;
+        }
+        else
+        {
+            recordsRead = read_input_records(blockIterator, iteratorState, buffer+es->headerSize, tuplesPerPage, es);
+            count_input_reads(&inputRecords, recordsRead, tuplesPerPage, metric);
+            if (recordsRead > 1)
+                sort_input_block(buffer + es->headerSize, recordsRead, es);
+        }
+        if (es->two_way_runs && recordsRead > 0)
+        {   /* Descending sublist takes input block in descending order. Block is out of order if its last record is before last output. */
+            if (es->run_descending && recordsRead > 1)
+                reverse_records(buffer + es->headerSize, recordsRead, es, metric);
+            blocksRead++;
+            if (haveOutputKey)
+            {
+                metric->num_compar++;
+                if (external_sort_compare(buffer + es->headerSize + (recordsRead-1)*es->record_size, lastOutputKey, es) < 0)
+                    wrongBlocks++;
+            }
+        }
+        recordsLeft += recordsRead;
+        inputCount = recordsRead;
+
+        #ifdef DEBUG
+            print_heap(buffer, heapStartOffset, heapSize, listSize, es);
+        #endif
+
+        /* Input/output block is block 0. Swap output records into it from heap if smaller than records currently there.
+           Heap only contains records that can be output in current sublist. */
+        for(i = 0; i < tuplesPerPage && recordsLeft > 0; i++)
+        {
+            heapVal = buffer+heapStartOffset;
+            inputVal = buffer+es->headerSize + i*es->record_size;
+
+            inputValid = 0;
+            if (i < inputCount)
+            {
+                inputValid = 1;
+                if (haveOutputKey)
+                {
+                    metric->num_compar++;
+                    inputValid = external_sort_compare(inputVal, lastOutputKey, es) >= 0;
+                }
+            }
+
+            if (!inputValid && heapSize <= 0)
+            {
+                /* Start a new sublist (as cannot use heap value or input value) */
+                if (es->max_disorder != 0)
+                    metric->disorder_violations++;
+
+                /* Two-way runs: new sublist changes direction if input trend changed. Heap is built in the new direction. */
+                reverseBlock = 0;
+                if (es->two_way_runs)
+                {
+                    reverseBlock = reverse_run_direction(wrongBlocks, blocksRead);
+                    es->run_descending ^= reverseBlock;
+                    blocksRead = 0;
+                    wrongBlocks = 0;
+                }
+
+                /* Convert unsorted list into heap */
+                if (es->heap_arity > 0 && listSize > 0)
+                {   /* Heap is empty so move heap root to last list record and build heap in place */
+                    heapStartOffset = es->page_size + (listSize-1)*es->record_size;
+                    heapSize = listSize;
+                    listSize = 0;
+                    build_heap_rev_d(buffer + heapStartOffset, tupleBuffer, heapSize, es->heap_arity, es, metric);
+                }
+                for ( ; listSize > 0; listSize--)
+                {
+                    /* Heap grows down as list shrinks. If heap blocks have less than a record spare, the last list record
+                       overlaps the new heap slot and is moved out before it is shifted up. */
+                    listRecord = buffer + es->page_size + (listSize-1)*es->record_size;
+                    if (listRecord + es->record_size > buffer + heapStartOffset - heapSize*es->record_size)
+                    {
+                        memcpy(tupleBuffer, listRecord, es->record_size);
+                        metric->num_memcpys++;
+                        listRecord = (char*) tupleBuffer;
+                    }
+                    shiftUp_rev(buffer + heapStartOffset, listRecord, heapSize, es, metric);
+                    heapSize++;
+                }
+
+                /* Restart building the sublist. Records already in block become input. Block is still sorted as they are not larger than remaining input.
+                   Sublist with no blocks written yet is kept as an empty sublist would break the run directory chain. */
+                outputCount = 0;
+                haveOutputKey = 0;
+                if (sublistSize > 0)
+                {
+                    prevSublistSize = sublistSize;
+                    sublistSize = 0;
+                    (*numSublist)++;
+                    metric->num_runs++;
+                }
+                recordsLeft += i;
+                if (i > inputCount)
+                    inputCount = i;
+                if (reverseBlock)
+                    reverse_records(buffer + es->headerSize, inputCount, es, metric);
+                i=-1;
+                continue;
+            }
+
+            if (i >= inputCount)
+            {   /* No more input records in block. Just copy over from heap */
+                metric->num_memcpys++;
+                memcpy(inputVal, heapVal, es->record_size);       /* Heap into input/output block */
+                lastOutputKey = inputVal;
+
+                /* Restore heap */
+                heapSize--;
+                if(heapSize > 0)
+                    replace_heap_top(buffer+heapStartOffset, buffer + heapStartOffset - heapSize*es->record_size, heapSize, es, metric);
+            }
+            else
+            {
+                if (inputValid && heapSize > 0)
+                    metric->num_compar++;
+
+                if (heapSize > 0 && (!inputValid || external_sort_compare(heapVal, inputVal, es) < 0))
+                {
+                    /* Use the heap value if heap value is less than input value OR input value is invalid */
+                    metric->num_memcpys += 2;
+                    memcpy(tupleBuffer, inputVal, es->record_size);              /* Input tuple into buffer */
+                    memcpy(inputVal, heapVal, es->record_size);                  /* Heap into input/output block */
+                    lastOutputKey = inputVal;
+
+                    /* Find somewhere to put the input value. Heap value is not smaller than last output key so only invalid input goes in list. */
+                    if (!inputValid)
+                    {
+                        /* Restore heap */
+                        heapSize--;
+                        if(heapSize > 0)
+                            replace_heap_top(buffer+heapStartOffset, buffer + heapStartOffset - heapSize*es->record_size, heapSize, es, metric);
+
+                        /* val into list (unsorted) */
+                        metric->num_memcpys++;
+                        memcpy(buffer+es->page_size + listSize*es->record_size, tupleBuffer, es->record_size);
+                        listSize++;
+                    }
+                    else
+                    {
+                        /* val into heap */
+                        replace_heap_top(buffer + heapStartOffset, tupleBuffer, heapSize, es, metric);
+                    }
+                }
+                else
+                {
+                    /* Use the newly read value. don't move it, it's in proper place. */
+                    lastOutputKey = inputVal;       /* Update the last key output */
+                }
+            }
+            haveOutputKey = 1;
+            outputCount++;
+            recordsLeft--;
+            #ifdef DEBUG
+                print_heap(buffer, heapStartOffset, heapSize, listSize, es);
+            #endif
+        }
+
+        if (outputCount == 0)
+            continue;
+
+        /* Store the last key output temporarily in tuple buffer as once write out then read new block it would be gone */
+        memcpy(tupleBuffer, buffer+(outputCount-1)*es->record_size+es->headerSize, es->key_offset + es->key_size);
+        lastOutputKey = tupleBuffer;
+
+        /* Merge reads a descending sublist from its last block so only its first block may be partial. Partial last block of input
+           is written as an ascending sublist of its own unless it is the only sublist or the first block of the sublist, as an empty
+           sublist would break the run directory chain. */
+        if (es->run_descending && outputCount < tuplesPerPage && sublistSize > 0 && *numSublist > 1)
+        {
+            reverse_records(buffer + es->headerSize, outputCount, es, metric);
+            es->run_descending = 0;
+            prevSublistSize = sublistSize;
+            sublistSize = 0;
+            (*numSublist)++;
+            metric->num_runs++;
+        }
+
+        /* Write the output block */
+        if ((err = write_run_block(outputFile, buffer, SUBLIST_BLOCK_ID(sublistSize, prevSublistSize), (int16_t) SUBLIST_BLOCK_COUNT(outputCount, es->run_descending), es, metric)) != 0)
+            return err;
+
+        sublistSize++;
+        outputCount = 0;
+    } /* while records left */
+
+    *lastSublistBlocks = sublistSize;
+    return 0;
+}
+
+/**
+ * Returns number of record slots of replacement_selection_index(). Slots fill the heap blocks from the start and the index heap
+ * of 2 bytes per slot fills them from the end. The buffer has no other free space for the index heap, so there are fewer slots
+ * than the records replacement_selection() keeps in the heap blocks unless the block headers and unused page ends fit it.
+ */
+EXTERNAL_SORT_TEMPLATE static int32_t index_heap_slots(int bufferSizeInBlocks, external_sort_t *es)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    int32_t numSlots        = (int32_t) ((long) (bufferSizeInBlocks-1)*es->page_size / (es->record_size + (int32_t) sizeof(uint16_t)));
+
+    return numSlots < (int32_t) (bufferSizeInBlocks-1)*tuplesPerPage ? numSlots : (int32_t) (bufferSizeInBlocks-1)*tuplesPerPage;
+}
+
+/**
+@brief      Run generation using replacement selection with a heap of record slot indices.
+            Follows replacement_selection() with a heap of index_heap_slots() records. Records in blocks 1 onwards stay in their slots. The heap
+            and the list of records for the next sublist are slot indices sharing one array: heap at start, list at end. The array
+            is at the end of the buffer after the slots, so the heap holds fewer records than replacement_selection().
+            A record is copied to a slot when it replaces a heap record in the input/output block and is copied once when output.
+            Input that ends while filling the heap blocks is sorted in memory by in_memory_run().
+@param      numSublist
+                Returns number of sublists generated. 0 if output was sent to the output sink.
+@param      lastSublistBlocks
+                Returns number of blocks in last sublist
+@return     0 if success, 9 if write error
+*/
+EXTERNAL_SORT_TEMPLATE static int replacement_selection_index(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    external_sort_t *es,
+    metrics_t *metric,
+    int32_t *numSublist,
+    int32_t *lastSublistBlocks
+)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    int8_t  arity           = es->heap_arity > 0 ? es->heap_arity : 2;
+    int32_t numSlots        = index_heap_slots(bufferSizeInBlocks, es);
+    char    *records        = buffer+es->page_size;
+    int32_t i;
+    int     err;
+    uint16_t slot;
+
+    int32_t recordsRead     = 0;
+    int32_t heapSize        = 0;
+    int32_t listSize        = 0;
+    int32_t streamedBlocks  = 0;                    /* Blocks written by presorted fast path */
+    int32_t pendingCount    = 0;                    /* Sorted records left in input/output block by presorted fast path or disorder estimate */
+    int32_t heapRecords;                            /* Records in heap blocks */
+    int32_t inputRecords    = 0;                    /* Records read since heap fill started. Earlier reads are whole blocks. */
+
+    *numSublist = 0;
+    /* Write input while it is sorted directly as first sublist */
+    if (es->presorted_fast_path)
+    {
+        if ((err = presorted_run(blockIterator, iteratorState, tupleBuffer, outputFile, buffer, 0, es, metric, &streamedBlocks, &pendingCount)) != 0)
+            return err;
+        if (streamedBlocks > 0)
+        {
+            metric->num_runs++;
+            (*numSublist)++;
+            if (pendingCount == 0)
+            {   /* Input is sorted */
+                *lastSublistBlocks = streamedBlocks;
+                return 0;
+            }
+        }
+    }
+
+    /* Heap may be smaller for bounded disorder */
+    heapRecords = disorder_heap_records(blockIterator, iteratorState, buffer, numSlots, es, metric, &pendingCount);
+    numSlots = heapRecords;
+    uint16_t *heap = (uint16_t*) (buffer + (long) bufferSizeInBlocks*es->page_size) - numSlots;
+
+    /* Fill all blocks other than first (input block) with tuples */
+    recordsRead = read_input_records(blockIterator, iteratorState, records, numSlots, es);
+    if (recordsRead < numSlots && streamedBlocks == 0)
+        return in_memory_run(outputFile, buffer, pendingCount, recordsRead, es, metric, numSublist, lastSublistBlocks);
+
+    count_input_reads(&inputRecords, recordsRead, tuplesPerPage, metric);
+    metric->num_runs++;
+    (*numSublist)++;
+
+    /* Two-way runs: first sublist is descending if input starts decreasing */
+    if (es->two_way_runs && recordsRead > 1)
+    {
+        metric->num_compar++;
+        es->run_descending = external_sort_compare(buffer + es->page_size + (recordsRead-1)*es->record_size, buffer + es->page_size, es) < 0;
+    }
+
+    /* Build heap of slots in filled blocks */
+    for (heapSize = 0; heapSize < recordsRead; heapSize++)
+        heap[heapSize] = (uint16_t) heapSize;
+    build_heap_index(records, heap, heapSize, arity, es, metric);
+
+    void *lastOutputKey        = NULL;              /* Pointer to memory storing value of last key output */
+    int8_t haveOutputKey       = 0;
+    int32_t sublistSize        = 0;                 /* size in blocks */
+    int32_t prevSublistSize    = streamedBlocks;    /* size in blocks of previous sublist */
+    int32_t outputCount        = 0;                 /* number of values in output block */
+    int32_t inputCount;                             /* number of input values at start of input/output block */
+    int32_t recordsLeft        = recordsRead;       /* number of records in buffer */
+    int8_t  inputValid;                             /* 1 if input value can be output in current sublist */
+    void *heapVal, *inputVal;
+    int32_t blocksRead         = 0;                 /* Input blocks read while building sublist (two-way runs) */
+    int32_t wrongBlocks        = 0;                 /* Input blocks read with all records out of sublist order (two-way runs) */
+    int8_t  reverseBlock;                           /* 1 if new sublist changes direction */
+
+    while (recordsLeft != 0 || pendingCount > 0)
+    {
+        /* Read next block and sort it. Block left by presorted fast path is already sorted. */
+        if (pendingCount > 0)
+        {
+            recordsRead = pendingCount;
+            pendingCount = 0;
+        }
+        else
+        {
+            recordsRead = read_input_records(blockIterator, iteratorState, buffer+es->headerSize, tuplesPerPage, es);
+            count_input_reads(&inputRecords, recordsRead, tuplesPerPage, metric);
+            if (recordsRead > 1)
+                sort_input_block(buffer + es->headerSize, recordsRead, es);
+        }
+        if (es->two_way_runs && recordsRead > 0)
+        {   /* Descending sublist takes input block in descending order. Block is out of order if its last record is before last output. */
+            if (es->run_descending && recordsRead > 1)
+                reverse_records(buffer + es->headerSize, recordsRead, es, metric);
+            blocksRead++;
+            if (haveOutputKey)
+            {
+                metric->num_compar++;
+                if (external_sort_compare(buffer + es->headerSize + (recordsRead-1)*es->record_size, lastOutputKey, es) < 0)
+                    wrongBlocks++;
+            }
+        }
+        recordsLeft += recordsRead;
+        inputCount = recordsRead;
+
+        /* Input/output block is block 0. Swap output records into it from heap if smaller than records currently there.
+           Heap only contains records that can be output in current sublist. */
+        for(i = 0; i < tuplesPerPage && recordsLeft > 0; i++)
+        {
+            slot = heap[0];
+            heapVal = records + (int32_t) slot*es->record_size;
+            inputVal = buffer+es->headerSize + i*es->record_size;
+
+            inputValid = 0;
+            if (i < inputCount)
+            {
+                inputValid = 1;
+                if (haveOutputKey)
+                {
+                    metric->num_compar++;
+                    inputValid = external_sort_compare(inputVal, lastOutputKey, es) >= 0;
+                }
+            }
+
+            if (!inputValid && heapSize <= 0)
+            {
+                /* Start a new sublist (as cannot use heap value or input value) */
+                if (es->max_disorder != 0)
+                    metric->disorder_violations++;
+
+                /* Two-way runs: new sublist changes direction if input trend changed. Heap is built in the new direction. */
+                reverseBlock = 0;
+                if (es->two_way_runs)
+                {
+                    reverseBlock = reverse_run_direction(wrongBlocks, blocksRead);
+                    es->run_descending ^= reverseBlock;
+                    blocksRead = 0;
+                    wrongBlocks = 0;
+                }
+
+                /* Convert list at end of slot array into heap */
+                memmove(heap, heap + numSlots - listSize, (size_t) listSize*sizeof(uint16_t));
+                heapSize = listSize;
+                listSize = 0;
+                build_heap_index(records, heap, heapSize, arity, es, metric);
+
+                /* Restart building the sublist. Records already in block become input. Block is still sorted as they are not larger than remaining input.
+                   Sublist with no blocks written yet is kept as an empty sublist would break the run directory chain. */
+                outputCount = 0;
+                haveOutputKey = 0;
+                if (sublistSize > 0)
+                {
+                    prevSublistSize = sublistSize;
+                    sublistSize = 0;
+                    (*numSublist)++;
+                    metric->num_runs++;
+                }
+                recordsLeft += i;
+                if (i > inputCount)
+                    inputCount = i;
+                if (reverseBlock)
+                    reverse_records(buffer + es->headerSize, inputCount, es, metric);
+                i=-1;
+                continue;
+            }
+
+            if (i >= inputCount)
+            {   /* No more input records in block. Just copy over from heap. Slot is no longer used. */
+                metric->num_memcpys++;
+                memcpy(inputVal, heapVal, es->record_size);       /* Heap into input/output block */
+                lastOutputKey = inputVal;
+
+                /* Restore heap */
+                heapSize--;
+                if(heapSize > 0)
+                    heapify_index(records, heap, heap[heapSize], 0, heapSize, arity, es, metric);
+            }
+            else
+            {
+                if (inputValid && heapSize > 0)
+                    metric->num_compar++;
+
+                if (heapSize > 0 && (!inputValid || external_sort_compare(heapVal, inputVal, es) < 0))
+                {
+                    /* Use the heap value if heap value is less than input value OR input value is invalid. Input value takes its slot. */
+                    metric->num_memcpys += 3;
+                    memcpy(tupleBuffer, inputVal, es->record_size);              /* Input tuple into buffer */
+                    memcpy(inputVal, heapVal, es->record_size);                  /* Heap into input/output block */
+                    memcpy(heapVal, tupleBuffer, es->record_size);               /* Input tuple into heap slot */
+                    lastOutputKey = inputVal;
+
+                    /* Heap value is not smaller than last output key so only invalid input goes in list. */
+                    if (!inputValid)
+                    {
+                        /* Restore heap */
+                        heapSize--;
+                        if(heapSize > 0)
+                            heapify_index(records, heap, heap[heapSize], 0, heapSize, arity, es, metric);
+
+                        /* slot into list (unsorted) */
+                        listSize++;
+                        heap[numSlots - listSize] = slot;
+                    }
+                    else
+                    {
+                        /* slot stays at top of heap with new value */
+                        heapify_index(records, heap, slot, 0, heapSize, arity, es, metric);
+                    }
+                }
+                else
+                {
+                    /* Use the newly read value. don't move it, it's in proper place. */
+                    lastOutputKey = inputVal;       /* Update the last key output */
+                }
+            }
+            haveOutputKey = 1;
+            outputCount++;
+            recordsLeft--;
+        }
+
+        if (outputCount == 0)
+            continue;
+
+        /* Store the last key output temporarily in tuple buffer as once write out then read new block it would be gone */
+        memcpy(tupleBuffer, buffer+(outputCount-1)*es->record_size+es->headerSize, es->key_offset + es->key_size);
+        lastOutputKey = tupleBuffer;
+
+        /* Merge reads a descending sublist from its last block so only its first block may be partial. Partial last block of input
+           is written as an ascending sublist of its own unless it is the only sublist or the first block of the sublist, as an empty
+           sublist would break the run directory chain. */
+        if (es->run_descending && outputCount < tuplesPerPage && sublistSize > 0 && *numSublist > 1)
+        {
+            reverse_records(buffer + es->headerSize, outputCount, es, metric);
+            es->run_descending = 0;
+            prevSublistSize = sublistSize;
+            sublistSize = 0;
+            (*numSublist)++;
+            metric->num_runs++;
+        }
+
+        /* Write the output block */
+        if ((err = write_run_block(outputFile, buffer, SUBLIST_BLOCK_ID(sublistSize, prevSublistSize), (int16_t) SUBLIST_BLOCK_COUNT(outputCount, es->run_descending), es, metric)) != 0)
+            return err;
+
+        sublistSize++;
+        outputCount = 0;
+    } /* while records left */
+
+    *lastSublistBlocks = sublistSize;
+    return 0;
+}
+
+/**
+@brief      Run generation using natural runs. Sorts each input block and appends it to the current sublist while it continues the
+            sorted order. A block that starts before the last record written starts a new sublist. Only uses the input/output block.
+@param      numSublist
+                Returns number of sublists generated
+@param      lastSublistBlocks
+                Returns number of blocks in last sublist
+@return     0 if success, 9 if write error
+*/
+EXTERNAL_SORT_TEMPLATE static int natural_runs(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    external_sort_t *es,
+    metrics_t *metric,
+    int32_t *numSublist,
+    int32_t *lastSublistBlocks
+)
+{
+    int32_t pendingCount    = 0;                    /* Sorted records in input/output block that start next sublist */
+    int32_t sublistBlocks   = 0;
+    int     err;
+
+    (void) bufferSizeInBlocks;
+    *numSublist = 0;
+    do
+    {
+        if ((err = presorted_run(blockIterator, iteratorState, tupleBuffer, outputFile, buffer, sublistBlocks, es, metric, &sublistBlocks, &pendingCount)) != 0)
+            return err;
+        metric->num_runs++;
+        (*numSublist)++;
+    } while (pendingCount > 0);
+
+    *lastSublistBlocks = sublistBlocks;
+    return 0;
+}
+
+/**
+@brief      Run generation using load-sort-store. Fills the whole buffer with input records, sorts them, and writes them as a sublist.
+            Records are read into consecutive slots from the start of the buffer and moved behind their block headers after sorting.
+            Buffer is sorted in place with introsort as radix sort would need a scratch area as large as the buffer. Input that ends in the first load is
+            sent to the output sink without writing.
+@param      numSublist
+                Returns number of sublists generated. 0 if output was sent to the output sink.
+@param      lastSublistBlocks
+                Returns number of blocks in last sublist
+@return     0 if success, 9 if write error
+*/
+EXTERNAL_SORT_TEMPLATE static int load_sort_store(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    external_sort_t *es,
+    metrics_t *metric,
+    int32_t *numSublist,
+    int32_t *lastSublistBlocks
+)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    int32_t capacity        = (int32_t) bufferSizeInBlocks*tuplesPerPage;
+    int32_t count, numBlocks;
+    int8_t  toSink;
+    int     err;
+
+    (void) tupleBuffer;
+    *numSublist = 0;
+    *lastSublistBlocks = 0;
+    do
+    {
+        count = read_input_records(blockIterator, iteratorState, buffer, capacity, es);
+        if (count == 0 && *numSublist > 0)
+            break;                                  /* Input ended with a full buffer */
+        numBlocks = (count + tuplesPerPage - 1) / tuplesPerPage;
+        metric->num_reads += numBlocks;
+        if (count > 1)
+            sort_records(buffer, count, IN_MEMORY_SORT_INTRO, es);
+
+        /* In-memory fast path: input that ended in the first load is sent to the output sink without writing */
+        toSink = es->output_sink != NULL && count < capacity && *numSublist == 0;
+        if ((err = write_sorted_buffer(outputFile, buffer, count, *lastSublistBlocks, toSink, es, metric)) != 0)
+            return err;
+
+        metric->num_runs++;
+        if (toSink)
+            return 0;
+        (*numSublist)++;
+        *lastSublistBlocks = numBlocks;
+    } while (count == capacity);
+
+    return 0;
+}
+
+/**
+ * Returns number of bits spanned by the range of integer keys from record min to record max. Key size in bits for other key types.
+ */
+EXTERNAL_SORT_TEMPLATE static uint16_t key_range_bits(char *min, char *max, external_sort_t *es)
+{
+    uint64_t range;
+    uint16_t bits = 0;
+
+    min += es->key_offset;
+    max += es->key_offset;
+    switch (es->key_type)
+    {
+        case KEY_TYPE_INT32:
+        {
+            int32_t a, b;
+            memcpy(&a, min, sizeof(int32_t));
+            memcpy(&b, max, sizeof(int32_t));
+            range = (uint64_t) ((int64_t) b - a);
+            break;
+        }
+        case KEY_TYPE_UINT32:
+        {
+            uint32_t a, b;
+            memcpy(&a, min, sizeof(uint32_t));
+            memcpy(&b, max, sizeof(uint32_t));
+            range = b - a;
+            break;
+        }
+        case KEY_TYPE_INT64:
+        {
+            int64_t a, b;
+            memcpy(&a, min, sizeof(int64_t));
+            memcpy(&b, max, sizeof(int64_t));
+            range = (uint64_t) b - (uint64_t) a;
+            break;
+        }
+        default:
+            return (uint16_t) (8*es->key_size);
+    }
+    for ( ; range != 0; range >>= 1)
+        bits++;
+    return bits;
+}
+
+/**
+ * Returns most records the input profile samples. Sample is stored at the end of the buffer and replayed as the first input records.
+ * Run generation only reads into the buffer below the replayed records and only writes to the end of the buffer after its first
+ * fill, so sample is at most the slots index replacement selection fills first. A bounded disorder heap may be smaller and
+ * an estimated bound is only known after the first block.
+ */
+EXTERNAL_SORT_TEMPLATE static int32_t profile_sample_records(int bufferSizeInBlocks, external_sort_t *es)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    int32_t records         = (int32_t) es->profile_blocks*tuplesPerPage;
+
+    if (records > index_heap_slots(bufferSizeInBlocks, es))
+        records = index_heap_slots(bufferSizeInBlocks, es);
+    if (es->max_disorder > 0 && records > es->max_disorder)
+        records = es->max_disorder;
+    else if (es->max_disorder == EXTERNAL_SORT_ESTIMATE_DISORDER && records > tuplesPerPage)
+        records = tuplesPerPage;
+    return records;
+}
+
+/**
+@brief      Reads up to sampleRecords input records into sample and estimates sortedness, duplicate ratio, and key range of the input
+            into the profile fields of metric. Sample is left sorted and is returned as the first input records by profile_replay_iterator().
+            Sample reads are counted when run generation reads the replayed records.
+@return     number of records in sample
+*/
+EXTERNAL_SORT_TEMPLATE static int32_t profile_input(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    char    *sample,
+    int32_t sampleRecords,
+    external_sort_t *es,
+    metrics_t *metric
+)
+{
+    int32_t count = read_input_records(blockIterator, iteratorState, sample, sampleRecords, es);
+    int32_t i, inOrder = 0, reverse = 0, duplicates = 0;
+    int8_t  c;
+
+    for (i = 1; i < count; i++)
+    {
+        metric->num_compar++;
+        c = external_sort_compare(sample + (i-1)*es->record_size, sample + i*es->record_size, es);
+        inOrder += c <= 0;
+        reverse += c >= 0;
+    }
+    if (count > 1)
+        sort_records(sample, count, IN_MEMORY_SORT_INTRO, es);     /* Sample may be many blocks */
+    for (i = 1; i < count; i++)
+    {
+        metric->num_compar++;
+        duplicates += 0 == external_sort_compare(sample + (i-1)*es->record_size, sample + i*es->record_size, es);
+    }
+
+    metric->profile_sorted_pct = (uint8_t) (count > 1 ? 100*inOrder/(count-1) : 100);
+    metric->profile_reverse_pct = (uint8_t) (count > 1 ? 100*reverse/(count-1) : 100);
+    metric->profile_duplicate_pct = (uint8_t) (count > 0 ? 100*duplicates/count : 0);
+    metric->profile_key_bits = count > 0 ? key_range_bits(sample, sample + (count-1)*es->record_size, es) : 0;
+    return count;
+}
+
+/**
+ * Returns number of merge passes to merge numRuns sublists fanIn at a time.
+ */
+static int32_t merge_passes(uint32_t numRuns, int32_t fanIn)
+{
+    int32_t passes = 0;
+
+    for ( ; numRuns > 1; passes++)
+        numRuns = (numRuns + fanIn - 1) / fanIn;
+    return passes;
+}
+
+/**
+ * Returns the smallest fan-in that merges numRuns sublists in as few passes as merging bufferSizeInBlocks at once.
+ * Fewer sublists per run take fewer comparisons to find the smallest record.
+ */
+static int16_t balanced_fan_in(uint32_t numRuns, int bufferSizeInBlocks)
+{
+    int32_t passes  = merge_passes(numRuns, bufferSizeInBlocks);
+    int32_t fanIn   = bufferSizeInBlocks;
+
+    while (passes > 0 && fanIn > 2 && merge_passes(numRuns, fanIn-1) == passes)
+        fanIn--;
+    return (int16_t) fanIn;
+}
+
+/**
+ * Returns predicted number of sublists of replacement selection with a heap of heapBlocks blocks. Sublists average twice the heap
+ * on random input. About half the records out of order are deferred to the next sublist so a sublist ends after
+ * heap size / (2 * fraction of records out of order) records on mostly sorted input.
+ */
+static uint32_t predicted_heap_runs(uint32_t numPages, uint32_t heapBlocks, uint8_t sortedPct)
+{
+    uint32_t runBlocks = 2*heapBlocks;
+
+    if (50*heapBlocks / (100 - sortedPct) > runBlocks)
+        runBlocks = 50*heapBlocks / (100 - sortedPct);
+    if (runBlocks == 0)
+        runBlocks = 1;
+    return (numPages + runBlocks - 1) / runBlocks;
+}
+
+/**
+@brief      Chooses run generation strategy, block sort algorithm, and merge fan-in from the input profile in metric and sets them in es.
+            es is the sort's own copy of the caller's settings. Plan is reported in metric.
+            Sorted or reverse sorted samples use replacement selection with the presorted fast path or two-way sublists. Otherwise
+            replacement selection is used if its longer sublists save a merge pass over load-sort-store.
+            Index replacement selection is used for large records if its smaller heap needs no more merge passes.
+            Blocks are sorted with radix sort if the key is an integer at the start of the record, the buffer has a scratch page for it,
+            and blocks hold enough records to pay for its passes over the key range. Otherwise introsort is used if the sample has
+            many duplicates as its 3-way partition skips equal keys, and quicksort if not.
+            Fan-in is predicted from predicted runs. The merge sets it again from the actual number of sublists.
+            Predicted runs and I/O use es->num_pages.
+*/
+EXTERNAL_SORT_TEMPLATE static void plan_sort(int bufferSizeInBlocks, external_sort_t *es, metrics_t *metric)
+{
+    int16_t  tuplesPerPage  = (es->page_size - es->headerSize) / es->record_size;
+    uint32_t numPages       = es->num_pages;
+    uint32_t numRuns        = 0, lssRuns, indexRuns;
+    int32_t  passes;
+    int      algorithm;
+
+    /* Radix sort skips digits where all keys are equal so it makes about one pass per byte of key range */
+    algorithm = radix_key_algorithm(es);
+    if (NULL == es->radix_scratch || tuplesPerPage < PROFILE_RADIX_MIN_RECORDS*((metric->profile_key_bits+7)/8))
+        algorithm = metric->profile_duplicate_pct >= PROFILE_DUPLICATE_PCT ? IN_MEMORY_SORT_INTRO : IN_MEMORY_SORT_QUICK;
+    es->in_memory_algorithm = (int8_t) algorithm;
+
+    es->run_gen_algorithm = RUN_GEN_REPLACEMENT_SELECTION;
+    es->presorted_fast_path = 0;
+    es->two_way_runs = 0;
+    if (numPages > 0 && numPages <= (uint32_t) bufferSizeInBlocks)
+    {   /* Input fits in buffer */
+        es->run_gen_algorithm = RUN_GEN_LOAD_SORT_STORE;
+        numRuns = 1;
+    }
+    else if (metric->profile_sorted_pct == 100)
+    {
+        es->presorted_fast_path = 1;
+        numRuns = numPages > 0;
+    }
+    else if (metric->profile_reverse_pct >= PROFILE_TREND_PCT)
+    {
+        es->two_way_runs = 1;
+        numRuns = numPages > 0;
+    }
+    else
+    {
+        numRuns = predicted_heap_runs(numPages, (uint32_t) (bufferSizeInBlocks-1), metric->profile_sorted_pct);
+        lssRuns = (numPages + bufferSizeInBlocks - 1) / bufferSizeInBlocks;
+        if (numPages > 0 && merge_passes(lssRuns, bufferSizeInBlocks) <= merge_passes(numRuns, bufferSizeInBlocks))
+        {   /* Sorting the buffer costs less than the heap if it needs as many merge passes */
+            es->run_gen_algorithm = RUN_GEN_LOAD_SORT_STORE;
+            numRuns = lssRuns;
+        }
+        else if (es->record_size >= PROFILE_INDEX_MIN_RECORD_SIZE && index_heap_slots(bufferSizeInBlocks, es) <= UINT16_MAX)
+        {   /* Index heap holds fewer records so it is only used if its shorter sublists need no more merge passes */
+            indexRuns = predicted_heap_runs(numPages, (uint32_t) (index_heap_slots(bufferSizeInBlocks, es) / tuplesPerPage), metric->profile_sorted_pct);
+            if (merge_passes(indexRuns, bufferSizeInBlocks) <= merge_passes(numRuns, bufferSizeInBlocks))
+            {
+                es->run_gen_algorithm = RUN_GEN_REPLACEMENT_SELECTION_INDEX;
+                numRuns = indexRuns;
+            }
+        }
+    }
+
+    if (es->run_gen_algorithm == RUN_GEN_LOAD_SORT_STORE)
+        es->in_memory_algorithm = IN_MEMORY_SORT_INTRO;       /* Sorts the whole buffer so radix scratch page is given back */
+    passes = merge_passes(numRuns, bufferSizeInBlocks);
+    es->merge_fan_in = balanced_fan_in(numRuns, bufferSizeInBlocks);
+
+    metric->plan_run_gen = es->run_gen_algorithm;
+    metric->plan_in_memory_algorithm = es->in_memory_algorithm;
+    metric->plan_fan_in = es->merge_fan_in;
+    metric->predicted_runs = numRuns;
+
+    /* Each pass reads and writes the input once. Final pass writes to the output sink. A single sublist is read again for the sink
+       or rewritten ascending if it is descending. */
+    metric->predicted_io = 2*numPages*(uint32_t)(1 + passes);
+    if (es->output_sink != NULL && passes > 0)
+        metric->predicted_io -= numPages;
+    else if (es->output_sink != NULL)
+        metric->predicted_io += numPages;
+    else if (passes == 0 && es->two_way_runs)
+        metric->predicted_io += 2*numPages;
+}
+
+/**
+ * Exchanges count records at a with count records at b.
+ */
+EXTERNAL_SORT_TEMPLATE static void swap_records(char *a, char *b, int16_t count, void *tupleBuffer, external_sort_t *es, metrics_t *metric)
+{
+    for ( ; count > 0; count--)
+    {
+        memcpy(tupleBuffer, a, es->record_size);
+        memcpy(a, b, es->record_size);
+        memcpy(b, tupleBuffer, es->record_size);
+        metric->num_memcpys += 3;
+        a += es->record_size;
+        b += es->record_size;
+    }
+}
+
+/**
+ * Exchanges contents of two pages using the tuple buffer. Copies are counted per record sized piece.
+ */
+EXTERNAL_SORT_TEMPLATE static void swap_pages(char *a, char *b, void *tupleBuffer, external_sort_t *es, metrics_t *metric)
+{
+    int32_t offset, size;
+
+    for (offset = 0; offset < es->page_size; offset += es->record_size)
+    {
+        size = es->page_size - offset < es->record_size ? es->page_size - offset : es->record_size;
+        memcpy(tupleBuffer, a + offset, size);
+        memcpy(a + offset, b + offset, size);
+        memcpy(b + offset, tupleBuffer, size);
+        metric->num_memcpys += 3;
+    }
+}
+
+/**
+ * Merges two adjacent sorted lists of records in place. Each record of the second list is inserted into the first list
+ * using binary search. Stops once a record of the second list is not smaller than any record before it.
+ */
+EXTERNAL_SORT_TEMPLATE static void merge_adjacent_records(char *records, int16_t firstCount, int16_t secondCount, void *tupleBuffer, external_sort_t *es, metrics_t *metric)
+{
+    int16_t lo = 0, hi, mid;
+    int16_t next = firstCount;                      /* Index of next record of second list to insert */
+    int16_t end = firstCount + secondCount;
+
+    if (firstCount == 0 || secondCount == 0)
+        return;
+
+    metric->num_compar++;
+    if (external_sort_compare(records + (firstCount-1)*es->record_size, records + firstCount*es->record_size, es) <= 0)
+        return;                                     /* Lists are already in order */
+
+    for ( ; next < end; next++)
+    {
+        /* Insert after any equal records. Second list is sorted so insert position is after the last one. */
+        hi = next;
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            metric->num_compar++;
+            if (external_sort_compare(records + mid*es->record_size, records + next*es->record_size, es) <= 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == next)
+            break;                                  /* Rest of second list is in position */
+
+        memcpy(tupleBuffer, records + next*es->record_size, es->record_size);
+        memmove(records + (lo+1)*es->record_size, records + lo*es->record_size, (size_t)(next - lo)*es->record_size);
+        memcpy(records + lo*es->record_size, tupleBuffer, es->record_size);
+        metric->num_memcpys += 2 + (next - lo);
+        lo++;
+    }
+}
+
+/**
+ * Given a full block of sorted kept records and a block of sorted input records, returns how many kept records are in
+ * the smallest tuplesPerPage records of both blocks. The rest are the first input records.
+ */
+EXTERNAL_SORT_TEMPLATE static int16_t merge_split_point(char *kept, char *input, int16_t inputCount, int16_t tuplesPerPage, external_sort_t *es, metrics_t *metric)
+{
+    int16_t lo = tuplesPerPage > inputCount ? tuplesPerPage - inputCount : 0;
+    int16_t hi = tuplesPerPage;
+    int16_t mid;
+
+    /* Common case for sorted input is all kept records are smaller */
+    metric->num_compar++;
+    if (external_sort_compare(kept + (tuplesPerPage-1)*es->record_size, input, es) <= 0)
+        return tuplesPerPage;
+    hi--;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi + 1) / 2;
+        metric->num_compar++;
+        if (external_sort_compare(kept + (mid-1)*es->record_size, input + (tuplesPerPage-mid)*es->record_size, es) <= 0)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/**
+@brief      Run generation for a buffer of two blocks using merging rather than a heap.
+            One block holds a sorted block of records kept for the current sublist. Each input block is sorted and merged with it.
+            The smallest block of records is output and the largest kept. Whichever block needs fewer records moved is output
+            so blocks alternate between kept and input/output. For sorted input no records are moved. A sublist ends when an
+            input block has a record smaller than the last key output.
+            A buffer of more than two blocks uses replacement_selection() as its heap generates longer sublists.
+@param      numSublist
+                Returns number of sublists generated
+@param      lastSublistBlocks
+                Returns number of blocks in last sublist
+@return     0 if success, 9 if write error
+*/
+EXTERNAL_SORT_TEMPLATE static int merge_run_generation(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    external_sort_t *es,
+    metrics_t *metric,
+    int32_t *numSublist,
+    int32_t *lastSublistBlocks
+)
+{
+    int16_t tuplesPerPage   = (es->page_size - es->headerSize) / es->record_size;
+    char    *keptBlock      = buffer;                       /* Sorted records kept for current sublist */
+    char    *inputBlock     = buffer + es->page_size;       /* Input block. Free after it is output. */
+    char    *outputBlock;
+    int16_t keptCount, inputCount, k, numSwap;
+    int32_t sublistSize     = 0;                            /* size in blocks */
+    int32_t prevSublistSize = 0;                            /* size in blocks of previous sublist */
+    int8_t  haveOutputKey   = 0;                            /* Last key output is stored in tuple buffer */
+    int     err;
+
+    if (bufferSizeInBlocks != 2)
+        return replacement_selection(blockIterator, iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks, es, metric, numSublist, lastSublistBlocks);
+
+    keptCount = (int16_t) read_input_records(blockIterator, iteratorState, keptBlock + es->headerSize, tuplesPerPage, es);
+    if (keptCount > 0)
+        metric->num_reads += 1;
+    if (keptCount > 1)
+        sort_input_block(keptBlock + es->headerSize, keptCount, es);
+    metric->num_runs++;
+    *numSublist = 1;
+
+    while (keptCount > 0)
+    {
+        inputCount = (int16_t) read_input_records(blockIterator, iteratorState, inputBlock + es->headerSize, tuplesPerPage, es);
+        if (inputCount == 0)
+            break;
+        metric->num_reads += 1;
+        if (inputCount > 1)
+            sort_input_block(inputBlock + es->headerSize, inputCount, es);
+
+        if (haveOutputKey)
+        {
+            metric->num_compar++;
+            if (external_sort_compare(inputBlock + es->headerSize, tupleBuffer, es) < 0)
+            {
+                /* Input has records for next sublist. End sublist with kept records. Input block is kept for next sublist. */
+                if ((err = write_run_block(outputFile, keptBlock, SUBLIST_BLOCK_ID(sublistSize, prevSublistSize), keptCount, es, metric)) != 0)
+                    return err;
+
+                (*numSublist)++;
+                metric->num_runs++;
+                prevSublistSize = sublistSize + 1;
+                sublistSize     = 0;
+                haveOutputKey   = 0;
+                outputBlock     = keptBlock;
+                keptBlock       = inputBlock;
+                inputBlock      = outputBlock;
+                keptCount       = inputCount;
+                continue;
+            }
+        }
+
+        /* Output block is first k kept records and first tuplesPerPage-k input records */
+        k = merge_split_point(keptBlock + es->headerSize, inputBlock + es->headerSize, inputCount, tuplesPerPage, es, metric);
+        if (k < tuplesPerPage - k && inputCount == tuplesPerPage)
+        {
+            /* Output input block. Exchange its largest records for the smallest kept records. */
+            swap_records(inputBlock + es->headerSize + (tuplesPerPage - k)*es->record_size, keptBlock + es->headerSize, k, tupleBuffer, es, metric);
+            merge_adjacent_records(inputBlock + es->headerSize, tuplesPerPage - k, k, tupleBuffer, es, metric);
+            merge_adjacent_records(keptBlock + es->headerSize, k, tuplesPerPage - k, tupleBuffer, es, metric);
+            outputBlock = inputBlock;
+        }
+        else
+        {
+            /* Output kept block. Exchange its largest records for the smallest input records. */
+            numSwap = tuplesPerPage - k;
+            swap_records(keptBlock + es->headerSize + k*es->record_size, inputBlock + es->headerSize, numSwap, tupleBuffer, es, metric);
+            merge_adjacent_records(keptBlock + es->headerSize, k, numSwap, tupleBuffer, es, metric);
+            merge_adjacent_records(inputBlock + es->headerSize, numSwap, inputCount - numSwap, tupleBuffer, es, metric);
+            outputBlock = keptBlock;
+            keptBlock = inputBlock;
+        }
+        keptCount = inputCount;
+
+        if ((err = write_run_block(outputFile, outputBlock, SUBLIST_BLOCK_ID(sublistSize, prevSublistSize), tuplesPerPage, es, metric)) != 0)
+            return err;
+        sublistSize++;
+
+        /* Store the last key output in tuple buffer as output block is used for next input */
+        memcpy(tupleBuffer, outputBlock + es->headerSize + (tuplesPerPage-1)*es->record_size, es->key_offset + es->key_size);
+        haveOutputKey = 1;
+        inputBlock = outputBlock;
+    }
+
+    /* Kept records are the end of the last sublist */
+    *lastSublistBlocks = sublistSize;
+    if (keptCount > 0)
+    {
+        *lastSublistBlocks = sublistSize + 1;
+        return write_run_block(outputFile, keptBlock, SUBLIST_BLOCK_ID(sublistSize, prevSublistSize), keptCount, es, metric);
+    }
+    return 0;
+}
+
+#if defined(ION_FILE_PREFETCH)
+/**
+ * Saves the last record of a block that was just read into lastRecord.
+ */
+EXTERNAL_SORT_TEMPLATE static void save_last_record(char *buffer, int16_t loadedBlock, char *lastRecord, external_sort_t *es, metrics_t *metric)
+{
+    char *block = buffer + loadedBlock * es->page_size;
+    int16_t count = *((int16_t *) (block + BLOCK_COUNT_OFFSET));
+
+    memcpy(lastRecord + loadedBlock * es->record_size, block + es->headerSize + (count - 1) * es->record_size, es->record_size);
+    metric->num_memcpys++;
+}
+
+/**
+ * Forecasts which sublist will need its next block first and starts reading that block. The sublist whose buffered block has the
+ * smallest last record runs out first. lastRecord stores the last record of the current block of each sublist. If loadedBlock is
+ * not -1, that block was just read and its last record is saved first.
+ */
+EXTERNAL_SORT_TEMPLATE static void prefetch_next_block(
+    ION_FILE *outputFile,
+    char    *buffer,
+    int16_t loadedBlock,
+    char    *lastRecord,
+    long    *sublsFilePtr,
+    int8_t  *sublsDescending,
+    int32_t *sublsBlkPos,
+    int32_t *blocksInSublist,
+    int32_t sublistsInRun,
+    external_sort_t *es,
+    metrics_t *metric
+)
+{
+    int16_t i, next = -1;
+
+    if (loadedBlock != -1)
+        save_last_record(buffer, loadedBlock, lastRecord, es, metric);
+
+    for (i = 0; i < sublistsInRun; i++)
+    {
+        if (sublsBlkPos[i] == -1 || sublsBlkPos[i] >= blocksInSublist[i] - 1)
+            continue;                   /* No more blocks to read */
+
+        if (next != -1)
+        {
+            metric->num_compar++;
+            if (external_sort_compare(lastRecord + next * es->record_size, lastRecord + i * es->record_size, es) <= 0)
+                continue;
+        }
+        next = i;
+    }
+
+    if (next != -1)
+        fprefetch(outputFile, sublsFilePtr[next] + (sublsDescending[next] ? -es->page_size : es->page_size), es->page_size);
+}
+#endif
+
+/**
+ * Writes an output block of a merge at writePos and advances it. Blocks of the final pass go to the output sink instead if there is one.
+ * Returns 0 if success, 9 if write error.
+ */
+EXTERNAL_SORT_TEMPLATE static int write_merge_block(ION_FILE *outputFile, char *block, long *writePos, int8_t toSink, external_sort_t *es, metrics_t *metric)
+{
+    if (toSink)
+        return 0 == es->output_sink(es->output_sink_state, block) ? 0 : 9;
+
+    /* Arduino prints 1st value nmemb times if nmemb != 1 */
+    if (0 == fwrite_at(block, (size_t)es->page_size, 1, outputFile, *writePos))
+        return 9;
+
+    *writePos += es->page_size;
+    metric->num_writes += 1;
+    return 0;
+}
+
+/**
+ * Sends sorted sublist of numBlocks blocks starting at filePtr to the output sink. Used when run generation produces only one sublist.
+ * A descending sublist is sent from its last block to its first with the records of each block reversed.
+ * Returns 0 if success, 9 if sink error, 10 if read error.
+ */
+EXTERNAL_SORT_TEMPLATE static int stream_sublist_to_sink(ION_FILE *outputFile, long filePtr, int32_t numBlocks, char *block, external_sort_t *es, metrics_t *metric)
+{
+    int32_t i;
+    int8_t  descending = 0;
+
+    for (i = 0; i < numBlocks; i++)
+    {
+        if (0 == fread_at(block, (size_t)es->page_size, 1, outputFile, filePtr + (long) (descending ? numBlocks-1-i : i)*es->page_size))
+            return 10;
+        metric->num_reads += 1;
+
+        if (i == 0 && !descending && numBlocks > 1 && *((int16_t *) (block + BLOCK_COUNT_OFFSET)) < 0)
+        {   /* Descending sublist. Start again from its last block. */
+            descending = 1;
+            i = -1;
+            continue;
+        }
+        ascending_block(block, es, metric);
+
+        if (0 != es->output_sink(es->output_sink_state, block))
+            return 9;
+    }
+    return 0;
+}
+
+/**
+ * Rewrites a descending sublist of numBlocks blocks starting at filePtr in ascending order. Exchanges blocks from both ends of the
+ * sublist using the first two blocks of buffer. Used when run generation produces only one sublist. Does nothing if it is ascending.
+ * Returns 0 if success, 9 if write error, 10 if read error.
+ */
+EXTERNAL_SORT_TEMPLATE static int ascending_sublist(ION_FILE *outputFile, long filePtr, int32_t numBlocks, char *buffer, external_sort_t *es, metrics_t *metric)
+{
+    char    *first = buffer, *last = buffer + es->page_size;
+    int32_t i, j;
+    int     err;
+
+    for (i = 0, j = numBlocks-1; i <= j; i++, j--)
+    {
+        if (0 == fread_at(first, (size_t)es->page_size, 1, outputFile, filePtr + (long) i*es->page_size))
+            return 10;
+        metric->num_reads += 1;
+        if (i == 0 && *((int16_t *) (first + BLOCK_COUNT_OFFSET)) >= 0)
+            return 0;                   /* Sublist is ascending */
+        ascending_block(first, es, metric);
+
+        if (i == j)
+        {   /* Middle block stays in place */
+            return rewrite_run_block(outputFile, first, filePtr + (long) i*es->page_size, SUBLIST_BLOCK_ID(i, 0), es, metric);
+        }
+
+        if (0 == fread_at(last, (size_t)es->page_size, 1, outputFile, filePtr + (long) j*es->page_size))
+            return 10;
+        metric->num_reads += 1;
+        ascending_block(last, es, metric);
+
+        if ((err = rewrite_run_block(outputFile, last, filePtr + (long) i*es->page_size, SUBLIST_BLOCK_ID(i, 0), es, metric)) != 0)
+            return err;
+        if ((err = rewrite_run_block(outputFile, first, filePtr + (long) j*es->page_size, SUBLIST_BLOCK_ID(j, 0), es, metric)) != 0)
+            return err;
+    }
+    return 0;
+}
+
+/**
+@brief      Run generation and merge phases of no_output_buffer_sort_replace_block(). Parameters and return value are the same.
+*/
+EXTERNAL_SORT_TEMPLATE static int sort_block(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+	void    *tupleBuffer,
+    ION_FILE *outputFile,		
+	char    *buffer,        
+	int     bufferSizeInBlocks,
+	external_sort_t *es,
+	long    *resultFilePtr,
+	metrics_t *metric,
+    int8_t  runGenOnly
+)
+{
+    printf("No Output Buffer Sort with Replacement Selection for Run Generation\n");
+	unsigned long start = millis();
+
+    int16_t     tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;	
+	long        lastWritePos = 0;	
+	int16_t     i, status;
+	int32_t     numSublist=0;
+    int32_t     lastSublistBlocks=0;        /* Size in blocks of last sublist written. Start of run directory chain. */
+    int32_t     numShiftOutOutput = 0, numShiftIntoOutput = 0, numShiftOtherBlock = 0;     
+    int         runGenBlocks = bufferSizeInBlocks;      /* Buffer blocks used by run generation */
+    profile_replay_t replay;
+
+    /* Run state is set by the sort in its own copy of the settings. Caller's values are not used, so they are cleared before the first comparison. */
+    es->run_descending = 0;
+    es->radix_scratch = NULL;
+
+    /* Radix sort distributes a block into the last buffer page, which run generation does not use. Run generation keeps at least 2 blocks.
+       Input profile keeps the page for a radix sort plan until the plan is chosen. */
+    if ((es->in_memory_algorithm >= IN_MEMORY_SORT_RADIX_INT32 || (es->profile_blocks > 0 && radix_key_algorithm(es) != 0)) && bufferSizeInBlocks > 2)
+    {
+        runGenBlocks = bufferSizeInBlocks - 1;
+        es->radix_scratch = buffer + (long) runGenBlocks*es->page_size;
+    }
+
+    metric->profile_sorted_pct = 0;
+    metric->profile_reverse_pct = 0;
+    metric->profile_duplicate_pct = 0;
+    metric->profile_key_bits = 0;
+    metric->plan_run_gen = es->run_gen_algorithm;
+    metric->plan_in_memory_algorithm = (int8_t) block_sort_algorithm(es);
+    metric->plan_fan_in = (int16_t) (es->merge_fan_in >= 2 && es->merge_fan_in < bufferSizeInBlocks ? es->merge_fan_in : bufferSizeInBlocks);
+    metric->predicted_runs = 0;
+    metric->predicted_io = 0;
+    metric->disorder_violations = 0;
+
+    /* Preflight: sample first input blocks into end of buffer to choose the plan. Sampled records are then returned first by the replay iterator. */
+    if (es->profile_blocks > 0)
+    {
+        int32_t sampleRecords = profile_sample_records(runGenBlocks, es);
+        replay.sample = buffer + (long) runGenBlocks*es->page_size - (long) sampleRecords*es->record_size;
+        replay.sampleCount = profile_input(blockIterator, iteratorState, replay.sample, sampleRecords, es, metric);
+        replay.next = 0;
+        replay.iterator = blockIterator;
+        replay.iteratorState = iteratorState;
+        replay.recordSize = es->record_size;
+        blockIterator = profile_replay_iterator;
+        iteratorState = &replay;
+        plan_sort(bufferSizeInBlocks, es, metric);
+        if (NULL != es->radix_scratch && es->in_memory_algorithm < IN_MEMORY_SORT_RADIX_INT32)
+        {   /* Plan does not use radix sort. Scratch page is given back. Sample ends below it so it is still replayed first. */
+            es->radix_scratch = NULL;
+            runGenBlocks = bufferSizeInBlocks;
+        }
+        if (es->two_way_runs && replay.sampleCount > 1)
+            reverse_records(replay.sample, replay.sampleCount, es, metric);     /* Sorted sample follows descending input trend */
+    }
+				                                
+    /* Run generation strategy. Strategies take the same arguments and write sublists in the same format for the merge phase. */
+    int (*runGeneration)(int32_t (*)(void*, void*, int32_t), void*, void*, ION_FILE*, char*, int, external_sort_t*, metrics_t*, int32_t*, int32_t*);
+
+    runGeneration = replacement_selection;
+    switch (es->run_gen_algorithm)
+    {
+        case RUN_GEN_MERGE:
+            runGeneration = merge_run_generation;
+            break;
+        case RUN_GEN_REPLACEMENT_SELECTION_INDEX:
+            if (index_heap_slots(runGenBlocks, es) <= UINT16_MAX)
+                runGeneration = replacement_selection_index;
+            break;
+        case RUN_GEN_LOAD_SORT_STORE:
+            runGeneration = load_sort_store;
+            break;
+        case RUN_GEN_NATURAL_RUNS:
+            runGeneration = natural_runs;
+            break;
+    }
+
+	/* -----Run Generation----- */
+    /* Run generation may send input that fits in the buffer to the output sink. Output stays in the file if only generating runs. */
+    int8_t  (*outputSink)(void *state, void *block) = es->output_sink;
+    if (runGenOnly)
+        es->output_sink = NULL;
+    fadvise(outputFile, 0, 0, ION_FILE_ADVICE_SEQUENTIAL);     /* Sublists are written and a single sublist is read in order */
+    status = runGeneration(blockIterator, iteratorState, tupleBuffer, outputFile, buffer, runGenBlocks, es, metric, &numSublist, &lastSublistBlocks);
+    es->run_descending = 0;
+    es->output_sink = outputSink;
+    if (status != 0)
+        return status;
+    if (0 != fflush(outputFile))
+        return 9;                       /* Barrier: sublists must be written before they are read back (write-behind) */
+
+    unsigned long duration = millis() - start;
+    metric->genTime = duration;
+    printf("Run generation time: %lu\n", duration);
+
+    if (numSublist == 0)
+    {   /* In-memory fast path sent output to sink */
+        *resultFilePtr = -1;
+        return 0;
+    }
+    if (numSublist == 1)
+	{	/* No merge phase necessary */
+		*resultFilePtr = 0;
+        if (es->output_sink != NULL && !runGenOnly)
+        {   /* Sorted output is already in file. Read it once to send to sink. */
+            *resultFilePtr = -1;
+            return stream_sublist_to_sink(outputFile, 0, lastSublistBlocks, buffer, es, metric);
+        }
+        if (es->two_way_runs)
+            return ascending_sublist(outputFile, 0, lastSublistBlocks, buffer, es, metric);
+		return 0;
+	}
+    if (runGenOnly)
+        return 0;
+    if (es->profile_blocks > 0)
+    {   /* Predicted sublists may be off so fan-in is chosen again */
+        es->merge_fan_in = balanced_fan_in((uint32_t) numSublist, bufferSizeInBlocks);
+        metric->plan_fan_in = es->merge_fan_in;
+    }
+        
+    lastWritePos = ftell(outputFile);
+    fadvise(outputFile, 0, 0, ION_FILE_ADVICE_RANDOM);         /* Merge reads one block of each sublist in turn. Next blocks are hinted with fprefetch(). */
+    /* ----- Merge phase: recursively combine M sublists ----- */
+    long	mergeSOW;                                                                           /* start of write */
+    int32_t currentBlockId          = 0;
+    long	lastMergeStart		    = 0;	                                                    /* start of read */
+    long	lastMergeEnd            = lastWritePos;
+
+    long	*sublsFilePtr		    = (long*) malloc(sizeof(long) * bufferSizeInBlocks);        /* location of current record in file */
+    int32_t *sublsBlkPos		    = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);  /* current block of sublist being read */
+    int32_t *blocksInSublist		= (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
+    int8_t  *sublsDescending        = (int8_t*) malloc(sizeof(int8_t) * bufferSizeInBlocks);     /* 1 if sublist is read from its last block to its first */
+
+    int32_t *record1				= (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);  /* current record of each buffered block. (byte offset from start of buffer) */
+    int32_t *record2				= (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);  /* current output block record stored in each buffered block (byte offset from start of buffer) */
+    /* Output block uses record2 to store position of last to-output record inserted */    
+
+    /* Selection tree has a leaf for record1 and record2 of each block. Number of leaves is rounded up to a power of 2. */
+    int16_t numLeaves               = 2;
+    while (numLeaves < 2 * bufferSizeInBlocks)
+        numLeaves *= 2;
+    int16_t *tree                   = (int16_t*) malloc(sizeof(int16_t) * 2 * numLeaves);
+    int16_t changedLeaves[3];
+    int8_t  numChanged              = 0;
+    int8_t  useTree                 = 0;
+    int8_t  rebuildTree             = 0;
+    int16_t run                     = 0;
+    int8_t  passNumber              = 1;
+    int32_t numRuns;
+    int32_t fanIn                   = metric->plan_fan_in;  /* Most sublists merged in a run */
+    int32_t resultRecOffset         = -1;   /* Number of records from start of buffer to the next record to output */
+    int32_t resultBlock	            = -1;   /* Block containing next record to output */
+    char	isRecord2			    = 0;    /* 1 if result record is from the output block but stored in a non outputblock */
+    int32_t offset                  = 0;    /* Offset of current record being compared with current smallest record */
+    int16_t heapSizeRecords;                /* Number of records in heap */      
+    char    outputIsEmpty           = 0;    /* Flag indicating if there are still more input records in sublist in output block */    
+    int16_t numTransferThisPass;
+    int32_t blk                     = -1;
+    int16_t space                   = 0;
+    int32_t outputCursor;
+    int8_t  destBlk;
+    int32_t outputRecord1;                  /* Position of output block input record before adding smallest record to output */
+    int8_t  sinkPass                = 0;    /* 1 if output blocks of this pass go to output sink */
+    unsigned long stallStart        = fstalltime(outputFile);
+    char    *lastRecord             = NULL; /* Last record of current block of each sublist. Used to forecast next block to prefetch. */
+
+    if (sublsFilePtr == NULL || sublsBlkPos == NULL || blocksInSublist == NULL || sublsDescending == NULL
+        || record1 == NULL || record2 == NULL || tree == NULL)
+    {
+        /* Verify all memory has been allocated successfully */
+        free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending);
+        return 8;
+    }
+    #if defined(ION_FILE_PREFETCH)
+    lastRecord                      = (char*) malloc((size_t) bufferSizeInBlocks * es->record_size);
+    if (lastRecord == NULL)
+    {
+        free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending);
+        return 8;
+    }
+    #endif
+    int32_t other = 0;
+    while (numSublist > 1) 
+    {
+        if (passNumber % 3 == 0)
+            lastWritePos = 0;          /* Wrap-around in memory space/file after every 3rd pass */
+                
+        duration = millis() - start; 
+        printf("Pass number: %d  Time: %lu Comparisons: %li  MemCopies: %li  TransferIn: %li  TransferOut: %li TransferOther: %li Other: %li\n", passNumber, duration, metric->num_compar, metric->num_memcpys, numShiftIntoOutput, numShiftOutOutput, numShiftOtherBlock, other);
+        passNumber++;
+
+        /* perform a merge */
+        mergeSOW = lastWritePos;
+
+        numRuns	= (numSublist + fanIn -1)/fanIn; /* Equivalent to CEIL(numSublist/fanIn) */
+        sinkPass = numRuns == 1 && es->output_sink != NULL;     /* Final pass output goes to sink rather than file */
+
+        /* perform runs */
+        long    sublistEnd          = lastMergeEnd;         /* File offset after end of next sublist to read */
+        int32_t sublistBlocks       = lastSublistBlocks;    /* Size in blocks of next sublist to read */
+        int32_t prevRunBlocks       = 0;                    /* Size in blocks of output of previous run */
+        for (run = 0; run < numRuns; run++) 
+        {            
+            /* Set up the run */
+            int32_t sublistsInRun = fanIn;
+            if (numSublist < fanIn) 
+                sublistsInRun = numSublist;
+            numSublist -= sublistsInRun;        
+
+            currentBlockId = 0;
+            /* 
+               Load first block of each sublist of the run. Sublists are read from back of previous pass.
+               Run directory: first block of each sublist stores size of sublist before it in place of block id.
+               Smallest sublist (by first record) is put in output block (0) as this results in fewest swaps (especially for sorted input).
+             */
+            int16_t smallest = 0;
+            for (i = 0; i < sublistsInRun; i++) 
+            {
+                sublsFilePtr[i] = sublistEnd - sublistBlocks * es->page_size;
+                sublsBlkPos[i] = 0;
+                blocksInSublist[i] = sublistBlocks;
+
+                if (0 == fread_at(&buffer[i * es->page_size], (size_t)es->page_size, 1, outputFile, sublsFilePtr[i])) 
+                {   /* Read error */
+                    free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending); free(lastRecord);
+                    return 10;
+                }
+                metric->num_reads += 1;                
+
+                sublistEnd = sublsFilePtr[i];
+                sublistBlocks = -(*(int32_t*) &buffer[i * es->page_size + BLOCK_ID_OFFSET]);
+
+                /* Descending sublist is read from its last block. Its first block is only read first for the run directory. */
+                sublsDescending[i] = *((int16_t *) (buffer + i * es->page_size + BLOCK_COUNT_OFFSET)) < 0;
+                if (sublsDescending[i] && blocksInSublist[i] > 1)
+                {
+                    sublsFilePtr[i] += (long) (blocksInSublist[i]-1) * es->page_size;
+                    if (0 == fread_at(&buffer[i * es->page_size], (size_t)es->page_size, 1, outputFile, sublsFilePtr[i]))
+                    {   /* Read error */
+                        free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending); free(lastRecord);
+                        return 10;
+                    }
+                    metric->num_reads += 1;
+                }
+                ascending_block(&buffer[i * es->page_size], es, metric);
+
+                #ifdef DEBUG_READ
+                test_record_t *firstRec = (void*) buffer + i * es->page_size + es->headerSize;
+                test_record_t *lastRec = (void*) buffer + i * es->page_size + es->headerSize + (*((int16_t *) (buffer + i * es->page_size + BLOCK_COUNT_OFFSET))-1) * es->record_size;               
+                printf("Read Sublist: %d Blocks: %d NumRec: %d First key: %d Last key: %d\n", i, blocksInSublist[i], 
+                                 *((int16_t *) (buffer + i * es->page_size + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
+                #endif
+
+                if (i != 0)
+                {
+                    metric->num_compar++;
+                    if (external_sort_compare(buffer + smallest * es->page_size + es->headerSize, buffer + i * es->page_size + es->headerSize, es) > 0)
+                        smallest = i;
+                }
+            }
+
+            if (smallest != 0)
+            {
+                #ifdef DEBUG
+                test_record_t *buffer0Rec = (void*) buffer + es->headerSize;
+                test_record_t *currentRec = (void*) buffer + smallest * es->page_size + es->headerSize;
+                printf("Swapping in buffer 0. Current key: %d  New key: %d\n", buffer0Rec->key, currentRec->key);
+                #endif
+                swap_pages(buffer, buffer + smallest * es->page_size, tupleBuffer, es, metric);
+
+                long    filePtr         = sublsFilePtr[0];
+                int32_t blocks          = blocksInSublist[0];
+                sublsFilePtr[0]         = sublsFilePtr[smallest];
+                blocksInSublist[0]      = blocksInSublist[smallest];
+                sublsFilePtr[smallest]  = filePtr;
+                blocksInSublist[smallest] = blocks;
+                int8_t  descending      = sublsDescending[0];
+                sublsDescending[0]      = sublsDescending[smallest];
+                sublsDescending[smallest] = descending;
+            }
+
+            for (i = 0; i < sublistsInRun; i++) 
+            {
+                /* Initialize record1 to start of each block and record2 to empty */
+                record1[i] = i * es->page_size + es->headerSize;
+                record2[i] = -1;
+                #if defined(ION_FILE_PREFETCH)
+                save_last_record(buffer, i, lastRecord, es, metric);
+                #endif
+            }          
+            #if defined(ION_FILE_PREFETCH)
+            prefetch_next_block(outputFile, buffer, -1, lastRecord, sublsFilePtr, sublsDescending, sublsBlkPos, blocksInSublist, sublistsInRun, es, metric);
+            #endif
+
+            /* Use selection tree to find smallest record when fan-in is large enough that it saves comparisons over a scan */
+            useTree = sublistsInRun >= MERGE_TREE_MIN_FANIN;
+            rebuildTree = 1;
+
+            /* Perform the run */
+            while (1) 
+            {
+                /* Find next smallest tuple */                
+                resultBlock	                    = -1;   
+                isRecord2			            = 0;                  
+
+                if (useTree)
+                {
+                    /* Replay only the matches affected by the last output unless blocks were reloaded and records moved between blocks */
+                    if (rebuildTree)
+                        merge_tree_build(tree, numLeaves, buffer, record1, record2, sublistsInRun, es, metric);
+                    else if (numChanged > 0)
+                        merge_tree_update(tree, numLeaves, changedLeaves, numChanged, buffer, record1, record2, sublistsInRun, es, metric);
+                    rebuildTree = 0;
+
+                    if (tree[1] != -1)
+                    {
+                        resultBlock = tree[1] >> 1;
+                        isRecord2 = tree[1] & 1;
+                        resultRecOffset = merge_tree_leaf(tree[1], record1, record2, sublistsInRun, es);
+                    }
+                }
+                else
+                {
+                    /* Find first sublist with valid data record */
+                    i = 0;
+                    while (i < sublistsInRun && record1[i] == -1)
+                        i++;
+
+                    if (i < sublistsInRun)
+                    {   /* Found a sublist with a valid data record */
+                        resultRecOffset = record1[i];
+                        resultBlock = i;
+                        i++;
+                    }
+
+                    /* Go through rest of sublists looking for a smaller record */
+                    for ( ; i < sublistsInRun; i++) 
+                    {
+                        if (record1[i] == -1) 
+                            continue;                       /* Sublist has no more records */
+
+                        offset = record1[i];
+
+                        metric->num_compar++;
+                        if (0 < external_sort_compare(buffer + resultRecOffset, buffer + offset, es)) 
+                        {   /* Record is smaller than current smallest record */
+                            resultRecOffset = offset;
+                            resultBlock = i;
+                        }
+                    }
+
+                    /* Find smallest value of last block, it might be scattered amongst other blocks 
+                       Note: For loop code is assuming OUTPUT_BLOCK_ID is 0. Otherwise, i should start at 0 not 1 and must check if i == OUTPUT_BLOCK_ID.
+                    */
+                    for (i = 1; i < sublistsInRun; i++) 
+                    {                
+                        if (record2[i] == -1) 
+                            continue;       /* This block has no records from the output block */
+
+                        /* Current value is at start of block in list 2 */
+                        offset = i * es->page_size + es->headerSize;
+
+                        if (resultBlock != -1)
+                            metric->num_compar++;
+
+                        if ((resultBlock == -1) || 0 < external_sort_compare(buffer + resultRecOffset, buffer + offset, es)) 
+                        {   /* Record is smaller than current smallest record */
+                            resultRecOffset     = offset;
+                            resultBlock	        = i;
+                            isRecord2			= 1;
+                        }
+                    }
+                }
+
+                if (resultBlock == -1) break; /* No records left to merge */
+
+                /* increment record2 to next position of output block. record2 is where the next record to output will be placed */
+                if (record2[OUTPUT_BLOCK_ID] == -1) 
+                    record2[OUTPUT_BLOCK_ID] = BUFFER_OUTPUT_BLOCK_START_RECORD_OFFSET;                
+                else 
+                    record2[OUTPUT_BLOCK_ID] += es->record_size;                
+                                                           
+                #ifdef DEBUG
+                test_record_t *buf = (void*) buffer + resultRecOffset;
+                printf("Smallest Record: %d  From list: %d\n", buf->key, resultBlock);                        
+                printf("List status: 0: (%d, %d) 1: (%d, %d) 2: (%d, %d) ResultList: %d\n", record1[0],record2[0],
+                                                record1[1],record2[1],record1[2],record2[2], resultBlock);
+
+                if (buf->key == 27391)
+                {
+                    /* Output all block contents */
+                    for (int l=0; l < 2; l++)
+                    {   
+                        printf("Current  block: %d  # records: %d\n", l, tuplesPerPage);
+                        for (int k=0; k < tuplesPerPage; k++)
+                        {
+                            test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size);
+                            printf("%d: Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size));                     
+                        }
+                    }
+                    printf("HERE\n");
+                }
+                #endif
+                
+                /* Add smallest tuple to output position in buffer (may already be in output buffer) */
+                outputRecord1 = record1[OUTPUT_BLOCK_ID];
+                if (resultBlock != OUTPUT_BLOCK_ID) 
+                {
+                    if ((record1[OUTPUT_BLOCK_ID] == record2[OUTPUT_BLOCK_ID]) && (record1[OUTPUT_BLOCK_ID] != -1)) 
+                    {   /* Output block does not have space for the result record */
+                        /* Optimization (removed):  
+                           Determine if space in block holding smallest record to store output block.
+                           If so, can directly insert into the heap in that block rather than using a temporary tuple.
+                           Note: Can extend this to check if space in other blocks not just the one with smallest record.
+                           This would be more comparisons but would save record copies.
+                           Savings on memory copies between 1 and 2% was determined not to be worth extra calculations.
+                           This is for records of 16 bytes. May be different for larger records.                           
+                        */                       
+
+                        /* Move output block's record into temporary buffer */
+                        metric->num_memcpys++;
+                        memcpy(tupleBuffer, buffer + record1[OUTPUT_BLOCK_ID], (size_t)es->record_size);
+                        numShiftOutOutput++;                                                                                                                                           
+                        #ifdef DEBUG
+                        test_record_t *buf = (void*) (buffer + record1[OUTPUT_BLOCK_ID]);
+                        printf("Output record moved to list %d Key: %d\n", resultBlock, buf->key);
+                        #endif                                
+                        /* Move result record into output block (record1[output_block]==record2[output_block]) */
+                        metric->num_memcpys++;
+                        memcpy(buffer + record2[OUTPUT_BLOCK_ID], buffer + resultRecOffset, (size_t)es->record_size);
+                                                
+                        /* Move displaced output block record out of the temp buffer and into the output list (list2) of the result record's block */
+                        if (isRecord2 == 0) 
+                        {   /* Smallest record is not originally from output block */
+							/* Result is from record1 list. Insert into heap of output records for block. */                                                      
+							if (record2[resultBlock] == -1) 
+								record2[resultBlock] = resultBlock * es->page_size + es->headerSize;						
+							else 
+								record2[resultBlock] += es->record_size;							
+                            heapSizeRecords = (record2[resultBlock]+es->record_size-resultBlock*es->page_size)/es->record_size;                            
+                            /* Buffered output record is in tuple_buffer */
+                            shiftUp(buffer + resultBlock*es->page_size + es->headerSize, tupleBuffer, heapSizeRecords -1, es, metric);                            
+						}
+						else 
+                        {
+							/* Result is from record2 list. Insert the displaced output value into record2 list */
+                            heapSizeRecords = (record2[resultBlock]+es->record_size-resultBlock*es->page_size)/es->record_size;
+
+                            /* Output record to be inserted is already stored in the tuple_buffer */
+                            heapify(buffer + resultBlock*es->page_size + es->headerSize, tupleBuffer, heapSizeRecords, es, metric);
+						}                      
+                        
+						/* Displaced the output block's current record. Increment to next output block record. */
+						record1[OUTPUT_BLOCK_ID] += es->record_size;
+                        if (record1[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + (*((int16_t *) (buffer + OUTPUT_BLOCK_ID * es->page_size + BLOCK_COUNT_OFFSET))) * es->record_size + es->headerSize) 
+						// if (record1[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + tuplesPerPage*es->record_size + es->headerSize)                        
+							record1[OUTPUT_BLOCK_ID] = -1;      						
+                    }
+                    else 
+                    {   /* Output block already has an empty slot for the result value. Only need to move result value into result list of output block. */
+                        /* Move result record into output block */
+                        metric->num_memcpys++;
+                        memcpy(buffer + record2[OUTPUT_BLOCK_ID], buffer + resultRecOffset, (size_t)es->record_size);
+
+                        if (isRecord2 == 1) 
+                        {
+                            /* is_record2: result value came from list2 of result block */
+                            record2[resultBlock] -= es->record_size;
+
+                            if (record2[resultBlock] < resultBlock * es->page_size + es->headerSize) 
+                                record2[resultBlock] = -1;                            
+                            else
+                            {
+                                /* Move last value to front of heap */
+                                heapSizeRecords = (record2[resultBlock] + es->record_size - resultBlock * es->page_size) / es->record_size;
+                                heapify(buffer + resultBlock*es->page_size + es->headerSize, buffer + record2[resultBlock]+es->record_size, heapSizeRecords, es, metric);
+							}                           
+                        }
+                    }
+
+                    /* increment to next position of block that smallest value was read from */
+                    if (isRecord2 == 0) 
+                        record1[resultBlock] += es->record_size;                    
+                } /* end if smallestblock != output block */
+                else 
+                {
+                    /* The smallest value is already in output block, move it from record1 to record2 */
+                    if (record2[resultBlock] != record1[resultBlock]) 
+                    {
+                        metric->num_memcpys++;
+                        memcpy(buffer + record2[resultBlock], buffer + record1[resultBlock], (size_t)es->record_size);
+                    }
+
+                    record1[resultBlock] += es->record_size;
+                }	/* end of adding smallest tuple to appropriate block */
+
+                /* Leaves of the result block always change. Output block's input leaf changes if its record was displaced. */
+                numChanged = 0;
+                if (resultBlock != OUTPUT_BLOCK_ID && record1[OUTPUT_BLOCK_ID] != outputRecord1)
+                    changedLeaves[numChanged++] = 2 * OUTPUT_BLOCK_ID;
+                changedLeaves[numChanged++] = 2 * resultBlock;
+                changedLeaves[numChanged++] = 2 * resultBlock + 1;
+
+                /* Determine if block with smallest value has any more records in it */                
+                if (record1[resultBlock] >= resultBlock * es->page_size + (*((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET))) * es->record_size + es->headerSize) 
+					record1[resultBlock] = -1;				
+
+                /* Output block is full, write it out */
+                if (record2[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + tuplesPerPage*es->record_size - es->record_size) 
+                {                
+                    /* Setup block header */
+                    *((int32_t *) buffer) = SUBLIST_BLOCK_ID(currentBlockId, prevRunBlocks);
+                    *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)) = (int16_t)tuplesPerPage;
+                    currentBlockId++;
+
+                    if (0 != write_merge_block(outputFile, buffer + OUTPUT_BLOCK_ID * es->page_size, &lastWritePos, sinkPass, es, metric)) 
+                    {   /* File write error */
+                        free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending); free(lastRecord);
+                        return 9;
+                    }                                        
+
+                    record2[OUTPUT_BLOCK_ID]	= -1;
+                    #ifdef DEBUG_OUTPUT
+                    printf("Wrote output block: %d  # records: %d\n", *((int32_t *) buffer), tuplesPerPage);
+                    for (int k=0; k < tuplesPerPage; k++)
+		            {
+			            test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size);
+			            printf("%d: Output Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size));                     
+		            }
+                    #endif                    
+                }                
+
+                /* Read in the next block of a sublist if buffered block is depleted (non-output block) */
+                if ((record1[resultBlock] == -1) && (sublsBlkPos[resultBlock] != -1) && (resultBlock != OUTPUT_BLOCK_ID)) 
+                {
+                    /* check if we are finished with that sublist */
+                    if (sublsBlkPos[resultBlock] >= blocksInSublist[resultBlock] - 1) 
+                    {
+                        sublsBlkPos[resultBlock]	 = -1;	/* sublist is spent */
+                        record1[resultBlock]	     = -1;
+                    }
+                    else 
+                    {
+                        /* not finished with sublist read in next block of sublist */
+                        sublsBlkPos[resultBlock]++;
+                        sublsFilePtr[resultBlock] += sublsDescending[resultBlock] ? -es->page_size : es->page_size;
+
+                        /* put any output records in this block into other blocks */
+                        int32_t originPtr	= resultBlock * es->page_size + es->headerSize;
+                        int32_t destBlk	= OUTPUT_BLOCK_ID;
+                        int16_t numTransfer = (record2[resultBlock]-originPtr) / es->record_size + 1;
+
+                        /* while there are still records left to move */
+                        while (record2[resultBlock] != -1 && originPtr <= record2[resultBlock]) 
+                        {
+                            /* Find a block with space to store the record */
+                            blk         = -1;
+                            space		= 0;
+                            while (blk == -1 && space == 0) 
+                            {                                                               
+                                if (record1[destBlk] != -1) 
+                                    space += record1[destBlk] - (destBlk * es->page_size + es->headerSize);                       
+                                else 
+                                    space += es->page_size - es->headerSize;                                
+
+                                if (record2[destBlk] != -1) 
+                                    space -= (record2[destBlk] - destBlk * es->page_size + es->record_size - es->headerSize);                                
+
+                                space = space / es->record_size;
+
+                                if (space >= 1)
+                                    blk = destBlk;
+                                else 
+                                    destBlk++;
+
+                                if (resultBlock == destBlk) 
+                                    destBlk++;                     /* Go to next destination block if currently at the original block that had smallest value */
+
+                                if (destBlk > bufferSizeInBlocks)
+                                {
+                                    printf("Incorrect destination block. List 1: (%d, %d) List 2: (%d, %d) List 3: (%d, %d) ResultList: %d\n", record1[0],record2[0],
+                                            record1[1],record2[1],record1[2],record2[2], resultBlock);
+
+                                    /* Output all block contents */
+                                    for (int l=0; l < 3; l++)
+                                    {   
+                                        printf("Current  block: %d  # records: %d\n", l, tuplesPerPage);
+                                        for (int k=0; k < tuplesPerPage; k++)
+                                        {
+                                            test_record_t *buf = (test_record_t*) (buffer+es->headerSize+k*es->record_size+l*es->page_size);
+                                            printf("%d: Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size));                     
+                                        }
+                                    }
+                                }
+                            }
+
+                            numTransferThisPass = space;
+                            if (space > numTransfer)
+                                numTransferThisPass = numTransfer;
+                            numTransfer -= numTransferThisPass;
+
+                            if (destBlk == OUTPUT_BLOCK_ID) 
+                            {   /* Returning tuples back to output block */                         
+                                /* Position record1 input pointer at first space for record to be inserted */                               
+                                if (record1[destBlk] == -1)
+                                {   /* There are no input records in sublist 0 currently in the block. Input records now end at end of block. */
+                                    *((int16_t *) (buffer + destBlk * es->page_size + BLOCK_COUNT_OFFSET)) = tuplesPerPage;
+                                    record1[destBlk] = destBlk * es->page_size + (tuplesPerPage - numTransferThisPass) * es->record_size + es->headerSize;
+                                    offset = record1[destBlk];                                  /* Remember first insert location */
+                                    for (i=0; i <  numTransferThisPass; i++)
+                                    {
+                                        #ifdef DEBUG
+                                        test_record_t *buf = (void*) (buffer + originPtr);
+                                        printf("Empty output block case. Moved output record back from list %d Key: %d\n", resultBlock, buf->key);
+                                        #endif
+                                        numShiftIntoOutput++;
+                                        /* Get top value from heap */
+                                        metric->num_memcpys++;
+                                        memcpy(buffer + record1[destBlk], buffer + originPtr, (size_t)es->record_size);
+
+                                        /* Fix heap */
+                                        heapSizeRecords = (record2[resultBlock]+es->record_size-resultBlock*es->page_size)/es->record_size;
+                                        heapSizeRecords--;              /* Subtract 1 as going to use last record in heap as insert record */
+                            
+                                        heapify(buffer + resultBlock*es->page_size + es->headerSize, (void*) (buffer+record2[resultBlock]), heapSizeRecords, es, metric);                                    
+                                        record1[destBlk] += es->record_size;
+                                        record2[resultBlock] -= es->record_size;
+                                    }   
+                                     record1[destBlk] = offset;         /* Set pointer to first insert location */                                                                                                     
+                                }
+                                else
+                                {
+                                    for (i=0; i <  numTransferThisPass; i++)
+                                    {
+                                        record1[destBlk] = record1[destBlk] - es->record_size;
+                                        #ifdef DEBUG
+                                        test_record_t *buf = (void*) (buffer + originPtr);
+                                        printf("Moved output record back from list %d Key: %d\n", resultBlock, buf->key);
+                                        #endif
+                                        numShiftIntoOutput++;
+
+                                        /* insertion sort type insert */
+                                        /* Block may not be full of input records. Only shift down the input records. */
+                                        int32_t insert_ptr = record1[destBlk];
+                                        int32_t last_ptr = destBlk * es->page_size + es->headerSize + (*((int16_t *) (buffer + destBlk * es->page_size + BLOCK_COUNT_OFFSET)) - 1) * es->record_size;
+                                        while (insert_ptr < last_ptr) 
+                                        {
+                                            metric->num_compar++;
+                                            #ifdef DEBUG
+                                            test_record_t *buf = (void*) (buffer + insert_ptr + es->record_size);
+                                            printf("Compare with list %d Key: %d\n", resultBlock, buf->key);
+                                            #endif
+                                            if ( 0 < external_sort_compare(buffer + originPtr, buffer + insert_ptr + es->record_size, es)) 
+                                            {
+                                                /* shift next_val down */
+                                                metric->num_memcpys++;
+                                                memcpy(buffer + insert_ptr, buffer + insert_ptr + es->record_size, (size_t)es->record_size);
+                                            }
+                                            else 
+                                                break;                                    
+
+                                            insert_ptr += es->record_size;
+                                        }
+
+                                        metric->num_memcpys++;
+                                        memcpy(buffer + insert_ptr, buffer + originPtr, (size_t)es->record_size); 
+                                        originPtr += es->record_size;  
+                                    }                            
+                                }
+                            }
+                            else 
+                            {
+                                for (i=0; i <  numTransferThisPass; i++)
+                                {
+                                    /* insert into a non output block, put into the record2 list of the block */
+                                    if (record2[destBlk] == -1) 
+                                        record2[destBlk] = destBlk * es->page_size + es->headerSize;	/* no other record2 values */
+                                    else 
+                                        record2[destBlk] += es->record_size;	                        /* other record2 values */
+                                
+                                    #ifdef DEBUG
+                                    test_record_t *buf = (void*) (buffer + originPtr);
+                                    printf("Moved output record to list %d Key: %d\n", destBlk, buf->key);                              
+                                    #endif
+                                    numShiftOtherBlock++;
+                                
+                                    /* Insert at end of heap */
+                                    int32_t heapSizeRecords = (record2[destBlk]+es->record_size - es->page_size*destBlk)/es->record_size; 
+                                    shiftUp(buffer + destBlk*es->page_size + es->headerSize, buffer + originPtr, heapSizeRecords -1, es, metric);    
+
+                                    originPtr += es->record_size;                              
+                                }
+                            }                          
+                        }
+
+                        /* read in next block */
+                        if (0 == fread_at(buffer + resultBlock * es->page_size, (size_t)es->page_size, 1, outputFile, sublsFilePtr[resultBlock])) 
+                        {   /* Read error */
+                            free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending); free(lastRecord);
+                            return 10;
+                        }
+                        ascending_block(buffer + resultBlock * es->page_size, es, metric);
+                        metric->num_reads		+= 1;                                             
+                        record2[resultBlock]	= -1;
+                        record1[resultBlock]	= resultBlock * es->page_size + es->headerSize;
+                        rebuildTree             = 1;        /* Records were moved into other blocks */
+                        #if defined(ION_FILE_PREFETCH)
+                        prefetch_next_block(outputFile, buffer, resultBlock, lastRecord, sublsFilePtr, sublsDescending, sublsBlkPos, blocksInSublist, sublistsInRun, es, metric);
+                        #endif
+                        #ifdef DEBUG_READ
+                        printf("Read block sublist: %d\n", resultBlock);
+                        test_record_t *firstRec = (void*) buffer + resultBlock * es->page_size + es->headerSize;
+                        test_record_t *lastRec = (void*) buffer + resultBlock * es->page_size + es->headerSize + (*((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET))-1) * es->record_size;               
+                        printf("Read Sublist: %d Block: %d NumRec: %d First key: %d Last key: %d\n", resultBlock, (int32_t) *(buffer + resultBlock * es->page_size), 
+                                 *((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
+                        #endif
+                    }
+                }	/* end if is the non output block empty */
+
+                /* Determine if there are no records from the output block left */
+                outputIsEmpty = 1;
+                if (record1[OUTPUT_BLOCK_ID] != -1) 
+                {
+                    outputIsEmpty = 0;
+                }
+                else 
+                {
+                    for (i = 0; i < sublistsInRun; i++) 
+                    {
+                        if (i == OUTPUT_BLOCK_ID) 
+                            continue;                        
+
+                        if (record2[i] != -1) 
+                        {
+                            outputIsEmpty = 0;
+                            break;
+                        }
+                    }
+                }
+
+                /* read in next block of sublist (output block) */
+                if (outputIsEmpty && (-1 != sublsBlkPos[OUTPUT_BLOCK_ID])) 
+                {
+                    /* check if we are finished with output blocks associated sublist */
+                    if (sublsBlkPos[OUTPUT_BLOCK_ID] >= blocksInSublist[OUTPUT_BLOCK_ID] - 1) 
+                    {
+                        sublsBlkPos[OUTPUT_BLOCK_ID]        = -1;	/* sublist is spent */
+                        record1[OUTPUT_BLOCK_ID]		    = -1;
+                    }
+                    else 
+                    {                        
+                        /* sublist isn't empty read in next block of sublist */
+                        sublsBlkPos[OUTPUT_BLOCK_ID]++;
+                        sublsFilePtr[OUTPUT_BLOCK_ID] += sublsDescending[OUTPUT_BLOCK_ID] ? -es->page_size : es->page_size;
+
+                        /* if the output block contains results they have to be temporarily stored in other blocks. */
+                        if (record2[OUTPUT_BLOCK_ID] != -1) 
+                        {
+                            outputCursor	= OUTPUT_BLOCK_ID * es->page_size + es->headerSize;
+                            destBlk		    = 1;
+
+                            /* While there are still output tuples to move */
+                            while (outputCursor <= record2[OUTPUT_BLOCK_ID]) 
+                            {
+                                /* find next block with space to store a tuple. Start at block 1 continue to block N where N>1 */
+                                blk = -1;
+                                space = 0;
+                                while (-1 == blk) 
+                                {                                    
+                                    if (record1[destBlk] != -1) 
+                                        space += record1[destBlk] - (destBlk * es->page_size + es->headerSize);                                    
+                                    else 
+                                        space += es->page_size - es->headerSize;
+
+                                    if (record2[destBlk] != -1) 
+                                        space -= (record2[destBlk] - destBlk * es->page_size + es->record_size - es->headerSize);                                    
+
+                                    space = space / es->record_size;
+
+                                    if (space >= 1) 
+                                        blk = destBlk;                                    
+                                    else 
+                                        destBlk++;                                                                   
+                                }
+
+                                if (record2[destBlk] == -1) 
+                                    record2[destBlk] = destBlk * es->page_size + es->headerSize;                                
+                                else 
+                                    record2[destBlk] += es->record_size;                                
+
+                                /* move the record */
+                                #ifdef DEBUG
+                                test_record_t *buf = (void*) (buffer + outputCursor);
+                                printf("Output list empty so moved record in output to list %d Key: %d\n", destBlk, buf->key);
+                                #endif
+                                numShiftOutOutput++;
+                                metric->num_memcpys++;
+                                memcpy(buffer + record2[destBlk], buffer + outputCursor, (size_t)es->record_size);
+                                outputCursor += es->record_size;
+                            }
+                        }
+
+                        /* Perform the the read into the now empty output block */
+                        if (0 == fread_at(buffer + OUTPUT_BLOCK_ID * es->page_size, (size_t)es->page_size, 1, outputFile, sublsFilePtr[OUTPUT_BLOCK_ID])) 
+                        {   // Read error
+                            free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending); free(lastRecord);
+                            return 10;
+                        }
+                        ascending_block(buffer + OUTPUT_BLOCK_ID * es->page_size, es, metric);
+                        
+                        int16_t numRecords = *((int16_t*) (buffer + BLOCK_COUNT_OFFSET));
+                        #ifdef DEBUG_READ
+                        printf("Read block sublist: 0\n");
+                        test_record_t *firstRec = (void*) buffer + es->headerSize;
+                        test_record_t *lastRec = (void*) buffer + es->headerSize + (*((int16_t *) (buffer +  BLOCK_COUNT_OFFSET))-1) * es->record_size;               
+                         printf("Read Sublist: %d Block: %d NumRec: %d First key: %d Last key: %d\n", 0, (int32_t) *(buffer + 0 * es->page_size), 
+                                 *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
+                        #endif
+
+                        metric->num_reads	+= 1;
+						record1[OUTPUT_BLOCK_ID]	= OUTPUT_BLOCK_ID * es->page_size + es->headerSize;
+                        rebuildTree                 = 1;
+                        #if defined(ION_FILE_PREFETCH)
+                        prefetch_next_block(outputFile, buffer, OUTPUT_BLOCK_ID, lastRecord, sublsFilePtr, sublsDescending, sublsBlkPos, blocksInSublist, sublistsInRun, es, metric);
+                        #endif
+
+                        /* put the results back into the output block, re-add them in reverse order from when we removed them (blocks N to 1)
+						 * This will keep the blocks in sorted order.  */
+						if (record2[OUTPUT_BLOCK_ID] != -1) 
+                        {
+							outputCursor = OUTPUT_BLOCK_ID * es->page_size + es->headerSize;						
+                            i = 0;
+
+							for (blk = 0; blk < sublistsInRun; blk++) 
+                            {
+								if (record2[blk] == -1) 
+									continue;								
+
+								if (blk == OUTPUT_BLOCK_ID) 
+									continue;								
+
+								int32_t blkCursor = blk * es->page_size + es->headerSize;
+								int32_t limit = record2[blk];
+
+                                /* Output block read may not be full of input records. Only swap the input records (counted over all blocks). */
+                                while (blkCursor <= limit && i < numRecords)
+                                {
+                                    i++;
+                                    metric->num_memcpys += 3;
+                                    /* swap record */
+									memcpy(tupleBuffer, buffer + blkCursor, (size_t)es->record_size);                                  
+									memcpy(buffer + blkCursor, buffer + outputCursor, (size_t)es->record_size);                                    
+                                    memcpy(buffer + outputCursor, tupleBuffer, (size_t)es->record_size);                                    
+									outputCursor	+= es->record_size;
+									blkCursor		+= es->record_size;
+                                    numShiftIntoOutput++;
+								}
+                                /* Copy back to output block all remaining records into the free space in the output block */
+                                while (blkCursor <= limit)
+                                {           
+                                    metric->num_memcpys += 1;                         
+									memcpy(buffer + outputCursor, buffer + blkCursor, (size_t)es->record_size);                                                                     
+									outputCursor	+= es->record_size;
+									blkCursor		+= es->record_size;
+                                    numShiftIntoOutput++;
+                                    record2[blk] -= es->record_size;
+                                }
+                                if (record2[blk] < blk * es->page_size + es->headerSize)
+                                    record2[blk] = -1;          /* All records were moved back to output block */
+							}
+
+							record1[OUTPUT_BLOCK_ID] = record2[OUTPUT_BLOCK_ID] + es->record_size;
+
+							if (record1[OUTPUT_BLOCK_ID] >=  OUTPUT_BLOCK_ID * es->page_size + es->headerSize + numRecords*es->record_size) 
+								record1[OUTPUT_BLOCK_ID] = -1;							
+						}
+					}                       
+                } /*end of reading in next output block */
+            }	/* end of run */
+
+            if (record2[0] > 0)
+            {   /* Tuples in output block to write out */
+                /* setup header */
+                *((int32_t *) buffer) = SUBLIST_BLOCK_ID(currentBlockId, prevRunBlocks);
+                *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)) = (int16_t) (record2[0]-es->headerSize)/es->record_size + 1; 
+                currentBlockId++;
+
+                if (0 != write_merge_block(outputFile, buffer + OUTPUT_BLOCK_ID * es->page_size, &lastWritePos, sinkPass, es, metric)) 
+                {   /* File write error */
+                    free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending); free(lastRecord);
+                    return 9;
+                }                    
+
+                record2[OUTPUT_BLOCK_ID]	= -1;
+
+                #ifdef DEBUG_OUTPUT
+                printf("Wrote output block here.\n");
+                for (int k=0; k < tuplesPerPage; k++)
+                {
+                    test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size);
+                    printf("%d: Output Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size));
+                }
+                #endif
+            }
+            prevRunBlocks = currentBlockId;
+
+        }	/* end of runs */
+
+        if (0 != fflush(outputFile))
+        {   /* Barrier: output of this pass must be written before next pass reads it */
+            free(record1); free(record2); free(tree); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist); free(sublsDescending); free(lastRecord);
+            return 9;
+        }
+
+        numSublist                  = numRuns;      /* each run produces 1 sublist */
+        lastSublistBlocks           = prevRunBlocks;
+        lastMergeStart			    = mergeSOW;     /* next merge reads where this one started writing */
+        lastMergeEnd                = lastWritePos;
+
+    }	/* end of merge */
+    *resultFilePtr = sinkPass ? -1 : lastMergeStart;
+    metric->stallTime = (uint32_t) (fstalltime(outputFile) - stallStart);
+    
+    duration = millis() - start; 
+    printf("Complete. Time: %lu Comparisons: %li  MemCopies: %li  TransferIn: %li  TransferOut: %li TransferOther: %li Other: %li\n", duration, metric->num_compar, metric->num_memcpys, numShiftIntoOutput, numShiftOutOutput, numShiftOtherBlock, other);
+
+    /* cleanup */
+    free(sublsFilePtr);
+    free(sublsDescending);
+    free(sublsBlkPos);
+    free(blocksInSublist);
+    free(lastRecord);
+
+    free(record1);
+    free(record2);
+    free(tree);
+
+	return 0;
+}
+
+/**
+@brief      No output sort with block input iterator and supporting variable number of records per block. Uses replacement selection.
+@param      blockIterator
+                Block iterator for reading input rows. Copies up to maxRecords consecutive rows into buffer and returns number copied (0 when no more rows).
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      outputFile
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record. -1 if output was sent to es->output_sink.
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Not used. Records are ordered by es->compare_fcn. Kept so existing callers compile.
+@param      runGenOnly
+                If 1, only generates sorted sublists and does not merge them
+*/
+EXTERNAL_SORT_TEMPLATE int no_output_buffer_sort_replace_block(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+	void    *tupleBuffer,
+    ION_FILE *outputFile,		
+	char    *buffer,        
+	int     bufferSizeInBlocks,
+	external_sort_t *es,
+	long    *resultFilePtr,
+	metrics_t *metric,
+    int8_t  (*compareFn)(void *a, void *b),
+    int8_t  runGenOnly
+)
+{
+    external_sort_t sortState = *es;        /* Sort plan and run generation state change this copy. Caller's settings are unchanged. */
+    unsigned long deviceStart = fdevicetime(outputFile);
+    int status = sort_block(blockIterator, iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks, &sortState, resultFilePtr, metric, runGenOnly);
+    metric->deviceTime = (uint32_t) (fdevicetime(outputFile) - deviceStart);
+    return status;
+}
+
+/**
+@brief      No output sort with record input iterator. Wraps the record iterator as a block iterator that reads one row per call.
+            Parameters are the same as no_output_buffer_sort_replace_block() except iterator.
+@param      iterator
+                Row iterator for reading input rows. Returns 0 when no more rows.
+*/
+EXTERNAL_SORT_TEMPLATE int no_output_buffer_sort_replace(
+    int     (*iterator)(void *state, void* buffer),
+    void    *iteratorState,
+	void    *tupleBuffer,
+    ION_FILE *outputFile,
+	char    *buffer,
+	int     bufferSizeInBlocks,
+	external_sort_t *es,
+	long    *resultFilePtr,
+	metrics_t *metric,
+    int8_t  (*compareFn)(void *a, void *b),
+    int8_t  runGenOnly
+)
+{
+    record_iterator_shim_t shim;
+
+    shim.iterator       = iterator;
+    shim.iteratorState  = iteratorState;
+    shim.recordSize     = es->record_size;
+
+    return no_output_buffer_sort_replace_block(&record_iterator_shim, &shim, tupleBuffer, outputFile, buffer, bufferSizeInBlocks,
+                                                es, resultFilePtr, metric, compareFn, runGenOnly);
+}
+
+#endif
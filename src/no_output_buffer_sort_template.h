@@ -0,0 +1,155 @@
+/******************************************************************************/
+/**
+@file		no_output_buffer_sort_template.h
+@author		IonDB Project Contributors
+@brief		C++ template of no output buffer sort specialized at compile time
+            for a fixed record layout.
+@copyright	Copyright 2021
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if !defined(NO_OUTPUT_BUFFER_SORT_TEMPLATE_H)
+#define NO_OUTPUT_BUFFER_SORT_TEMPLATE_H
+
+#if !defined(__cplusplus)
+#error "no_output_buffer_sort_template.h requires C++"
+#endif
+
+/* Headers of the sort implementation are included here as the implementation headers include none inside the namespace */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "no_output_buffer_sort_replace.h"
+#include "no_output_heap.h"
+#include "in_memory_sort.h"
+
+namespace no_output_buffer_sort {
+
+/**
+ * Key extractor for records with an integer member named key such as test_record_t.
+ */
+template <typename Record>
+struct key_member_t {
+    typedef int32_t Key;
+    static const uint16_t offset = offsetof(Record, key);
+};
+
+/**
+ * Record layout used in place of external_sort_t. Record size, page size, header size and comparator are compile-time
+ * constants so the sort code is compiled with constant-size copies, constant offsets and an inlined comparison.
+ * Run time settings have the same names and meaning as in external_sort_t.
+ * KeyExtractor has a type Key ordered with operator< and the byte offset of the key in Record.
+ */
+template <typename Record, typename KeyExtractor, uint16_t PageSize>
+struct fixed_layout_t {
+    typedef typename KeyExtractor::Key Key;
+
+    static const uint16_t record_size   = sizeof(Record);
+    static const uint16_t key_size      = sizeof(Key);
+    static const uint16_t key_offset    = KeyExtractor::offset;
+    static const uint16_t page_size     = PageSize;
+    static const int8_t   headerSize    = BLOCK_HEADER_SIZE;
+    static const int8_t   key_prefix_compare = 0;               /* Comparator is already inlined */
+
+    uint32_t    num_pages;
+    int8_t      run_gen_algorithm;
+    int8_t      key_type;                   /* KEY_TYPE_INT32 etc. only if key is that integer at start of record */
+    int8_t      (*output_sink)(void *state, void *block);
+    void        *output_sink_state;
+    int8_t      heap_arity;
+    int8_t      presorted_fast_path;
+    int32_t     max_disorder;
+    int8_t      two_way_runs;
+    int8_t      run_descending;
+    int8_t      profile_blocks;
+    int8_t      in_memory_algorithm;
+    int16_t     merge_fan_in;
+    char        *radix_scratch;
+
+    static int8_t compare_fcn(void *a, void *b)
+    {
+        Key x, y;
+        memcpy(&x, (char*) a + key_offset, sizeof(Key));      /* Records in blocks are not aligned */
+        memcpy(&y, (char*) b + key_offset, sizeof(Key));
+        return (int8_t) ((y < x) - (x < y));
+    }
+};
+
+/**
+ * Compares records using the layout comparator. Replaces the C external_sort_compare() in the specialized sort.
+ * Order is reversed while run generation builds a descending sublist.
+ */
+template <class Layout>
+inline int8_t external_sort_compare(void *a, void *b, Layout *es)
+{
+    int8_t c = Layout::compare_fcn(a, b);
+    if (es->run_descending)
+        return (int8_t) ((c < 0) - (c > 0));
+    return c;
+}
+
+/* Sort implementation compiled as templates on the layout type. Functions that take an external_sort_t take a Layout.
+   The C sort is built once from the same implementation headers by no_output_heap.c and no_output_buffer_sort_replace.c. */
+#undef EXTERNAL_SORT_TEMPLATE
+#define EXTERNAL_SORT_TEMPLATE template <class external_sort_t>
+#include "no_output_heap_impl.h"
+#include "no_output_buffer_sort_replace_impl.h"
+#undef EXTERNAL_SORT_TEMPLATE
+#define EXTERNAL_SORT_TEMPLATE
+
+/**
+@brief      Sorts records from block iterator using no output buffer sort specialized for the layout.
+            Parameters and return value are the same as no_output_buffer_sort_replace_block().
+*/
+template <class Layout>
+int sort(
+    int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    Layout  *es,
+    long    *resultFilePtr,
+    metrics_t *metric,
+    int8_t  runGenOnly
+)
+{
+    return no_output_buffer_sort_replace_block(blockIterator, iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks,
+                                                es, resultFilePtr, metric, Layout::compare_fcn, runGenOnly);
+}
+
+}
+
+#endif
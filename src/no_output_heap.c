@@ -45,139 +45,4 @@
 
 #include "no_output_heap.h"
 
-/*
- *Starts with empty root and recursively moves tuples into their empty parent. Stops when the input tuple can be inserted into the parent instead while maintaining sorted order.
- */
-void heapify(   char* buffer,
-                void* input_tuple,
-                int32_t size,
-                external_sort_t* es,
-                metrics_t *metric
-) {
-    int32_t left, right, smallest;
-    int32_t i = 0;
-    while (1) {
-        left = 2 * i + 1;
-        right = left + 1;
-
-        if (left >= size)
-            break;
-
-        //find if left or right is smallest
-        metric->num_compar++;
-        if (right < size && es->compare_fcn(buffer + right*es->record_size, buffer + left*es->record_size) < 0)
-            smallest = right;
-        else
-            smallest = left;
-
-        //is input tuple the smallest
-        metric->num_compar++;
-        if (es->compare_fcn(input_tuple, buffer + smallest*es->record_size) < 0)
-            break;
-
-        //Perform shift
-        metric->num_memcpys ++;
-        memcpy(buffer + i*es->record_size, buffer + smallest*es->record_size, (size_t)es->record_size);
-        i = smallest;
-    }
-    //insert the tuple
-    metric->num_memcpys ++;
-    memcpy(buffer + i*es->record_size, input_tuple, (size_t)es->record_size);
-}
-/*
- * Shifts parent node of current child at idx into the child. Stops shifting parents and inserts the insert_tuple into the idx when
- * the idx points to the position where the input tuple belongs in sorted order.
- */
-void shiftUp(char* buffer,
-             void* input_tuple,
-             int32_t idx,
-             external_sort_t* es,
-             metrics_t *metric
-) {
-    int32_t parent;
-
-    while (idx > 0) {
-        parent = (idx - 1) / 2;
-
-        metric->num_compar++;
-        if (es->compare_fcn(input_tuple, buffer + parent*es->record_size) >= 0) {
-            break;
-        }
-        metric->num_memcpys++;
-        memcpy(buffer + idx*es->record_size, buffer + parent*es->record_size, (size_t)es->record_size);
-        idx = parent;
-    }
-    metric->num_memcpys++;
-    memcpy(buffer + idx*es->record_size, input_tuple, (size_t)es->record_size);
-}
-
-
-/*
- *Starts with empty root and recursively moves tuples into their empty parent. Stops when the input tuple can be inserted into the parent instead while maintaining sorted order.
- * Heap function assumes root is at end of array and works backwards
- */
-void heapify_rev(   char* buffer,
-                void* input_tuple,
-                int32_t size,
-                external_sort_t* es,
-                metrics_t *metric
-) {
-    int32_t left, right, smallest;
-    int32_t i = 0;
-    while (1) {
-        left = 2 * i + 1;
-        right = left + 1;
-
-        if (left >= size)
-            break;
-
-        //find if left or right is smallest
-        metric->num_compar++;
-        if (right < size && es->compare_fcn(buffer - right*es->record_size, buffer - left*es->record_size) < 0)
-            smallest = right;
-        else
-            smallest = left;
-
-        //is input tuple the smallest
-        metric->num_compar++;
-        if (es->compare_fcn(input_tuple, buffer - smallest*es->record_size) < 0)
-            break;
-
-        //Perform shift
-        metric->num_memcpys ++;
-        memcpy(buffer - i*es->record_size, buffer - smallest*es->record_size, (size_t)es->record_size);
-        i = smallest;
-    }
-    //insert the tuple
-    metric->num_memcpys ++;
-    memcpy(buffer - i*es->record_size, input_tuple, (size_t)es->record_size);
-}
-/*
- * Shifts parent node of current child at idx into the child. Stops shifting parents and inserts the insert_tuple into the idx when
- * the idx points to the position where the input tuple belongs in sorted order.
- * Heap function assumes root is at end of array and works backwards
- */
-void shiftUp_rev(char* buffer,
-             void* input_tuple,
-             int32_t idx,
-             external_sort_t* es,
-             metrics_t *metric
-) {
-    int32_t parent;
-
-    while (idx > 0) {
-        parent = (idx - 1) / 2;
-
-        metric->num_compar++;
-        if (es->compare_fcn(input_tuple, buffer - parent*es->record_size) >= 0) {
-            break;
-        }
-        metric->num_memcpys++;
-        memcpy(buffer - idx*es->record_size, buffer - parent*es->record_size, (size_t)es->record_size);
-        idx = parent;
-    }
-    metric->num_memcpys++;
-    memcpy(buffer - idx*es->record_size, input_tuple, (size_t)es->record_size);
-}
-
-
+#include "no_output_heap_impl.h"
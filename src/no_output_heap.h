@@ -42,6 +42,42 @@ void shiftUp_rev(char* buffer,
              metrics_t *metric
 );
 
+/* d-ary reverse heap used by run generation when es->heap_arity is set. Children of node i are arity*i+1 to arity*i+arity. */
+void heapify_rev_d(   char* buffer,
+                void* input_tuple,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+);
+
+void build_heap_rev_d(char* buffer,
+                void* tuple_buffer,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+);
+
+/* Heap of record slot indices used by RUN_GEN_REPLACEMENT_SELECTION_INDEX. Records stay in their slots. */
+void heapify_index(char* records,
+                uint16_t* heap,
+                uint16_t slot,
+                int32_t i,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+);
+
+void build_heap_index(char* records,
+                uint16_t* heap,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,338 @@
+/******************************************************************************/
+/**
+@file		no_output_heap_impl.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		Heaps of replacement selection. Compiled as C by no_output_heap.c and as templates on a record layout by
+			no_output_buffer_sort_template.h. Includes no headers, so the includer provides no_output_heap.h and the C headers.
+@copyright	Copyright 2019
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if !defined(NO_OUTPUT_HEAP_IMPL_H)
+#define NO_OUTPUT_HEAP_IMPL_H
+
+/*
+ *Starts with empty root and recursively moves tuples into their empty parent. Stops when the input tuple can be inserted into the parent instead while maintaining sorted order.
+ */
+EXTERNAL_SORT_TEMPLATE void heapify(   char* buffer,
+                void* input_tuple,
+                int32_t size,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    int32_t left, right, smallest;
+    int32_t i = 0;
+    while (1) {
+        left = 2 * i + 1;
+        right = left + 1;
+
+        if (left >= size)
+            break;
+
+        //find if left or right is smallest
+        metric->num_compar++;
+        if (right < size && external_sort_compare(buffer + right*es->record_size, buffer + left*es->record_size, es) < 0)
+            smallest = right;
+        else
+            smallest = left;
+
+        //is input tuple the smallest
+        metric->num_compar++;
+        if (external_sort_compare(input_tuple, buffer + smallest*es->record_size, es) < 0)
+            break;
+
+        //Perform shift
+        metric->num_memcpys ++;
+        memcpy(buffer + i*es->record_size, buffer + smallest*es->record_size, (size_t)es->record_size);
+        i = smallest;
+    }
+    //insert the tuple
+    metric->num_memcpys ++;
+    memcpy(buffer + i*es->record_size, input_tuple, (size_t)es->record_size);
+}
+/*
+ * Shifts parent node of current child at idx into the child. Stops shifting parents and inserts the insert_tuple into the idx when
+ * the idx points to the position where the input tuple belongs in sorted order.
+ */
+EXTERNAL_SORT_TEMPLATE void shiftUp(char* buffer,
+             void* input_tuple,
+             int32_t idx,
+             external_sort_t* es,
+             metrics_t *metric
+) {
+    int32_t parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+
+        metric->num_compar++;
+        if (external_sort_compare(input_tuple, buffer + parent*es->record_size, es) >= 0) {
+            break;
+        }
+        metric->num_memcpys++;
+        memcpy(buffer + idx*es->record_size, buffer + parent*es->record_size, (size_t)es->record_size);
+        idx = parent;
+    }
+    metric->num_memcpys++;
+    memcpy(buffer + idx*es->record_size, input_tuple, (size_t)es->record_size);
+}
+
+
+/*
+ *Starts with empty root and recursively moves tuples into their empty parent. Stops when the input tuple can be inserted into the parent instead while maintaining sorted order.
+ * Heap function assumes root is at end of array and works backwards
+ */
+EXTERNAL_SORT_TEMPLATE void heapify_rev(   char* buffer,
+                void* input_tuple,
+                int32_t size,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    int32_t left, right, smallest;
+    int32_t i = 0;
+    while (1) {
+        left = 2 * i + 1;
+        right = left + 1;
+
+        if (left >= size)
+            break;
+
+        //find if left or right is smallest
+        metric->num_compar++;
+        if (right < size && external_sort_compare(buffer - right*es->record_size, buffer - left*es->record_size, es) < 0)
+            smallest = right;
+        else
+            smallest = left;
+
+        //is input tuple the smallest
+        metric->num_compar++;
+        if (external_sort_compare(input_tuple, buffer - smallest*es->record_size, es) < 0)
+            break;
+
+        //Perform shift
+        metric->num_memcpys ++;
+        memcpy(buffer - i*es->record_size, buffer - smallest*es->record_size, (size_t)es->record_size);
+        i = smallest;
+    }
+    //insert the tuple
+    metric->num_memcpys ++;
+    memcpy(buffer - i*es->record_size, input_tuple, (size_t)es->record_size);
+}
+/*
+ * Shifts parent node of current child at idx into the child. Stops shifting parents and inserts the insert_tuple into the idx when
+ * the idx points to the position where the input tuple belongs in sorted order.
+ * Heap function assumes root is at end of array and works backwards
+ */
+EXTERNAL_SORT_TEMPLATE void shiftUp_rev(char* buffer,
+             void* input_tuple,
+             int32_t idx,
+             external_sort_t* es,
+             metrics_t *metric
+) {
+    int32_t parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+
+        metric->num_compar++;
+        if (external_sort_compare(input_tuple, buffer - parent*es->record_size, es) >= 0) {
+            break;
+        }
+        metric->num_memcpys++;
+        memcpy(buffer - idx*es->record_size, buffer - parent*es->record_size, (size_t)es->record_size);
+        idx = parent;
+    }
+    metric->num_memcpys++;
+    memcpy(buffer - idx*es->record_size, input_tuple, (size_t)es->record_size);
+}
+
+/*
+ * Moves the hole at index i of a d-ary heap down until input_tuple can be stored in it. The children of node i are at
+ * arity*i+1 to arity*i+arity so they are adjacent in memory and are compared in one pass.
+ * Heap function assumes root is at end of array and works backwards
+ */
+EXTERNAL_SORT_TEMPLATE static void sift_down_rev_d(char* buffer,
+                void* input_tuple,
+                int32_t i,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    int32_t child, last, smallest;
+    while (1) {
+        child = arity * i + 1;
+        if (child >= size)
+            break;
+
+        last = child + arity;
+        if (last > size)
+            last = size;
+
+        //find smallest child
+        smallest = child;
+        for (child++; child < last; child++) {
+            metric->num_compar++;
+            if (external_sort_compare(buffer - child*es->record_size, buffer - smallest*es->record_size, es) < 0)
+                smallest = child;
+        }
+
+        //is input tuple not larger than smallest child
+        metric->num_compar++;
+        if (external_sort_compare(input_tuple, buffer - smallest*es->record_size, es) <= 0)
+            break;
+
+        //Perform shift
+        metric->num_memcpys ++;
+        memcpy(buffer - i*es->record_size, buffer - smallest*es->record_size, (size_t)es->record_size);
+        i = smallest;
+    }
+    //insert the tuple
+    metric->num_memcpys ++;
+    memcpy(buffer - i*es->record_size, input_tuple, (size_t)es->record_size);
+}
+
+/*
+ * Same as heapify_rev() for a heap where each node has arity children.
+ */
+EXTERNAL_SORT_TEMPLATE void heapify_rev_d(   char* buffer,
+                void* input_tuple,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    sift_down_rev_d(buffer, input_tuple, 0, size, arity, es, metric);
+}
+
+/*
+ * Builds a d-ary heap bottom-up (Floyd) from the size records already in the heap array. Takes O(size) comparisons.
+ * A node not larger than its smallest child is not moved. Otherwise it is copied to tuple_buffer and sifted down.
+ * Heap function assumes root is at end of array and works backwards
+ */
+EXTERNAL_SORT_TEMPLATE void build_heap_rev_d(char* buffer,
+                void* tuple_buffer,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    int32_t i, child, last, smallest;
+
+    if (size < 2)
+        return;
+
+    for (i = (size - 2) / arity; i >= 0; i--) {
+        child = arity * i + 1;
+        last = child + arity;
+        if (last > size)
+            last = size;
+
+        smallest = child;
+        for (child++; child < last; child++) {
+            metric->num_compar++;
+            if (external_sort_compare(buffer - child*es->record_size, buffer - smallest*es->record_size, es) < 0)
+                smallest = child;
+        }
+
+        metric->num_compar++;
+        if (external_sort_compare(buffer - i*es->record_size, buffer - smallest*es->record_size, es) <= 0)
+            continue;
+
+        metric->num_memcpys += 2;
+        memcpy(tuple_buffer, buffer - i*es->record_size, (size_t)es->record_size);
+        memcpy(buffer - i*es->record_size, buffer - smallest*es->record_size, (size_t)es->record_size);
+        sift_down_rev_d(buffer, tuple_buffer, smallest, size, arity, es, metric);
+    }
+}
+
+/*
+ * Moves the hole at index i of a heap of record slot indices down until slot can be stored in it. Records are not moved.
+ * Record of slot s is at records + s*record_size. Children of node i are arity*i+1 to arity*i+arity.
+ */
+EXTERNAL_SORT_TEMPLATE void heapify_index(char* records,
+                uint16_t* heap,
+                uint16_t slot,
+                int32_t i,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    int32_t child, last, smallest;
+    char *val = records + (int32_t) slot*es->record_size;
+
+    while (1) {
+        child = arity * i + 1;
+        if (child >= size)
+            break;
+
+        last = child + arity;
+        if (last > size)
+            last = size;
+
+        //find smallest child
+        smallest = child;
+        for (child++; child < last; child++) {
+            metric->num_compar++;
+            if (external_sort_compare(records + (int32_t) heap[child]*es->record_size, records + (int32_t) heap[smallest]*es->record_size, es) < 0)
+                smallest = child;
+        }
+
+        //is slot record not larger than smallest child
+        metric->num_compar++;
+        if (external_sort_compare(val, records + (int32_t) heap[smallest]*es->record_size, es) <= 0)
+            break;
+
+        heap[i] = heap[smallest];
+        i = smallest;
+    }
+    heap[i] = slot;
+}
+
+/*
+ * Builds a heap of record slot indices bottom-up (Floyd) from the size indices already in heap.
+ */
+EXTERNAL_SORT_TEMPLATE void build_heap_index(char* records,
+                uint16_t* heap,
+                int32_t size,
+                int8_t arity,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    int32_t i;
+
+    if (size < 2)
+        return;
+
+    for (i = (size - 2) / arity; i >= 0; i--)
+        heapify_index(records, heap, heap[i], i, size, arity, es, metric);
+}
+
+#endif
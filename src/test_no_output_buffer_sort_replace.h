@@ -228,6 +228,10 @@ external_sort_write_test_data(
                 else 
                     *((int32_t*)buffer) = recordKey + 1;
             }
+            else if (testDataType == 4)
+            {   // Bounded disorder data. Records are less than percent_random positions out of place.
+                *((int32_t*)buffer) = recordKey + rand() % percent_random;
+            }
             #ifdef DATA_COMPARE 
             sampleData[i] = (int32_t) *((int32_t*)buffer);
             #endif
@@ -270,6 +274,10 @@ external_sort_write_test_data(
             else 
                 *((int32_t*)buffer) = recordKey + 1;
         }
+        else if (testDataType == 4)
+        {   // Bounded disorder data
+            *((int32_t*)buffer) = recordKey + rand() % percent_random;
+        }
         #ifdef DATA_COMPARE 
         sampleData[i] = (int32_t) *((int32_t*)buffer);
         #endif
@@ -304,18 +312,365 @@ int fileRecordIterator(void* state, void* buffer)
     if (fileState->recordsRead >= fileState->totalRecords)
         return 0;
 
-    /* Read next record */
-    /* TODO: Improve by reading a block at a time */
+    /* Read next record. Use fileBlockIterator to read a block at a time. */
     fread(buffer, fileState->recordSize, 1, fileState->file);
     fileState->recordsRead++;
     return 1;
 }
 
-void runalltests_no_output_buffer_sort_block()
+/**
+ * Iterates through records in a file reading up to maxRecords with one read. Returns number of records read (0 when no more records).
+ */
+int32_t fileBlockIterator(void* state, void* buffer, int32_t maxRecords)
+{
+    file_iterator_state_t* fileState = (file_iterator_state_t*) state;
+    uint32_t recordsLeft = fileState->totalRecords - fileState->recordsRead;
+
+    if (fileState->recordsRead >= fileState->totalRecords)
+        return 0;
+
+    if ((uint32_t) maxRecords > recordsLeft)
+        maxRecords = (int32_t) recordsLeft;
+
+    maxRecords = (int32_t) fread(buffer, fileState->recordSize, (size_t) maxRecords, fileState->file);
+    fileState->recordsRead += maxRecords;
+    return maxRecords;
+}
+
+/**
+ * Iterates through records in memory copying up to maxRecords with one copy. Returns number of records copied (0 when no more records).
+ * Records of a mapped file are copied from the page cache without a read into a stdio buffer.
+ */
+int32_t mappedBlockIterator(void* state, void* buffer, int32_t maxRecords)
+{
+    mapped_iterator_state_t* mapState = (mapped_iterator_state_t*) state;
+    uint32_t recordsLeft = mapState->totalRecords - mapState->recordsRead;
+
+    if (mapState->recordsRead >= mapState->totalRecords)
+        return 0;
+
+    if ((uint32_t) maxRecords > recordsLeft)
+        maxRecords = (int32_t) recordsLeft;
+
+    memcpy(buffer, mapState->records + (size_t) mapState->recordsRead * mapState->recordSize, (size_t) maxRecords * mapState->recordSize);
+    mapState->recordsRead += maxRecords;
+    return maxRecords;
+}
+
+
+/* Counts a failed check of a test in failures and prints the check */
+#define TEST_ASSERT(failures, condition) \
+    do { if (!(condition)) { printf("FAILED %s line %d: %s\n", __func__, __LINE__, #condition); (failures)++; } } while (0)
+
+/**
+ * Sets sort state for num_test_values records of record_size bytes with an int32 key at offset 0 in blocks of page_size bytes.
+ * Sorts with replacement selection and every optional feature off.
+ */
+void init_external_sort(external_sort_t *es, int16_t record_size, int16_t page_size, int32_t num_test_values)
+{
+    memset(es, 0, sizeof(external_sort_t));
+    es->key_size = sizeof(int32_t);
+    es->value_size = record_size - es->key_size;
+    es->headerSize = BLOCK_HEADER_SIZE;
+    es->record_size = record_size;
+    es->page_size = page_size;
+    es->compare_fcn = merge_sort_int32_comparator;
+    es->run_gen_algorithm = RUN_GEN_REPLACEMENT_SELECTION;
+    es->key_type = KEY_TYPE_INT32;
+
+    int32_t values_per_page = (es->page_size - es->headerSize) / es->record_size;
+    es->num_pages = (uint32_t) (num_test_values + values_per_page - 1) / values_per_page;
+}
+
+/**
+ * Writes num_test_values records of testDataType (see external_sort_write_test_data()) to fp and sets iteratorState to read them
+ * from the start. Returns 0 if the records were written.
+ */
+int init_test_input(
+        ION_FILE *fp,
+        file_iterator_state_t *iteratorState,
+        int32_t num_test_values,
+        external_sort_t *es,
+        int testDataType,
+        int percent_random,
+        int numDistinct)
+{
+    if (NULL == fp || 0 != external_sort_write_test_data(fp, num_test_values, es->record_size, testDataType, es, percent_random, numDistinct))
+        return 9;
+    fflush(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    iteratorState->file = fp;
+    iteratorState->recordsRead = 0;
+    iteratorState->totalRecords = num_test_values;
+    iteratorState->recordSize = es->record_size;
+    return 0;
+}
+
+/* State of output sink that verifies sorted output */
+typedef struct {
+    external_sort_t *es;
+    int32_t numRecords;
+    int32_t lastKey;
+    int8_t  sorted;
+} verify_sink_state_t;
+
+/**
+ * Output sink that checks records are in order and counts them.
+ */
+int8_t verifySortedSink(void *state, void *block)
+{
+    verify_sink_state_t *sinkState = (verify_sink_state_t*) state;
+    int16_t count = *((int16_t*) ((char*) block + BLOCK_COUNT_OFFSET));
+
+    for (int16_t i = 0; i < count; i++)
+    {
+        test_record_t *rec = (test_record_t*) ((char*) block + sinkState->es->headerSize + i*sinkState->es->record_size);
+        if (sinkState->numRecords > 0 && rec->key < sinkState->lastKey)
+            sinkState->sorted = 0;
+        sinkState->lastKey = rec->key;
+        sinkState->numRecords++;
+    }
+    return 0;
+}
+
+/**
+ * Starts checking records of es with verifySortedSink().
+ */
+void init_verify_sink(verify_sink_state_t *sinkState, external_sort_t *es)
+{
+    sinkState->es = es;
+    sinkState->numRecords = 0;
+    sinkState->lastKey = 0;
+    sinkState->sorted = 1;
+}
+
+/**
+ * Reads the es->num_pages blocks of sorted output at resultFilePtr of outFile into buffer and checks them with verifySortedSink().
+ * Output of a mapped file is checked in place. Returns 1 if output was checked in place.
+ */
+int8_t verify_sorted_file(ION_FILE *outFile, long resultFilePtr, external_sort_t *es, char *buffer, verify_sink_state_t *sinkState)
+{
+    fflush(outFile);
+    #if defined(ION_HOST_FILE)
+    char *sorted = (char*) host_fmap(outFile, resultFilePtr, (long) es->num_pages * es->page_size);
+    if (NULL != sorted)
+    {
+        for (uint32_t i = 0; i < es->num_pages; i++)
+            verifySortedSink(sinkState, sorted + (size_t) i * es->page_size);
+        return 1;
+    }
+    #endif
+    for (uint32_t i = 0; i < es->num_pages; i++)
+    {
+        if (0 == fread_at(buffer, es->page_size, 1, outFile, resultFilePtr + (long) i*es->page_size))
+        {
+            sinkState->sorted = 0;
+            return 0;
+        }
+        verifySortedSink(sinkState, buffer);
+    }
+    return 0;
+}
+
+/**
+ * Counts records in the sublist blocks that run generation wrote from the start of outFile. Sets *sorted to 0 if records of a block
+ * are out of order.
+ */
+int32_t count_sublist_records(ION_FILE *outFile, external_sort_t *es, char *buffer, int8_t *sorted)
+{
+    int32_t numvals = 0;
+    verify_sink_state_t blockState;
+
+    fflush(outFile);
+    for (long offset = 0; 0 != fread_at(buffer, es->page_size, 1, outFile, offset); offset += es->page_size)
+    {
+        init_verify_sink(&blockState, es);
+        verifySortedSink(&blockState, buffer);
+        numvals += blockState.numRecords;
+        if (!blockState.sorted)
+            *sorted = 0;
+    }
+    return numvals;
+}
+
+/* One sort of a test run by run_sort_test(). Fields left 0 or NULL are defaults. */
+typedef struct {
+    int32_t     numRecords;
+    int         bufferPages;
+    int         testDataType;               /* Input data as for external_sort_write_test_data() */
+    int         percentRandom;
+    int         numDistinct;
+    unsigned int seed;                      /* Random seed of input data */
+    const char  *inputName;
+    const char  *outputName;
+    int8_t      useSink;                    /* 1 to check sorted output in verifySortedSink() instead of reading it back from the output file */
+    int8_t      recordIterator;             /* 1 to read input a record at a time with no_output_buffer_sort_replace() */
+    int8_t      runGenOnly;                 /* 1 to only generate sublists and check the records in them */
+    int         (*sort)(int32_t (*)(void*, void*, int32_t), void*, void*, ION_FILE*, char*, int, external_sort_t*, long*, metrics_t*, int8_t);
+                                            /* Block sort to run. NULL for no_output_buffer_sort_replace_block(). */
+    #if defined(ION_HOST_FILE)
+    int16_t     writeBehindPages;           /* Write-behind queue pages of output file */
+    const host_file_backend_t *inputBackend;    /* Backend of input file. NULL for default. */
+    const host_file_backend_t *outputBackend;   /* Backend of output file. NULL for default. */
+    int8_t      mapInput;                   /* 1 to copy input from a mapping of the input file with mappedBlockIterator() */
+    void        (*beforeSort)(void);        /* Called after input is written and before the sort. NULL for none. */
+    void        (*afterSort)(void);         /* Called after the sort and before output is checked. NULL for none. */
+    #endif
+} sort_test_t;
+
+/* Results of run_sort_test() */
+typedef struct {
+    int         err;                        /* Error of the sort */
+    metrics_t   metric;
+    unsigned long duration;                 /* Sort time in ms */
+    int32_t     numRecords;                 /* Records in sorted output (or sublists if only generating runs) */
+    int8_t      sorted;
+    int8_t      ok;                         /* 1 if no error and every record is output in order */
+    int8_t      stateChanged;               /* 1 if the sort changed es */
+    int8_t      mappedOutput;               /* 1 if sorted output was checked in place in a mapping */
+} sort_test_result_t;
+
+/**
+ * Sets test to sort numRecords records of testDataType (see external_sort_write_test_data()) with a buffer of bufferPages pages.
+ * Input is written to inputName with seed 2020 and output to outputName. Other settings are off.
+ */
+void init_sort_test(
+        sort_test_t *test,
+        int32_t numRecords,
+        int bufferPages,
+        int testDataType,
+        int percentRandom,
+        int numDistinct,
+        const char *inputName,
+        const char *outputName)
+{
+    memset(test, 0, sizeof(sort_test_t));
+    test->numRecords = numRecords;
+    test->bufferPages = bufferPages;
+    test->testDataType = testDataType;
+    test->percentRandom = percentRandom;
+    test->numDistinct = numDistinct;
+    test->seed = 2020;
+    test->inputName = inputName;
+    test->outputName = outputName;
+}
+
+/**
+ * Writes the input of test, sorts it with es, and checks the sorted output in result. test->numRecords must match es->num_pages.
+ * Returns 0 if the sort ran. Sort errors are in result->err.
+ */
+int run_sort_test(external_sort_t *es, const sort_test_t *test, sort_test_result_t *result)
+{
+    verify_sink_state_t sinkState;
+    file_iterator_state_t iteratorState;
+    long resultFilePtr;
+    external_sort_t callerState;
+
+    char *buffer = (char*) malloc((size_t) test->bufferPages * es->page_size + es->record_size);
+    if (NULL == buffer) {
+        printf("Error: Out of memory!\n");
+        return 8;
+    }
+    char *tupleBuffer = buffer + (size_t) test->bufferPages * es->page_size;
+
+    srand(test->seed);
+    #if defined(ION_HOST_FILE)
+    ION_FILE *fp = NULL != test->inputBackend ? host_fopen_backend(test->inputName, "w+b", test->inputBackend) : fopen(test->inputName, "w+b");
+    ION_FILE *outFilePtr = NULL != test->outputBackend ? host_fopen_backend(test->outputName, "w+b", test->outputBackend) : fopen(test->outputName, "w+b");
+    #else
+    ION_FILE *fp = fopen(test->inputName, "w+b");
+    ION_FILE *outFilePtr = fopen(test->outputName, "w+b");
+    #endif
+    int openErr = NULL == outFilePtr || 0 != init_test_input(fp, &iteratorState, test->numRecords, es, test->testDataType, test->percentRandom, test->numDistinct);
+    #if defined(ION_HOST_FILE)
+    if (!openErr && 0 != host_set_write_behind(outFilePtr, test->writeBehindPages, es->page_size))
+        openErr = 1;
+    #endif
+    if (openErr) {
+        printf("Error: Can't open file!\n");
+        if (NULL != fp)
+            fclose(fp);
+        if (NULL != outFilePtr)
+            fclose(outFilePtr);
+        free(buffer);
+        return 10;
+    }
+
+    int32_t (*blockIterator)(void*, void*, int32_t) = &fileBlockIterator;
+    void    *iteratorStatePtr = &iteratorState;
+    #if defined(ION_HOST_FILE)
+    mapped_iterator_state_t mapState;
+    if (test->mapInput)
+    {
+        mapState.records = (const char*) host_fmap(fp, 0, (long) test->numRecords * es->record_size);
+        mapState.recordsRead = 0;
+        mapState.totalRecords = test->numRecords;
+        mapState.recordSize = es->record_size;
+        if (NULL == mapState.records) {
+            printf("Error: Can't map file!\n");
+            fclose(fp);
+            fclose(outFilePtr);
+            free(buffer);
+            return 10;
+        }
+        blockIterator = &mappedBlockIterator;
+        iteratorStatePtr = &mapState;
+    }
+    fadvise(fp, 0, 0, ION_FILE_ADVICE_SEQUENTIAL);
+    #endif
+
+    init_verify_sink(&sinkState, es);
+    es->output_sink = test->useSink ? verifySortedSink : NULL;
+    es->output_sink_state = test->useSink ? &sinkState : NULL;
+    memset(&result->metric, 0, sizeof(metrics_t));
+    callerState = *es;
+    #if defined(ION_HOST_FILE)
+    if (NULL != test->beforeSort)
+        test->beforeSort();
+    #endif
+
+    unsigned long start = millis();
+    if (test->recordIterator)
+        result->err = no_output_buffer_sort_replace(&fileRecordIterator, &iteratorState, tupleBuffer, outFilePtr, buffer, test->bufferPages, es, &resultFilePtr, &result->metric, merge_sort_int32_comparator, test->runGenOnly);
+    else if (NULL != test->sort)
+        result->err = test->sort(blockIterator, iteratorStatePtr, tupleBuffer, outFilePtr, buffer, test->bufferPages, es, &resultFilePtr, &result->metric, test->runGenOnly);
+    else
+        result->err = no_output_buffer_sort_replace_block(blockIterator, iteratorStatePtr, tupleBuffer, outFilePtr, buffer, test->bufferPages, es, &resultFilePtr, &result->metric, merge_sort_int32_comparator, test->runGenOnly);
+    result->duration = millis() - start;
+    #if defined(ION_HOST_FILE)
+    if (NULL != test->afterSort)
+        test->afterSort();
+    #endif
+    result->stateChanged = 0 != memcmp(&callerState, es, sizeof(external_sort_t));
+
+    result->mappedOutput = 0;
+    if (0 == result->err && test->runGenOnly)
+        sinkState.numRecords = count_sublist_records(outFilePtr, es, buffer, &sinkState.sorted);
+    else if (0 == result->err && !test->useSink)
+        result->mappedOutput = verify_sorted_file(outFilePtr, resultFilePtr, es, buffer, &sinkState);
+    result->numRecords = sinkState.numRecords;
+    result->sorted = sinkState.sorted;
+    result->ok = 0 == result->err && sinkState.sorted && sinkState.numRecords == test->numRecords;
+
+    es->output_sink = NULL;
+    es->output_sink_state = NULL;
+    fclose(fp);
+    fclose(outFilePtr);
+    free(buffer);
+    return 0;
+}
+
+/**
+ * Sorts random records with a buffer of 2 pages and prints metrics of each run and their averages.
+ * Returns number of failed checks.
+ */
+int runalltests_no_output_buffer_sort_block()
 {
     int8_t          numRuns = 2;
     metrics_t       metric[numRuns];
     external_sort_t es;
+    int             failures = 0;
 
     /* Set random seed */
     seed = time(0);  
@@ -337,19 +692,7 @@ void runalltests_no_output_buffer_sort_block()
                 printf("--- Run Number %d ---\n", (r+1));
                 int buffer_max_pages = mem;
                     
-                metric[r].num_reads = 0;
-                metric[r].num_writes = 0;
-                metric[r].num_compar = 0;
-                metric[r].num_memcpys = 0;
-                metric[r].num_runs = 0;
-
-                es.key_size = sizeof(int32_t); 
-                es.value_size = 12;
-                es.headerSize = BLOCK_HEADER_SIZE ;
-                es.record_size = es.key_size + es.value_size;
-                es.page_size = 512;
-
-                int32_t values_per_page = (es.page_size - es.headerSize) / es.record_size;
+                int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
                 int32_t num_test_values = values_per_page;
 												   
                 int k;
@@ -360,8 +703,8 @@ void runalltests_no_output_buffer_sort_block()
                 // num_test_values = values_per_page * 125;
                 /* Add variable number of records so pages not completely full (optional) */
                 // num_test_values += rand() % 10;
-                es.num_pages = (uint32_t) (num_test_values + values_per_page - 1) / values_per_page; 
-                es.compare_fcn = merge_sort_int32_comparator;
+                init_external_sort(&es, sizeof(test_record_t), 512, num_test_values);
+                memset(&metric[r], 0, sizeof(metrics_t));
 
                 /* Buffers and file offsets used by sorting algorithim*/
                 long result_file_ptr;
@@ -369,7 +712,7 @@ void runalltests_no_output_buffer_sort_block()
                 char *tuple_buffer = buffer + es.page_size * buffer_max_pages;
                 if (NULL == buffer) {
                     printf("Error: Out of memory!\n");
-                    return;
+                    return failures+1;
                 }
 
                 /* Create the file and fill it with test data */
@@ -377,22 +720,15 @@ void runalltests_no_output_buffer_sort_block()
                 fp = fopen("myfile7.bin", "w+b");
                 if (NULL == fp) {
                     printf("Error: Can't open file!\n");
-                    return;
+                    free(buffer);
+                    return failures+1;
                 }
 
                 // external_sort_write_int32_sequential_data(fp, num_test_values, es.record_size, 1);
                 // external_sort_write_int32_random_data(fp, num_test_values, es.record_size);
                 // external_sort_write_int32_sorted_updated_data(fp, num_test_values, es.record_size, 10);
-                external_sort_write_test_data(fp, num_test_values, es.record_size, 2, &es, 0, 64);
-
-                fflush(fp);
-                fseek(fp, 0, SEEK_SET);
-
                 file_iterator_state_t iteratorState;
-                iteratorState.file = fp;
-                iteratorState.recordsRead = 0;
-                iteratorState.totalRecords = num_test_values;
-                iteratorState.recordSize = es.record_size;
+                init_test_input(fp, &iteratorState, num_test_values, &es, 2, 0, 64);
 
                 /* Open output file */
                 ION_FILE *outFilePtr;
@@ -402,6 +738,9 @@ void runalltests_no_output_buffer_sort_block()
                 if (NULL == outFilePtr)
                 {
                     printf("Error: Can't open output file!\n");			
+                    fclose(fp);
+                    free(buffer);
+                    return failures+1;
                 }
 
                 /* Run and time the algorithim */
@@ -414,7 +753,7 @@ void runalltests_no_output_buffer_sort_block()
                 #endif                    
 
                 int8_t runGenOnly = 0;        
-                int err = no_output_buffer_sort_replace(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], merge_sort_int32_comparator, runGenOnly);
+                int err = no_output_buffer_sort_replace_block(&fileBlockIterator, &iteratorState, tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], merge_sort_int32_comparator, runGenOnly);
 
                 if (8 == err) {
                     printf("Out of memory!\n");
@@ -440,11 +779,15 @@ void runalltests_no_output_buffer_sort_block()
                 /* Verify the data is sorted*/
                 int sorted = 1;    
                 fflush(outFilePtr);   
+                fclose(fp);
                 fclose(outFilePtr);
-                outFilePtr = fopen("tmpsort.bin", "r+b");
+                outFilePtr = fopen("tmpsort7.bin", "r+b");
                 fp = outFilePtr;
-                char *rec_last = (char*) malloc(es.record_size);
-                memcpy(rec_last, buffer + es.headerSize, es.record_size);
+                if (NULL == fp) {
+                    printf("Error: Can't open output file!\n");
+                    free(buffer);
+                    return failures+1;
+                }
 
                 printf("Starting file offset: %lu\n", result_file_ptr);
                 fseek(fp, result_file_ptr, SEEK_SET);
@@ -515,6 +858,7 @@ void runalltests_no_output_buffer_sort_block()
                 if (0 != fclose(fp)) {
                     printf("Error file not closed!");
                 }
+                TEST_ASSERT(failures, 0 == err && sorted);
                 if (sorted)
                     printf("SUCCESS");
                 else
@@ -595,4 +939,1040 @@ void runalltests_no_output_buffer_sort_block()
              printf("%li\t%li\t%li\t%li\t%li\t%li\t%li\n",vals[0], vals[1], vals[2], vals[3], vals[4], vals[5], vals[6]);
         }
     }
+    return failures;
+}
+
+/**
+ * Compares run generation using replacement selection, merging, and index replacement selection with a buffer of 2 blocks.
+ * Only runs generation phase. Verifies all records are in the sublists written and sorted input is one sublist.
+ * Merging writes sublists of at least 2 blocks. Data sets: sorted, reverse sorted, 10% random, random
+ * Returns number of failed checks.
+ */
+int runalltests_run_generation_merge()
+{
+    int8_t          dataType[] = {0, 1, 3, 2};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 512, 2, 0, 10, 64, "myfile7.bin", "tmpsort7.bin");
+    test.recordIterator = 1;
+    test.runGenOnly = 1;
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+    es.key_type = KEY_TYPE_OTHER;
+
+    printf("Data\tAlg\tGenTime\tRuns\tReads\tWrites\tCompares\tCopies\tOK\n");
+    for (int t = 0; t < 4; t++)
+    {
+        for (int8_t algorithm = RUN_GEN_REPLACEMENT_SELECTION; algorithm <= RUN_GEN_REPLACEMENT_SELECTION_INDEX; algorithm++)
+        {
+            es.run_gen_algorithm = algorithm;
+            test.testDataType = dataType[t];
+            test.seed = 2020+t;             /* Same data for all algorithms */
+            if (0 != run_sort_test(&es, &test, &result))
+                return failures+1;
+
+            printf("%d\t%d\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%d\n", dataType[t], algorithm, (unsigned long) result.metric.genTime,
+                (unsigned long) result.metric.num_runs, (unsigned long) result.metric.num_reads, (unsigned long) result.metric.num_writes,
+                (unsigned long) result.metric.num_compar, (unsigned long) result.metric.num_memcpys, result.ok);
+            TEST_ASSERT(failures, result.ok);
+            if (0 == dataType[t] && RUN_GEN_MERGE != algorithm)
+                TEST_ASSERT(failures, 1 == result.metric.num_runs);
+            if (RUN_GEN_MERGE == algorithm)
+                TEST_ASSERT(failures, result.metric.num_runs <= (es.num_pages + 1) / 2);
+        }
+    }
+    return failures;
+}
+
+/**
+ * Times sorting blocks of random records using each in memory sort algorithm. Page sizes are 512 and 4096 bytes.
+ * Keys are random with 64 distinct values or random over EXTERNAL_SORT_MAX_RAND. Radix sort distributes records into a scratch block.
+ * Verifies every block is sorted and keeps its keys.
+ * Returns number of failed checks.
+ */
+int runalltests_in_memory_sort_block()
+{
+    int             pageSizes[] = {512, 4096};
+    int             algorithms[] = {IN_MEMORY_SORT_QUICK, IN_MEMORY_SORT_INTRO, IN_MEMORY_SORT_RADIX_INT32};
+    int32_t         numDistinct[] = {64, EXTERNAL_SORT_MAX_RAND};
+    int32_t         numBlocks = 1000;
+    int16_t         record_size = sizeof(test_record_t);
+    int             failures = 0;
+
+    printf("PageSize\tDistinct\tAlg\tTime\tSorted\n");
+    for (int p = 0; p < 2; p++)
+    {
+        int16_t values_per_page = (pageSizes[p] - BLOCK_HEADER_SIZE) / record_size;
+        char *block = (char*) malloc((size_t) values_per_page * record_size * 2);
+        if (NULL == block) {
+            printf("Error: Out of memory!\n");
+            return failures+1;
+        }
+        char *scratch = block + (size_t) values_per_page * record_size;
+
+        for (int d = 0; d < 2; d++)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                int sorted = 1;
+                srand(2020);
+
+                #if defined(ARDUINO)
+                unsigned long elapsed = 0, start;
+                #else
+                clock_t elapsed = 0, start;
+                #endif
+                for (int32_t b = 0; b < numBlocks; b++)
+                {
+                    int32_t keySum = 0;
+                    for (int16_t i = 0; i < values_per_page; i++)
+                    {
+                        test_record_t *rec = (test_record_t*) (block + i*record_size);
+                        rec->key = rand() % numDistinct[d];
+                        keySum += rec->key;
+                    }
+
+                    #if defined(ARDUINO)
+                    start = millis();
+                    in_memory_sort_scratch(block, (uint32_t) values_per_page, record_size, merge_sort_int32_comparator, algorithms[a], scratch);
+                    elapsed += millis() - start;
+                    #else
+                    start = clock();
+                    in_memory_sort_scratch(block, (uint32_t) values_per_page, record_size, merge_sort_int32_comparator, algorithms[a], scratch);
+                    elapsed += clock() - start;
+                    #endif
+
+                    for (int16_t i = 0; i < values_per_page; i++)
+                    {
+                        keySum -= ((test_record_t*) (block + i*record_size))->key;
+                        if (i > 0 && ((test_record_t*) (block + (i-1)*record_size))->key > ((test_record_t*) (block + i*record_size))->key)
+                            sorted = 0;
+                    }
+                    if (0 != keySum)
+                        sorted = 0;
+                }
+
+                #if defined(ARDUINO)
+                printf("%d\t%li\t%d\t%lu ms\t%d\n", pageSizes[p], (long) numDistinct[d], algorithms[a], elapsed, sorted);
+                #else
+                printf("%d\t%li\t%d\t%0.6f s\t%d\n", pageSizes[p], (long) numDistinct[d], algorithms[a], ((double) elapsed) / CLOCKS_PER_SEC, sorted);
+                #endif
+                TEST_ASSERT(failures, sorted);
+            }
+        }
+        free(block);
+    }
+    return failures;
+}
+
+/**
+ * Compares I/Os of writing final merge pass to file and reading it back against sending it to an output sink.
+ * The output sink saves writing and reading back the sorted output.
+ * Returns number of failed checks.
+ */
+int runalltests_output_sink()
+{
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    uint32_t        fileReads = 0, fileWrites = 0;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 1024, 4, 2, 0, 64, "myfile7.bin", "tmpsort7.bin");
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("Sink\tReads\tWrites\tSorted\n");
+    for (int useSink = 0; useSink <= 1; useSink++)
+    {
+        test.useSink = useSink;
+        if (0 != run_sort_test(&es, &test, &result))
+            return failures+1;
+
+        if (!useSink)
+        {   /* Caller reads sorted output from file */
+            result.metric.num_reads += es.num_pages;
+            fileReads = result.metric.num_reads;
+            fileWrites = result.metric.num_writes;
+        }
+
+        printf("%d\t%lu\t%lu\t%d\n", useSink, (unsigned long) result.metric.num_reads, (unsigned long) result.metric.num_writes, result.ok);
+        TEST_ASSERT(failures, result.ok);
+        if (useSink)
+        {
+            TEST_ASSERT(failures, result.metric.num_writes + es.num_pages == fileWrites);
+            TEST_ASSERT(failures, result.metric.num_reads + es.num_pages == fileReads);
+        }
+    }
+    return failures;
+}
+
+#if defined(ION_HOST_FILE)
+/**
+ * Compares time merge waits for reads with and without read-ahead prefetching of the next block of the sublist forecast to run out first.
+ * Memory sizes are 4, 8, and 16 pages. Prefetching does not change the reads of the sort.
+ * Returns number of failed checks.
+ */
+int runalltests_prefetch()
+{
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             memSizes[] = {4, 8, 16};
+    uint32_t        reads = 0;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 4096, 0, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile8.bin", "tmpsort8.bin");
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("Mem\tPrefetch\tTime\tStall(us)\tReads\tSorted\n");
+    for (int m = 0; m < 3; m++)
+    {
+        test.bufferPages = memSizes[m];
+        for (int prefetch = 0; prefetch <= 1; prefetch++)
+        {
+            host_set_prefetch(prefetch);
+            int err = run_sort_test(&es, &test, &result);
+            host_set_prefetch(1);
+            if (0 != err)
+                return failures+1;
+
+            printf("%d\t%d\t%lu\t%lu\t%lu\t%d\n", test.bufferPages, prefetch, result.duration, (unsigned long) result.metric.stallTime,
+                (unsigned long) result.metric.num_reads, result.ok);
+            TEST_ASSERT(failures, result.ok);
+            if (prefetch)
+                TEST_ASSERT(failures, result.metric.num_reads == reads);
+            reads = result.metric.num_reads;
+        }
+    }
+    return failures;
+}
+#endif
+
+#if defined(ION_HOST_FILE)
+/**
+ * Compares sort time with output writes done directly and queued in 1, 2, and 4 write-behind pages of the output file.
+ * Queueing does not change the writes of the sort.
+ * Returns number of failed checks.
+ */
+int runalltests_write_behind()
+{
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int16_t         queuePages[] = {0, 1, 2, 4};
+    uint32_t        writes = 0;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 4096, 8, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile9.bin", "tmpsort9.bin");
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("QueuePages\tGenTime\tTime\tWrites\tSorted\n");
+    for (int q = 0; q < 4; q++)
+    {
+        test.writeBehindPages = queuePages[q];
+        if (0 != run_sort_test(&es, &test, &result))
+            return failures+1;
+
+        printf("%d\t%lu\t%lu\t%lu\t%d\n", queuePages[q], (unsigned long) result.metric.genTime, result.duration,
+            (unsigned long) result.metric.num_writes, result.ok);
+        TEST_ASSERT(failures, result.ok);
+        if (q > 0)
+            TEST_ASSERT(failures, result.metric.num_writes == writes);
+        writes = result.metric.num_writes;
+    }
+    return failures;
+}
+#endif
+
+/**
+ * Compares comparisons and copies of replacement selection run generation using binary heap built by insertion (arity 0)
+ * and 2, 4, and 8-ary heaps built bottom-up. Index replacement selection uses the same heap arities on slot indices.
+ * Record sizes are 16 and 64 bytes. A 4-ary heap copies fewer records than the binary heap built by insertion.
+ * Returns number of failed checks.
+ */
+int runalltests_heap_arity()
+{
+    int8_t          arity[] = {0, 2, 4, 8};
+    int16_t         recordSizes[] = {16, 64};
+    int8_t          dataType[] = {0, 2};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    uint32_t        binaryCopies = 0;
+    int             failures = 0;
+
+    printf("Record\tData\tAlg\tArity\tGenTime\tRuns\tCompares\tCopies\tOK\n");
+    for (int r = 0; r < 2; r++)
+    {
+        int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / recordSizes[r];
+        init_sort_test(&test, values_per_page * 1024, 16, 0, 10, EXTERNAL_SORT_MAX_RAND, "myfile11.bin", "tmpsort11.bin");
+        test.recordIterator = 1;
+        test.runGenOnly = 1;
+
+        for (int t = 0; t < 2; t++)
+        {
+            for (int a = 0; a < 8; a++)
+            {
+                init_external_sort(&es, recordSizes[r], 512, test.numRecords);
+                es.run_gen_algorithm = a < 4 ? RUN_GEN_REPLACEMENT_SELECTION : RUN_GEN_REPLACEMENT_SELECTION_INDEX;
+                es.heap_arity = arity[a % 4];
+                test.testDataType = dataType[t];
+                test.seed = 2020+t;         /* Same data for all heaps */
+                if (0 != run_sort_test(&es, &test, &result))
+                    return failures+1;
+
+                printf("%d\t%d\t%d\t%d\t%lu\t%lu\t%lu\t%lu\t%d\n", es.record_size, dataType[t], es.run_gen_algorithm, es.heap_arity,
+                    (unsigned long) result.metric.genTime, (unsigned long) result.metric.num_runs, (unsigned long) result.metric.num_compar,
+                    (unsigned long) result.metric.num_memcpys, result.ok);
+                TEST_ASSERT(failures, result.ok);
+                if (0 == dataType[t])
+                    TEST_ASSERT(failures, 1 == result.metric.num_runs);
+                if (0 == a)
+                    binaryCopies = result.metric.num_memcpys;
+                else if (2 == a && 2 == dataType[t])
+                    TEST_ASSERT(failures, result.metric.num_memcpys < binaryCopies);
+            }
+        }
+    }
+    return failures;
+}
+
+/* Calls of countingComparator() */
+uint32_t comparatorCalls;
+
+/**
+ * Compares records as merge_sort_int32_comparator() and counts calls in comparatorCalls.
+ */
+int8_t countingComparator(void *a, void *b)
+{
+    comparatorCalls++;
+    return merge_sort_int32_comparator(a, b);
+}
+
+/**
+ * Compares sort time calling the comparator for every comparison against comparing int32 key prefixes and only calling
+ * the comparator on ties. Keys are random with 64 distinct values or random over EXTERNAL_SORT_MAX_RAND.
+ * Prefixes make the same comparisons with fewer comparator calls.
+ * Returns number of failed checks.
+ */
+int runalltests_key_prefix()
+{
+    int32_t         numDistinct[] = {64, EXTERNAL_SORT_MAX_RAND};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    uint32_t        calls = 0, compares = 0;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 2048, 8, 2, 0, 0, "myfile13.bin", "tmpsort13.bin");
+    test.useSink = 1;
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+    es.compare_fcn = countingComparator;
+
+    printf("Distinct\tPrefix\tTime\tCompares\tCalls\tSorted\n");
+    for (int d = 0; d < 2; d++)
+    {
+        for (int8_t prefix = 0; prefix <= 1; prefix++)
+        {
+            es.key_prefix_compare = prefix;
+            test.numDistinct = numDistinct[d];
+            test.seed = 2020+d;
+            comparatorCalls = 0;
+            if (0 != run_sort_test(&es, &test, &result))
+                return failures+1;
+
+            printf("%ld\t%d\t%lu\t%lu\t%lu\t%d\n", (long) numDistinct[d], prefix, result.duration, (unsigned long) result.metric.num_compar,
+                (unsigned long) comparatorCalls, result.ok);
+            TEST_ASSERT(failures, result.ok);
+            if (prefix)
+            {
+                TEST_ASSERT(failures, result.metric.num_compar == compares);
+                TEST_ASSERT(failures, comparatorCalls < calls);
+            }
+            calls = comparatorCalls;
+            compares = result.metric.num_compar;
+        }
+    }
+    return failures;
+}
+
+/**
+ * Compares sorting with and without the presorted fast path of run generation.
+ * Sorted input is one sublist and the fast path copies fewer records for it. Data sets: sorted, 1% random, random
+ * Returns number of failed checks.
+ */
+int runalltests_presorted()
+{
+    int8_t          dataType[] = {0, 3, 2};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    uint32_t        copies = 0;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 2048, 8, 0, 1, EXTERNAL_SORT_MAX_RAND, "myfile15.bin", "tmpsort15.bin");
+    test.useSink = 1;
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("Data\tFast\tTime\tGenTime\tRuns\tCompares\tCopies\tSorted\n");
+    for (int t = 0; t < 3; t++)
+    {
+        for (int8_t fast = 0; fast <= 1; fast++)
+        {
+            es.presorted_fast_path = fast;
+            test.testDataType = dataType[t];
+            test.seed = 2020+t;
+            if (0 != run_sort_test(&es, &test, &result))
+                return failures+1;
+
+            printf("%d\t%d\t%lu\t%lu\t%lu\t%lu\t%lu\t%d\n", dataType[t], fast, result.duration, (unsigned long) result.metric.genTime,
+                (unsigned long) result.metric.num_runs, (unsigned long) result.metric.num_compar, (unsigned long) result.metric.num_memcpys,
+                result.ok);
+            TEST_ASSERT(failures, result.ok);
+            if (0 == dataType[t])
+            {
+                TEST_ASSERT(failures, 1 == result.metric.num_runs);
+                if (fast)
+                    TEST_ASSERT(failures, result.metric.num_memcpys < copies);
+            }
+            copies = result.metric.num_memcpys;
+        }
+    }
+    return failures;
+}
+
+/**
+ * Sorts data with records less than 100 positions out of place using the full heap, a disorder bound of 100, an estimated
+ * bound, and a bound of 20 that the input exceeds. A bound that holds gives one sublist and no merge. A bound that the input
+ * exceeds is reported in disorder_violations.
+ * Returns number of failed checks.
+ */
+int runalltests_bounded_disorder()
+{
+    int32_t         bounds[] = {0, 100, EXTERNAL_SORT_ESTIMATE_DISORDER, 20};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 2048, 16, 4, 100, EXTERNAL_SORT_MAX_RAND, "myfile16.bin", "tmpsort16.bin");
+    test.useSink = 1;
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("Bound\tTime\tRuns\tCompares\tCopies\tViolations\tSorted\n");
+    for (int b = 0; b < 4; b++)
+    {
+        es.max_disorder = bounds[b];
+        if (0 != run_sort_test(&es, &test, &result))
+            return failures+1;
+
+        printf("%ld\t%lu\t%lu\t%lu\t%lu\t%lu\t%d\n", (long) es.max_disorder, result.duration, (unsigned long) result.metric.num_runs,
+            (unsigned long) result.metric.num_compar, (unsigned long) result.metric.num_memcpys, (unsigned long) result.metric.disorder_violations,
+            result.ok);
+        TEST_ASSERT(failures, result.ok);
+        if (20 == bounds[b])
+            TEST_ASSERT(failures, result.metric.disorder_violations > 0);
+        else
+        {
+            TEST_ASSERT(failures, 1 == result.metric.num_runs);
+            TEST_ASSERT(failures, 0 == result.metric.disorder_violations);
+        }
+    }
+    return failures;
+}
+
+/**
+ * Compares replacement selection with ascending sublists and with two-way sublists on sorted, reverse sorted, and random data.
+ * Reverse sorted data is one descending sublist with two-way sublists. Output is checked in the output file and in the output sink.
+ * Returns number of failed checks.
+ */
+int runalltests_two_way()
+{
+    int8_t          dataType[] = {0, 1, 2};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 1000 + 7, 8, 0, 0, EXTERNAL_SORT_MAX_RAND, "myfile17.bin", "tmpsort17.bin");   /* Last block is partial */
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("Data\tAlg\tTwoWay\tSink\tTime\tRuns\tReads\tWrites\tSorted\n");
+    for (int t = 0; t < 3; t++)
+    {
+        for (int a = 0; a < 4; a++)
+        {
+            es.run_gen_algorithm = a < 2 ? RUN_GEN_REPLACEMENT_SELECTION : RUN_GEN_REPLACEMENT_SELECTION_INDEX;
+            es.two_way_runs = a % 2;
+            for (int useSink = 0; useSink < 2; useSink++)
+            {
+                test.testDataType = dataType[t];
+                test.useSink = useSink;
+                if (0 != run_sort_test(&es, &test, &result))
+                    return failures+1;
+
+                printf("%d\t%d\t%d\t%d\t%lu\t%lu\t%lu\t%lu\t%d\n", dataType[t], es.run_gen_algorithm, es.two_way_runs, useSink, result.duration,
+                    (unsigned long) result.metric.num_runs, (unsigned long) result.metric.num_reads, (unsigned long) result.metric.num_writes,
+                    result.ok);
+                TEST_ASSERT(failures, result.ok);
+                if (0 == dataType[t] || (1 == dataType[t] && es.two_way_runs))
+                    TEST_ASSERT(failures, 1 == result.metric.num_runs);
+                if (1 == dataType[t] && !es.two_way_runs)
+                    TEST_ASSERT(failures, result.metric.num_runs > 1);
+            }
+        }
+    }
+    return failures;
+}
+
+/**
+ * Sorts 10% random data in 4096 byte pages with two-way sublists and a disorder bound of 50 records, which is less than a block.
+ * A new sublist may be needed again before the sublist started has a block written. Memory sizes are 2, 4, and 16 pages.
+ * Every record is output in order.
+ * Returns number of failed checks.
+ */
+int runalltests_two_way_disorder()
+{
+    int             memSizes[] = {2, 4, 16};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    init_sort_test(&test, 5000, 0, 3, 10, 0, "myfile17.bin", "tmpsort17.bin");
+    init_external_sort(&es, sizeof(test_record_t), 4096, test.numRecords);
+    es.two_way_runs = 1;
+    es.max_disorder = 50;
+
+    printf("Mem\tAlg\tRuns\tViolations\tRecords\tSorted\n");
+    for (int m = 0; m < 3; m++)
+    {
+        for (int a = 0; a < 2; a++)
+        {
+            es.run_gen_algorithm = 0 == a ? RUN_GEN_REPLACEMENT_SELECTION : RUN_GEN_REPLACEMENT_SELECTION_INDEX;
+            test.bufferPages = memSizes[m];
+            if (0 != run_sort_test(&es, &test, &result))
+                return failures+1;
+
+            printf("%d\t%d\t%lu\t%lu\t%ld\t%d\n", test.bufferPages, es.run_gen_algorithm, (unsigned long) result.metric.num_runs,
+                (unsigned long) result.metric.disorder_violations, (long) result.numRecords, result.ok);
+            TEST_ASSERT(failures, 0 == result.err);
+            TEST_ASSERT(failures, result.numRecords == test.numRecords);
+            TEST_ASSERT(failures, result.sorted);
+        }
+    }
+    return failures;
+}
+
+/**
+ * Compares run generation strategies on sorted, reverse sorted and random data with 8 buffer pages.
+ * The merge strategy is replacement selection with more than 2 buffer pages so it is run with 2 pages.
+ * Sorted data is one sublist for strategies other than load-sort-store, which writes a sublist for every buffer load.
+ * Returns number of failed checks.
+ */
+int runalltests_run_generation_strategies()
+{
+    int             buffer_max_pages = 8;
+    int8_t          dataType[] = {0, 1, 2};
+    int8_t          strategy[] = {RUN_GEN_REPLACEMENT_SELECTION, RUN_GEN_REPLACEMENT_SELECTION_INDEX, RUN_GEN_LOAD_SORT_STORE,
+                                  RUN_GEN_NATURAL_RUNS, RUN_GEN_MERGE};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 1000 + 7, buffer_max_pages, 0, 0, EXTERNAL_SORT_MAX_RAND, "myfile18.bin", "tmpsort18.bin");   /* Last block is partial */
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("Data\tAlg\tTime\tRuns\tReads\tWrites\tSorted\n");
+    for (int t = 0; t < 3; t++)
+    {
+        for (int a = 0; a < 5; a++)
+        {
+            es.run_gen_algorithm = strategy[a];
+            test.bufferPages = RUN_GEN_MERGE == strategy[a] ? 2 : buffer_max_pages;
+            test.testDataType = dataType[t];
+            if (0 != run_sort_test(&es, &test, &result))
+                return failures+1;
+
+            printf("%d\t%d\t%lu\t%lu\t%lu\t%lu\t%d\n", dataType[t], es.run_gen_algorithm, result.duration,
+                (unsigned long) result.metric.num_runs, (unsigned long) result.metric.num_reads, (unsigned long) result.metric.num_writes,
+                result.ok);
+            TEST_ASSERT(failures, result.ok);
+            if (0 == dataType[t] && RUN_GEN_LOAD_SORT_STORE != strategy[a])
+                TEST_ASSERT(failures, 1 == result.metric.num_runs);
+            if (RUN_GEN_LOAD_SORT_STORE == strategy[a])
+                TEST_ASSERT(failures, result.metric.num_runs == (es.num_pages + buffer_max_pages - 1) / buffer_max_pages);
+        }
+    }
+    return failures;
+}
+
+/**
+ * Sorts sorted, reverse sorted, random, and mostly sorted data with the input profile choosing the plan for 4, 8 and 32 buffer pages.
+ * Prints the profile, the plan, and predicted and actual sublists and I/Os. Sorted data is one sublist as predicted. The plan does
+ * not change the sort state of the caller. Blocks of the integer key are radix sorted and a key with many duplicates uses introsort.
+ * Returns number of failed checks.
+ */
+int runalltests_profile()
+{
+    int             memSizes[] = {4, 8, 32};
+    int8_t          dataType[] = {0, 1, 2, 3};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 1000 + 7, 0, 0, 10, EXTERNAL_SORT_MAX_RAND, "myfile19.bin", "tmpsort19.bin");   /* Last block is partial */
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+    es.profile_blocks = 4;
+    es.run_descending = 1;              /* Run state left by caller is not used by the profile */
+
+    printf("Data\tMem\tSorted%%\tRev%%\tDup%%\tBits\tAlg\tBlkSort\tFanIn\tPredRuns\tRuns\tPredIO\tIO\tSorted\n");
+    for (int t = 0; t < 4; t++)
+    {
+        for (int m = 0; m < 3; m++)
+        {
+            test.testDataType = dataType[t];
+            test.bufferPages = memSizes[m];
+            if (0 != run_sort_test(&es, &test, &result))
+                return failures+1;
+
+            metrics_t *metric = &result.metric;
+            printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%lu\t%lu\t%lu\t%lu\t%d\n", dataType[t], memSizes[m], metric->profile_sorted_pct,
+                metric->profile_reverse_pct, metric->profile_duplicate_pct, metric->profile_key_bits, metric->plan_run_gen,
+                metric->plan_in_memory_algorithm, metric->plan_fan_in, (unsigned long) metric->predicted_runs, (unsigned long) metric->num_runs,
+                (unsigned long) metric->predicted_io, (unsigned long) (metric->num_reads + metric->num_writes), result.ok);
+            TEST_ASSERT(failures, result.ok);
+            TEST_ASSERT(failures, !result.stateChanged);
+            if (0 == dataType[t])
+            {
+                TEST_ASSERT(failures, 100 == metric->profile_sorted_pct);
+                TEST_ASSERT(failures, 1 == metric->num_runs);
+                TEST_ASSERT(failures, 1 == metric->predicted_runs);
+            }
+            if (RUN_GEN_LOAD_SORT_STORE != metric->plan_run_gen)
+                TEST_ASSERT(failures, IN_MEMORY_SORT_RADIX_INT32 == metric->plan_in_memory_algorithm);
+        }
+    }
+
+    /* Key only ordered by compare_fcn with many duplicates is sorted with introsort */
+    es.key_type = KEY_TYPE_OTHER;
+    test.testDataType = 2;
+    test.bufferPages = 4;
+    test.numDistinct = 64;
+    if (0 != run_sort_test(&es, &test, &result))
+        return failures+1;
+    printf("Duplicates: %d%%  Alg: %d  BlkSort: %d  Sorted: %d\n", result.metric.profile_duplicate_pct, result.metric.plan_run_gen,
+        result.metric.plan_in_memory_algorithm, result.ok);
+    TEST_ASSERT(failures, result.ok);
+    TEST_ASSERT(failures, result.metric.profile_duplicate_pct >= PROFILE_DUPLICATE_PCT);
+    TEST_ASSERT(failures, IN_MEMORY_SORT_INTRO == result.metric.plan_in_memory_algorithm);
+    return failures;
+}
+
+/**
+ * Sorts batches that fit in 8 buffer pages with replacement selection, index replacement selection, and load-sort-store, with
+ * and without an output sink. Batches that end while filling the buffer are sorted in memory and written once or only sent to the sink.
+ * The heap of index replacement selection has 2 bytes per record so the largest batch does not fit in it.
+ * Returns number of failed checks.
+ */
+int runalltests_in_memory()
+{
+    int             buffer_max_pages = 8;
+    int8_t          strategy[] = {RUN_GEN_REPLACEMENT_SELECTION, RUN_GEN_REPLACEMENT_SELECTION_INDEX, RUN_GEN_LOAD_SORT_STORE};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    int32_t batchSizes[] = {1, values_per_page * 3 + 5, values_per_page * (buffer_max_pages-1) - 1};
+
+    printf("Records\tAlg\tSink\tRuns\tReads\tWrites\tMemcpys\tSorted\n");
+    for (int b = 0; b < 3; b++)
+    {
+        init_sort_test(&test, batchSizes[b], buffer_max_pages, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile20.bin", "tmpsort20.bin");
+        for (int a = 0; a < 3; a++)
+        {
+            for (int useSink = 0; useSink < 2; useSink++)
+            {
+                init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+                es.run_gen_algorithm = strategy[a];
+                test.useSink = useSink;
+                if (0 != run_sort_test(&es, &test, &result))
+                    return failures+1;
+
+                printf("%ld\t%d\t%d\t%lu\t%lu\t%lu\t%lu\t%d\n", (long) test.numRecords, es.run_gen_algorithm, useSink,
+                    (unsigned long) result.metric.num_runs, (unsigned long) result.metric.num_reads, (unsigned long) result.metric.num_writes,
+                    (unsigned long) result.metric.num_memcpys, result.ok);
+                TEST_ASSERT(failures, result.ok);
+                TEST_ASSERT(failures, 1 == result.metric.num_runs);
+                int32_t heapRecords = RUN_GEN_REPLACEMENT_SELECTION_INDEX == strategy[a]
+                                    ? (buffer_max_pages-1) * es.page_size / (es.record_size + 2) : (buffer_max_pages-1) * values_per_page;
+                if (test.numRecords <= heapRecords)
+                {
+                    TEST_ASSERT(failures, result.metric.num_reads == es.num_pages);
+                    TEST_ASSERT(failures, result.metric.num_writes == (useSink ? 0 : es.num_pages));
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+#if defined(ION_HOST_FILE)
+/* Simulated device totals of last sort of runalltests_sim_device() */
+static host_sim_device_t simDeviceAfterSort;
+
+static void save_sim_device(void)
+{
+    simDeviceAfterSort = host_sim_device;
+}
+
+/**
+ * Predicts SD card time of replacement selection and load-sort-store for memory sizes of 4, 8, and 16 pages using files on the
+ * simulated device. Prints predicted device time and the page reads, page writes, seeks, and erases it is made of.
+ * Returns number of failed checks.
+ */
+int runalltests_sim_device()
+{
+    int             memSizes[] = {4, 8, 16};
+    int8_t          strategy[] = {RUN_GEN_REPLACEMENT_SELECTION, RUN_GEN_LOAD_SORT_STORE};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 1000, 0, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile21.bin", "tmpsort21.bin");
+    test.beforeSort = host_sim_reset;
+    test.afterSort = save_sim_device;
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    host_set_backend(&host_sim_backend);
+    printf("Mem\tAlg\tDevice(ms)\tPageReads\tPageWrites\tSeeks\tErases\tSorted\n");
+    for (int m = 0; m < 3; m++)
+    {
+        for (int a = 0; a < 2; a++)
+        {
+            es.run_gen_algorithm = strategy[a];
+            test.bufferPages = memSizes[m];
+            if (0 != run_sort_test(&es, &test, &result))
+            {
+                host_set_backend(NULL);
+                return failures+1;
+            }
+
+            host_sim_device_t *device = &simDeviceAfterSort;
+            printf("%d\t%d\t%lu\t%lu\t%lu\t%lu\t%lu\t%d\n", test.bufferPages, es.run_gen_algorithm, (unsigned long) result.metric.deviceTime / 1000,
+                device->page_reads, device->page_writes, device->seeks, device->erases, result.ok);
+            TEST_ASSERT(failures, result.ok);
+            TEST_ASSERT(failures, result.metric.deviceTime > 0);
+            TEST_ASSERT(failures, device->page_reads >= result.metric.num_reads && device->page_writes >= result.metric.num_writes);
+        }
+    }
+    host_set_backend(NULL);
+    host_ram_remove("myfile21.bin");
+    host_ram_remove("tmpsort21.bin");
+    return failures;
+}
+#endif
+
+#if defined(ION_HOST_FILE)
+/**
+ * Sorts with input in a stdio file and the output file holding sublists in a stdio file or in RAM. RAM budgets are unlimited,
+ * half the input size, and 16 pages so later sublists spill to a stdio file. Only limited budgets spill.
+ * Returns number of failed checks.
+ */
+int runalltests_ram_file()
+{
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 4096, 8, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile22.bin", "tmpsort22.bin");
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    /* Budget -1 is a stdio output file */
+    long budgets[] = {-1, 0, (long) es.num_pages * es.page_size / 2, 16L * es.page_size};
+
+    printf("Output\tBudget\tTime\tSpilled(KB)\tSorted\n");
+    for (int b = 0; b < 4; b++)
+    {
+        host_ram_set_budget(budgets[b] > 0 ? (size_t) budgets[b] : 0);
+        test.outputBackend = budgets[b] < 0 ? &host_stdio_backend : &host_ram_backend;
+        unsigned long spilled = host_ram_spilled();
+        if (0 != run_sort_test(&es, &test, &result))
+        {
+            host_ram_set_budget(0);
+            return failures+1;
+        }
+        spilled = host_ram_spilled() - spilled;
+
+        printf("%s\t%ld\t%lu\t%lu\t%d\n", budgets[b] < 0 ? "file" : "ram", budgets[b] < 0 ? 0 : budgets[b], result.duration, spilled / 1024,
+            result.ok);
+        TEST_ASSERT(failures, result.ok);
+        TEST_ASSERT(failures, (budgets[b] > 0) == (spilled > 0));
+    }
+    host_ram_set_budget(0);
+    host_ram_remove("tmpsort22.bin");
+    return failures;
+}
+#endif
+
+#if defined(ION_HOST_FILE)
+/**
+ * Sorts with input and output files using stdio with a seek before each access, pread/pwrite, and pread/pwrite with O_DIRECT.
+ * Every backend does the same reads and writes.
+ * Returns number of failed checks.
+ */
+int runalltests_positional()
+{
+    const host_file_backend_t *backends[] = {&host_stdio_backend, &host_posix_backend, &host_direct_backend};
+    const char      *names[] = {"stdio", "pread", "direct"};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    uint32_t        reads = 0, writes = 0;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 4096, 8, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile23.bin", "tmpsort23.bin");
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("Backend\tTime\tReads\tWrites\tSorted\n");
+    for (int b = 0; b < 3; b++)
+    {
+        test.inputBackend = backends[b];
+        test.outputBackend = backends[b];
+        if (0 != run_sort_test(&es, &test, &result))
+            return failures+1;
+
+        printf("%s\t%lu\t%lu\t%lu\t%d\n", names[b], result.duration, (unsigned long) result.metric.num_reads, (unsigned long) result.metric.num_writes,
+            result.ok);
+        TEST_ASSERT(failures, result.ok);
+        if (b > 0)
+            TEST_ASSERT(failures, result.metric.num_reads == reads && result.metric.num_writes == writes);
+        reads = result.metric.num_reads;
+        writes = result.metric.num_writes;
+    }
+    return failures;
+}
+#endif
+
+#if defined(ION_HOST_FILE)
+/**
+ * Sorts input read with fread from a pread/pwrite file and copied from a mapped file, with sublists in a pread/pwrite file and in
+ * a mapped file. Sorted output of a mapped file is verified in place.
+ * Returns number of failed checks.
+ */
+int runalltests_mmap()
+{
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 4096, 8, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile24.bin", "tmpsort24.bin");
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("Input\tOutput\tTime\tSorted\n");
+    for (int t = 0; t < 4; t++)
+    {
+        int8_t mapInput = t & 1, mapOutput = t >> 1;
+
+        test.inputBackend = mapInput ? &host_mmap_backend : &host_posix_backend;
+        test.outputBackend = mapOutput ? &host_mmap_backend : &host_posix_backend;
+        test.mapInput = mapInput;
+        if (0 != run_sort_test(&es, &test, &result))
+            return failures+1;
+
+        printf("%s\t%s\t%lu\t%d\n", mapInput ? "mmap" : "fread", mapOutput ? "mmap" : "pwrite", result.duration,
+            result.ok && mapOutput == result.mappedOutput);
+        TEST_ASSERT(failures, result.ok);
+        TEST_ASSERT(failures, mapOutput == result.mappedOutput);
+    }
+    return failures;
+}
+#endif
+
+#if defined(ION_HOST_FILE)
+/* io_uring totals of last sort of runalltests_uring() */
+static host_uring_stats_t uringStatsAfterSort;
+
+static void save_uring_stats(void)
+{
+    uringStatsAfterSort = host_uring_stats;
+}
+
+/**
+ * Sorts with sublists in a pread/pwrite file and in an io_uring file with write-behind queues of 4 and 32 pages.
+ * The io_uring file writes all queued pages in one batch. Batches fall back to pwrite if io_uring is not available.
+ * Returns number of failed checks.
+ */
+int runalltests_uring()
+{
+    int16_t         queuePages[] = {4, 32};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 4096, 8, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile25.bin", "tmpsort25.bin");
+    test.beforeSort = host_uring_reset;
+    test.afterSort = save_uring_stats;
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+
+    printf("io_uring available: %d\n", host_uring_available());
+    printf("Backend\tQueuePages\tTime\tBatches\tQueueDepth\tFallbacks\tSorted\n");
+    for (int t = 0; t < 4; t++)
+    {
+        int8_t uring = t >> 1;
+
+        test.outputBackend = uring ? &host_uring_backend : &host_posix_backend;
+        test.writeBehindPages = queuePages[t & 1];
+        if (0 != run_sort_test(&es, &test, &result))
+            return failures+1;
+
+        host_uring_stats_t *stats = &uringStatsAfterSort;
+        printf("%s\t%d\t%lu\t%lu\t%.2f\t%lu\t%d\n", uring ? "uring" : "pwrite", test.writeBehindPages, result.duration, stats->batches,
+            stats->submissions > 0 ? (double) (stats->operations - stats->fallbacks) / stats->submissions : 0.0, stats->fallbacks, result.ok);
+        TEST_ASSERT(failures, result.ok);
+        TEST_ASSERT(failures, uring == (stats->batches > 0));
+        if (uring && host_uring_available())
+            TEST_ASSERT(failures, stats->max_depth > 1);
+    }
+    return failures;
+}
+#endif
+
+/* Specialized sort is only benchmarked on the host as the Arduino build runs the C tests */
+#if defined(__cplusplus) && !defined(ARDUINO)
+#include "no_output_buffer_sort_template.h"
+
+typedef no_output_buffer_sort::fixed_layout_t<test_record_t, no_output_buffer_sort::key_member_t<test_record_t>, 512> test_record_layout_t;
+
+/**
+ * Sorts as no_output_buffer_sort_replace_block() with the sort specialized for test_record_t and 512 byte pages. Takes the settings
+ * of es that are not fixed by the layout.
+ */
+static int specialized_sort(
+        int32_t (*blockIterator)(void *state, void *buffer, int32_t maxRecords),
+        void    *iteratorState,
+        void    *tupleBuffer,
+        ION_FILE *outputFile,
+        char    *buffer,
+        int     bufferSizeInBlocks,
+        external_sort_t *es,
+        long    *resultFilePtr,
+        metrics_t *metric,
+        int8_t  runGenOnly)
+{
+    test_record_layout_t layout;
+
+    memset(&layout, 0, sizeof(layout));
+    layout.num_pages = es->num_pages;
+    layout.run_gen_algorithm = es->run_gen_algorithm;
+    layout.key_type = es->key_type;
+    layout.output_sink = es->output_sink;
+    layout.output_sink_state = es->output_sink_state;
+    return no_output_buffer_sort::sort(blockIterator, iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks, &layout, resultFilePtr, metric, runGenOnly);
+}
+
+/**
+ * Compares sort time of the generic sort against the sort specialized at compile time for test_record_t and 512 byte pages.
+ * Memory sizes are 4 and 16 pages. Keys are random over EXTERNAL_SORT_MAX_RAND. Both sorts make the same comparisons and copies.
+ * Returns number of failed checks.
+ */
+int runalltests_specialized()
+{
+    int             memSizes[] = {4, 16};
+    external_sort_t es;
+    sort_test_t     test;
+    sort_test_result_t result;
+    uint32_t        compares = 0, copies = 0;
+    int             failures = 0;
+
+    int32_t values_per_page = (512 - BLOCK_HEADER_SIZE) / sizeof(test_record_t);
+    init_sort_test(&test, values_per_page * 4096, 0, 2, 0, EXTERNAL_SORT_MAX_RAND, "myfile14.bin", "tmpsort14.bin");
+    test.useSink = 1;
+    init_external_sort(&es, sizeof(test_record_t), 512, test.numRecords);
+    es.key_type = KEY_TYPE_OTHER;
+
+    printf("Mem\tSpecialized\tTime\tCompares\tCopies\tSorted\n");
+    for (int m = 0; m < 2; m++)
+    {
+        for (int specialized = 0; specialized <= 1; specialized++)
+        {
+            test.bufferPages = memSizes[m];
+            test.sort = specialized ? specialized_sort : NULL;
+            if (0 != run_sort_test(&es, &test, &result))
+                return failures+1;
+
+            printf("%d\t%d\t%lu\t%lu\t%lu\t%d\n", test.bufferPages, specialized, result.duration, (unsigned long) result.metric.num_compar,
+                (unsigned long) result.metric.num_memcpys, result.ok);
+            TEST_ASSERT(failures, result.ok);
+            if (specialized)
+                TEST_ASSERT(failures, result.metric.num_compar == compares && result.metric.num_memcpys == copies);
+            compares = result.metric.num_compar;
+            copies = result.metric.num_memcpys;
+        }
+    }
+    return failures;
+}
+#endif
+
+/**
+ * Runs every test that checks its results. Host file tests only run on the host.
+ * Returns number of failed checks.
+ */
+int runalltests()
+{
+    int failures = 0;
+
+    failures += runalltests_no_output_buffer_sort_block();
+    failures += runalltests_run_generation_merge();
+    failures += runalltests_in_memory_sort_block();
+    failures += runalltests_output_sink();
+    failures += runalltests_heap_arity();
+    failures += runalltests_key_prefix();
+    failures += runalltests_presorted();
+    failures += runalltests_bounded_disorder();
+    failures += runalltests_two_way();
+    failures += runalltests_two_way_disorder();
+    failures += runalltests_run_generation_strategies();
+    failures += runalltests_profile();
+    failures += runalltests_in_memory();
+    #if defined(ION_HOST_FILE)
+    failures += runalltests_prefetch();
+    failures += runalltests_write_behind();
+    failures += runalltests_sim_device();
+    failures += runalltests_ram_file();
+    failures += runalltests_positional();
+    failures += runalltests_mmap();
+    failures += runalltests_uring();
+    #endif
+    #if defined(__cplusplus) && !defined(ARDUINO)
+    failures += runalltests_specialized();
+    #endif
+
+    printf("Failed checks: %d\n", failures);
+    return failures;
 }